@@ -10,44 +10,66 @@
 #define	FUSE_USE_VERSION 26
 
 #include <fuse.h>
+#include <fuse_lowlevel.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <limits.h>
 #include <string.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#pragma push_macro("BLOCK_SIZE")	//linux/fs.h, which io_uring.h pulls in, has a BLOCK_SIZE of its own
+#undef BLOCK_SIZE
+#include <linux/io_uring.h>
+#undef BLOCK_SIZE
+#pragma pop_macro("BLOCK_SIZE")
+#include <pthread.h>
+#include <time.h>
 
-//size of a disk block
+//size of a disk block, a power of two from 512 to 65536. build with -DBLOCK_SIZE=4096 for blocks the size of a page
+#ifndef BLOCK_SIZE
 #define	BLOCK_SIZE 512
+#endif
+#if BLOCK_SIZE < 512 || BLOCK_SIZE > 65536 || (BLOCK_SIZE & (BLOCK_SIZE - 1)) != 0
+#error "BLOCK_SIZE has to be a power of two from 512 to 65536"
+#endif
 
 //we'll use 8.3 filenames
 #define	MAX_FILENAME 8
 #define	MAX_EXTENSION 3
 
-//How many files can there be in one directory?
-#define	MAX_FILES_IN_DIR (BLOCK_SIZE - (MAX_FILENAME + 1) - sizeof(int)) / \
-	((MAX_FILENAME + 1) + (MAX_EXTENSION + 1) + sizeof(size_t) + sizeof(long))
+//How many files fit in one record of .directories? A directory takes as many records as it needs
+#define	MAX_FILES_IN_DIR ((BLOCK_SIZE - (MAX_FILENAME + 1) - 2 * sizeof(int)) / \
+	((MAX_FILENAME + 1) + (MAX_EXTENSION + 1) + sizeof(size_t) + sizeof(long)))
 
-//Amount of total DISK_BLOCKS
-#define MAX_BLOCKS 10220
+//Amount of total DISK_BLOCKS in a .disk made before superblocks, 5 MB of 512 byte blocks with the bitmap in its last 1280 bytes
+#define LEGACY_BLOCKS 10220
 
 //How much data can one block hold?
 #define	MAX_DATA_IN_BLOCK BLOCK_SIZE
 
 //How many pointers in an inode?
-#define NUM_POINTERS_IN_INODE ((BLOCK_SIZE - sizeof(unsigned int) - sizeof(unsigned long)) / sizeof(unsigned long))
+#define NUM_POINTERS_IN_INODE ((BLOCK_SIZE - 2 * sizeof(unsigned int) - sizeof(unsigned long)) / sizeof(unsigned long))
 
 struct cs1550_directory_entry
 {
-	char dname[MAX_FILENAME	+ 1];	//the directory name (plus space for a nul)
-	int nFiles;			//How many files are in this directory. 
+	char dname[MAX_FILENAME	+ 1];	//the directory name (plus space for a nul), "" if the record only holds more files of a directory
+	int nFiles;			//How many files are in this record. 
 					//Needs to be less than MAX_FILES_IN_DIR
+	int nNextRecord;		//where the next record of files of this directory is in .directories, 0 if this is the last one
 
 	struct cs1550_file_directory
 	{
 		char fname[MAX_FILENAME + 1];	//filename (plus space for nul)
 		char fext[MAX_EXTENSION + 1];	//extension (plus space for nul)
 		size_t fsize;			//file size
-		long nStartBlock;		//where the first block is on disk
+		long nInodeBlock;		//where the inode of the file is on disk
 	} files[MAX_FILES_IN_DIR];		//There is an array of these
 };
 
@@ -62,713 +84,8462 @@ struct cs1550_disk_block
 
 typedef struct cs1550_disk_block cs1550_disk_block;
 
-struct bitmap	//bitmap to hold, total size in bytes = 10224 (4 + 10220), out of 10240(512 * 20) available because of block size being 512  
+//How many data blocks the inode points to itself, the last pointer is for the indirect block, or the double indirect one of a bigger file
+#define	DIRECT_POINTERS (NUM_POINTERS_IN_INODE - 1)
+#define	INDIRECT_POINTER (NUM_POINTERS_IN_INODE - 1)
+
+//How many pointers fit in an indirect block?
+#define	POINTERS_IN_INDIRECT (BLOCK_SIZE / sizeof(unsigned long))
+
+//Most data blocks a file can have, the direct ones and those in the indirect blocks the double indirect block points to
+#define	MAX_FILE_BLOCKS (DIRECT_POINTERS + POINTERS_IN_INDIRECT * POINTERS_IN_INDIRECT)
+
+//Whether the data pointer index is the first one in an indirect block, which the file has to be given before it
+#define	STARTS_INDIRECT(index) ((index) >= DIRECT_POINTERS && ((index) - DIRECT_POINTERS) % POINTERS_IN_INDIRECT == 0)
+
+//How many indirect blocks a file with blocks data pointers has, not counting the double indirect one
+#define	INDIRECT_BLOCKS(blocks) ((long) (blocks) <= (long) DIRECT_POINTERS ? 0L : ((long) (blocks) - (long) DIRECT_POINTERS - 1) / (long) POINTERS_IN_INDIRECT + 1)
+
+//Whether a file with blocks data pointers has more than fit in the inode and one indirect block, the last pointer of the inode is then the double indirect block, whose first pointer is the indirect block it was before
+#define	NEEDS_DOUBLE_INDIRECT(blocks) ((long) (blocks) > (long) (DIRECT_POINTERS + POINTERS_IN_INDIRECT))
+
+//What a data pointer holds where the file has a hole, no block is given to it and it reads as zeros
+#define	HOLE_BLOCK (-1L)
+
+//How many data blocks -o compress compresses together, 16 KB worth but at least 2 so a chunk can save a block
+#define	CHUNK_BLOCKS (BLOCK_SIZE < 8192 ? 16384 / BLOCK_SIZE : 2)
+#define	CHUNK_SIZE (CHUNK_BLOCKS * BLOCK_SIZE)
+
+//A compressed chunk keeps its data in the blocks its first pointers point to, the next pointer is this with the length of the data in the low bits and the rest are holes
+#define	COMPRESSED_CHUNK (1L << 62)
+#define	IS_COMPRESSED_CHUNK(block) ((block) != HOLE_BLOCK && ((block) & COMPRESSED_CHUNK) != 0)
+
+//Set in the flags of an inode once a chunk of the file was compressed, files without it have no COMPRESSED_CHUNK pointer to look for
+#define	INODE_COMPRESSED 1
+
+//Set when the data of the file is in the inode itself where the pointers would be, it has no data pointer and the bytes past its size are zeros
+#define	INODE_INLINE 2
+
+//Most bytes of data an inode can hold, all of its pointers
+#define	INLINE_BYTES (NUM_POINTERS_IN_INODE * sizeof(unsigned long))
+
+//How many slots the table lz_compress() finds repeats with has, as a power of two
+#define	LZ_HASH_BITS 12
+
+//How many slots the index of -o dedup starts with, it grows once three quarters of them are used
+#define	DEDUP_INDEX_START_SIZE 1024
+
+//How many chains the table of inode owners starts with, it doubles once it holds more owners than that
+#define	OWNER_TABLE_START_SIZE 64
+
+//How many slots a block_table that grows starts with, it doubles once three quarters of them are used
+#define	BLOCK_TABLE_START_SIZE 64
+
+//Most whole blocks -o dedup holds back from a write to send to .disk with one call
+#define	DEDUP_RUN_BLOCKS 64
+
+struct cs1550_inode	//one block per file that says where each of its data blocks is
+{
+	unsigned int nBlocks;	//how many data pointers the file has, holes included, the blocks past them up to size are holes too
+	unsigned int flags;	//INODE_COMPRESSED and INODE_INLINE, how the data of the file is kept
+	unsigned long size;	//file size
+	unsigned long pointers[NUM_POINTERS_IN_INODE];	//block numbers of the data blocks in file order, the last one is the indirect (or double indirect) block
+};
+
+typedef struct cs1550_inode cs1550_inode;
+
+struct cs1550_indirect_block	//block numbers of the data blocks that do not fit in the inode, or of the indirect blocks that hold them
+{
+	unsigned long pointers[POINTERS_IN_INDIRECT];
+};
+
+typedef struct cs1550_indirect_block cs1550_indirect_block;
+
+struct cs1550_file_map	//a file's inode, its double indirect block and the indirect block last used, the data pointers in other indirect blocks are read in when asked for
+{
+	long nInodeBlock;	//where the inode is on disk
+	cs1550_inode inode;
+	cs1550_indirect_block indirect;	//the indirect_index-th indirect block, the first one is filled in when inode.nBlocks > DIRECT_POINTERS
+	long indirect_index;	//which indirect block is in indirect, -1 for none
+	long indirect_block;	//where it is on disk
+	int indirect_dirty;	//set when indirect has to be written back
+	cs1550_indirect_block double_indirect;	//only filled in when NEEDS_DOUBLE_INDIRECT(inode.nBlocks)
+	int double_dirty;	//set when double_indirect has to be written back
+	int error;	//-EIO once an indirect block could not be read or written back, the map must not be stored then
+};
+
+typedef struct cs1550_file_map cs1550_file_map;
+
+//What the first 8 bytes of a .disk made by mkfs say, "cs1550fs"
+#define SUPERBLOCK_MAGIC 0x7366303535317363ULL
+
+//Layout of the superblock and of what it describes
+#define SUPERBLOCK_VERSION 1
+
+struct cs1550_superblock	//block 0 of a .disk made by mkfs, a .disk without one has the legacy layout of LEGACY_BLOCKS
+{
+	uint64_t magic;	//SUPERBLOCK_MAGIC
+	uint32_t version;	//SUPERBLOCK_VERSION
+	uint32_t block_size;	//bytes per block, has to be the BLOCK_SIZE this was built with
+	uint64_t block_count;	//how many blocks there are, block 0 is this one and always in use
+	uint64_t bitmap_offset;	//where the free space bitmap is in .disk, right after the last block
+	uint64_t bitmap_words;	//how many 64 bit words the bitmap has, the bits past block_count are kept set
+	uint32_t directory_record_size;	//bytes per record of the directory table, it depends on the block size
+	char directory_file[20];	//name of the file holding the directory table, next to .disk
+	uint64_t checksum;	//FNV-1a hash of everything above
+};
+
+typedef struct cs1550_superblock cs1550_superblock;
+
+static long block_count = LEGACY_BLOCKS;	//how many blocks .disk has, from its superblock
+static long bitmap_words = (LEGACY_BLOCKS + 63) / 64;	//how many 64 bit words the free space bitmap has, one bit per block
+static char directory_file[20] = ".directories";	//where the directory table is, from the superblock
+static uint64_t *free_space = NULL;	//free space bitmap, a set bit means the block is in use. a copy loaded at mount, sync_bitmap() writes it back
+static long free_block_count = 0;	//how many blocks free_space says are free
+static int free_space_dirty = 0;	//set when free_space differs from the copy in .disk
+struct block_entry	//one slot of a block_table
+{
+	long block;	//-1 if the slot is empty
+	long value;
+};
+
+typedef struct block_entry block_entry;
+
+struct block_table	//open addressing hash table from blocks of .disk to a value each, for what only a few of them have so it does not grow with .disk
+{
+	block_entry *slots;
+	long size;	//how many slots there are, a power of two
+	long used;	//how many are not empty
+};
+
+typedef struct block_table block_table;
+
+static block_table block_shares = { NULL, 0, 0 };	//how many data pointers besides the first point at each block that has more than one, nothing on disk says so and it is counted at mount
+static long shared_block_count = 0;	//how many blocks have a share, no write has to copy a block first while it is 0
+
+struct dedup_entry	//one slot of dedup_index
 {
-	unsigned char tracker[ 20 * MAX_DATA_IN_BLOCK - 20 ];	//512 * 20 - 20= 10220 total blocks able to be track
+	uint64_t fingerprint;	//of the data the block held when it was indexed
+	long block;	//-1 if the slot is empty
 };
 
-typedef struct bitmap bitmap;	//bit map will be written to the end of the .disk file
+typedef struct dedup_entry dedup_entry;
+
+static dedup_entry *dedup_index = NULL;	//open addressing hash index of the whole blocks -o dedup wrote, by fingerprint, NULL without it
+static long dedup_index_size = 0;	//how many slots dedup_index has
+static long dedup_index_used = 0;	//how many of them are not empty, stale ones too
+static block_table block_fingerprints = { NULL, 0, 0 };	//fingerprint each block the dedup index holds is indexed under, a slot of the index whose block has another one or none is stale
+static char zero_block[BLOCK_SIZE];	//what a hole reads as, written where a new block has to read as zeros
 
 struct meta_entry	//holds a cs1550_directory_entry with some metadata to help the file functions
 {
 	int file_index;	//this is the file index that is set and -1 if not a file or file not found
 	int index_of_directory;	//tells what index the directory is at and -1 if directory is not found
 	int slash_count;	//if slash count is greater than 1 than not under root
+	int locked;	//which lock find_correct_directory() took on the directory, NO_LOCK if none
+};
+
+typedef struct meta_entry meta_entry;
+
+//How find_correct_directory() should lock what it finds
+#define NO_LOCK 0
+#define READ_LOCK 1
+#define WRITE_LOCK 2
+
+//Longest path that can name anything, "/" directory "/" filename "." extension
+#define MAX_PATH_LENGTH (1 + MAX_FILENAME + 1 + MAX_FILENAME + 1 + MAX_EXTENSION)
+
+//How many paths the path cache remembers, a power of two
+#define PATH_CACHE_SIZE 1024
+
+struct path_cache_entry	//what one path resolved to, positive or not
+{
+	char path[MAX_PATH_LENGTH + 1];	//"" if the slot is empty
+	meta_entry attribute;	//index_of_directory and file_index are -1 for what does not exist
+	long size;	//size of the file, 0 for anything else
+};
+
+typedef struct path_cache_entry path_cache_entry;
+
+static path_cache_entry path_cache[PATH_CACHE_SIZE];	//direct mapped by the hash of the path, so a lookup is one probe
+static pthread_mutex_t path_cache_lock = PTHREAD_MUTEX_INITIALIZER;	//guards path_cache, entries only change while what they name is locked for writing
+
+//How many slots the directory name index starts with, always a power of two
+#define DIRECTORY_INDEX_START_SIZE 64
+
+//How many slots the file name index of a directory starts with, always a power of two
+#define FILE_INDEX_START_SIZE 32
+
+static cs1550_directory_entry *directory_table = NULL;	//every record of .directories, loaded once at mount and kept in sync by every write
+static int directory_count = 0;	//how many records are in directory_table, directories and the records holding their extra files
+static int directory_capacity = 0;	//how many records directory_table can hold before it has to grow
+static int *directory_index = NULL;	//open addressing hash index of directory names, each slot holds an index into directory_table or -1 if empty
+static int directory_index_size = 0;	//how many slots directory_index has
+
+struct directory_contents	//where the files of one directory are, built at mount from its chain of records
+{
+	int *records;	//index in directory_table of each record of the directory, in chain order
+	int record_count;	//how many records the directory has
+	int nFiles;	//how many files are in all of its records, file i is in record i / MAX_FILES_IN_DIR of the chain
+	int *index;	//open addressing hash index of filename.extension, each slot holds a file index or -1 if empty
+	int index_size;	//how many slots index has
+};
+
+typedef struct directory_contents directory_contents;
+
+static directory_contents *contents_of = NULL;	//one per record of directory_table, only used for the records that start a directory
+static int contents_count = 0;	//how many are in contents_of
+
+struct inode_owner	//which file an inode block belongs to, so a file can be found from its inode number without its path, kept only while something holds the file
+{
+	long block;	//the inode block
+	struct inode_owner *next;	//in the same chain of owner_table
+	int index_of_directory;	//-1 if the file is not linked anymore
+	int file_index;
+	unsigned long lookups;	//how many lookups of the file the kernel holds in -o lowlevel mode
+	unsigned long opens;	//how many open_files there are of the file
+	int orphaned;	//set when the file was unlinked while the kernel held lookups or it was open, its blocks are freed at the last forget or release
+	unsigned long map_version;	//bumped each time the inode is written, so an open file can tell its copy of the map is stale
+	struct open_file *pending;	//the open holding data appended to the file that has no blocks yet, NULL if there is none
+};
+
+typedef struct inode_owner inode_owner;
+
+static inode_owner **owner_table = NULL;	//chained hash table of the owners of the files the kernel holds lookups of, that are open or that are orphaned, by inode block, made at mount
+static long owner_table_size = 0;	//how many chains owner_table has, a power of two
+static long owner_count = 0;	//how many owners are in owner_table
+static pthread_mutex_t owner_lock = PTHREAD_MUTEX_INITIALIZER;	//guards owner_table, no other lock is taken while it is held. an owner only changes while its directory is locked for writing
+static pthread_mutex_t orphan_lock = PTHREAD_MUTEX_INITIALIZER;	//held instead of a directory lock while reading or writing an orphaned file
+
+//Inode numbers in -o lowlevel mode: root is 1, a directory is twice its index in directory_table + 2 and a file is twice its inode block + 3
+#define DIRECTORY_INO(index) (((fuse_ino_t) (index) + 1) << 1)
+#define FILE_INO(block) ((((fuse_ino_t) (block) + 1) << 1) | 1)
+#define INO_IS_FILE(ino) ((ino) & 1)
+#define INO_INDEX(ino) ((long) ((ino) >> 1) - 1)	//directory index or inode block the number is made from
+
+//How many seconds the kernel may keep names and attributes it was given in -o lowlevel mode, nothing changes them behind its back
+#define LOWLEVEL_TIMEOUT 60.0
+
+//Lock order is directory_table_lock, then one directory lock, then allocator_lock
+static pthread_rwlock_t directory_table_lock = PTHREAD_RWLOCK_INITIALIZER;	//held for reading while using directory_table, for writing only while mkdir grows it
+static pthread_rwlock_t **directory_locks = NULL;	//one lock per directory guarding its records, its contents_of, its files and their inodes
+static int directory_lock_count = 0;	//how many locks are in directory_locks
+static pthread_mutex_t allocator_lock = PTHREAD_MUTEX_INITIALIZER;	//guards free_space, free_block_count, block_shares and the dedup index
+
+static int disk_fd = -1;	//.disk, opened once at mount and closed at unmount
+static int directory_fd = -1;	//.directories, opened once at mount and closed at unmount
+static off_t bitmap_offset = 0;	//where the bitmap starts in .disk, from the superblock or bitmap_words words before the end
+
+static char *disk_map = NULL;	//all of .disk when mounted with -o mmap, NULL otherwise
+static off_t disk_size = 0;	//how many bytes .disk has
+
+//How many requests each thread's io_uring holds when -o io_depth is not given
+#define IO_DEFAULT_DEPTH 64
+
+//Most requests -o io_depth can give an io_uring
+#define IO_MAX_DEPTH 4096
+
+//Most runs of blocks one batch of reads or writes holds
+#define IO_BATCH_RUNS 64
+
+struct io_request	//buffers read from (or written to) one place of a file one after another, the requests of a batch go to the kernel together
+{
+	int fd;
+	struct iovec *vector;	//used up by the request
+	int count;	//how many buffers are in vector
+	off_t offset;
+	int writing;	//set for a write
+	int res;	//0 or -EIO once the batch is done
+};
+
+typedef struct io_request io_request;
+
+struct disk_span	//bytes of .disk one read (or write) copies to (or from) data, the spans of one call go to the disk together
+{
+	char *data;
+	size_t size;
+	off_t offset;
+};
+
+typedef struct disk_span disk_span;
+
+struct block_run	//blocks in a row on disk
+{
+	long block;	//first block of .disk
+	long count;	//how many blocks
+};
+
+typedef struct block_run block_run;
+
+struct io_ring	//the io_uring of one thread, the rings are mapped from the kernel and only that thread touches them
+{
+	int fd;	//from io_uring_setup
+	unsigned int entries;	//how many requests can be in flight
+	unsigned int *sq_head;	//submissions the kernel has taken
+	unsigned int *sq_tail;	//submissions the thread has put in
+	unsigned int *sq_mask;
+	unsigned int *sq_array;	//entry of sqes each submission is in
+	struct io_uring_sqe *sqes;
+	unsigned int *cq_head;	//completions the thread has taken
+	unsigned int *cq_tail;	//completions the kernel has put in
+	unsigned int *cq_mask;
+	struct io_uring_cqe *cqes;
+	void *sq_ring;	//the mappings the fields above point into, MAP_FAILED if not mapped
+	size_t sq_ring_size;
+	void *cq_ring;
+	size_t cq_ring_size;
+	size_t sqes_size;
+};
+
+typedef struct io_ring io_ring;
+
+static unsigned int io_depth = 0;	//how many requests each thread's io_uring holds, 0 when batches go out one preadv or pwritev at a time
+static __thread io_ring *my_ring = NULL;	//the io_uring of this thread, NULL until it sends a batch
+static __thread int my_ring_failed = 0;	//set when this thread could not make one, its batches go out one request at a time
+static pthread_key_t ring_key;	//its destructor closes the io_uring of a thread that exits
+static pthread_once_t ring_key_once = PTHREAD_ONCE_INIT;
+
+//How many blocks the cache holds when -o cache_blocks is not given (512 KB of 512 byte blocks)
+#define CACHE_DEFAULT_BLOCKS 1024
+
+//How many seconds dirty blocks can sit in the cache before the write back thread writes them
+#define CACHE_FLUSH_SECONDS 5
+
+//Most blocks read or written with one preadv or pwritev when the cache fills or writes back a run (128 KB of 512 byte blocks, a whole big write)
+#define CACHE_RUN_BLOCKS 256
+
+//Fewest slots the cache has while there is a journal, the inodes, indirect blocks and records a transaction changed stay in it until .journal has them
+#define JOURNAL_CACHE_BLOCKS 64
+
+//What a record of .directories is cached under, blocks of .disk are cached under their number and -1 is an empty slot
+#define RECORD_KEY(index) (-2 - (long) (index))
+#define KEY_RECORD(key) (-2 - (key))
+
+//The writing cache_io() is given for a change the transaction of this thread pins in the cache
+#define WRITE_PINNED 2
+
+struct cache_block	//one block of .disk, or record of .directories, held in memory
+{
+	long block;	//which block of .disk this is, RECORD_KEY() of a record, -1 if the slot is empty
+	int dirty;	//set when data is newer than what is in .disk
+	int newer;	//slot used right after this one, -1 if this is the most recently used
+	int older;	//slot used right before this one, -1 if this is the least recently used
+	int prefetched;	//set when readahead filled the slot and no read has used it yet
+	int pins;	//how many transactions changed it and have not committed, it is neither written back nor evicted until they have
+	long lsn;	//.journal has to be durable up to this before the slot is written back, 0 if it does not wait
+	union	//a record is a little bigger than a block
+	{
+		cs1550_disk_block data;
+		cs1550_directory_entry record;
+	};
+};
+
+typedef struct cache_block cache_block;
+
+static cache_block *cache = NULL;	//the block cache, NULL when mounted with -o mmap or -o cache_blocks=0 and there is no journal
+static int cache_data = 0;	//set when file data goes through the cache too, otherwise it only holds what the journal has to keep from .disk and .directories until it is durable
+static int cache_size = 0;	//how many slots cache has
+static block_table cache_slot_of = { NULL, 0, 0 };	//slot of cache each cached block of .disk is in, twice as many slots as cache so it never grows
+static int cache_newest = -1;	//most recently used slot
+static int cache_oldest = -1;	//least recently used slot, the next one to be evicted
+static int cache_dirty_count = 0;	//how many slots are dirty
+static struct iovec *cache_run = NULL;	//data of the slots going to .disk in one batch, one per slot
+static int *cache_run_slots = NULL;	//slot each block of cache_run is in
+static io_request cache_batch[IO_BATCH_RUNS];	//the runs of cache_run being written back
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;	//guards everything above, no other lock is taken while it is held
+static pthread_cond_t cache_writer_wake = PTHREAD_COND_INITIALIZER;	//signaled at unmount to stop the write back thread
+static pthread_t cache_writer_thread;
+static int cache_writer_running = 0;	//set while the write back thread should keep going
+
+//How many blocks readahead fetches at most ahead of a sequential reader when -o readahead_blocks is not given (128 KB of 512 byte blocks)
+#define READAHEAD_DEFAULT_BLOCKS 256
+
+//How many blocks the first readahead of a sequential reader fetches, the window doubles from here
+#define READAHEAD_MIN_BLOCKS 8
+
+//How many runs of blocks can wait for the readahead thread, more are dropped
+#define READAHEAD_QUEUE_SIZE 64
+
+//How many bytes of appends can wait in memory for their blocks, across every open file, when -o delalloc_bytes is not given
+#define DELALLOC_DEFAULT_BYTES (4 * 1024 * 1024)
+
+struct open_file	//what open keeps in fi->fh for one open of a file
+{
+	pthread_mutex_t lock;	//guards the readahead state below, reads through the same open can run side by side
+	off_t next_offset;	//where the next read starts if it carries on from the last one
+	long window;	//how many blocks readahead keeps ahead of the reader, 0 until reads are sequential
+	long ahead;	//block of the file readahead has queued up to, not including it
+	char *pending;	//data appended through this open that has no blocks yet, it goes right after fsize. guarded by the lock of the file's directory
+	size_t pending_size;	//how many bytes of pending are used
+	size_t pending_capacity;	//how many bytes pending can hold
+	long inode;	//inode block of the file, it stays the same while the file is open, even after unlink, -1 for /.stats
+	cs1550_file_map map;	//the inode and indirect blocks of the file as of map_version, guarded by lock
+	unsigned long map_version;	//version of the inode map is a copy of, 0 if there is no copy yet
+	char *stats;	//what /.stats said when it was opened, NULL for any other file
+	size_t stats_size;	//how many bytes of it there are
+};
+
+typedef struct open_file open_file;
+
+static block_run readahead_queue[READAHEAD_QUEUE_SIZE];	//runs waiting for the readahead thread, a ring
+static int readahead_head = 0;	//next run the thread takes
+static int readahead_queued = 0;	//how many runs are in readahead_queue
+static long readahead_limit = 0;	//largest window, 0 when there is no readahead
+static pthread_mutex_t readahead_lock = PTHREAD_MUTEX_INITIALIZER;	//guards the queue and readahead_running, no other lock is taken while it is held
+static pthread_cond_t readahead_wake = PTHREAD_COND_INITIALIZER;	//signaled when a run is queued and at unmount
+static pthread_t readahead_thread;
+static int readahead_running = 0;	//set while the readahead thread should keep going
+static size_t pending_total = 0;	//bytes held in the pending data of every open file, guarded by owner_lock
+
+//Handlers /.stats times, -o lowlevel counts each of its handlers with the path one it matches
+#define OP_GETATTR 0
+#define OP_READDIR 1
+#define OP_MKDIR 2
+#define OP_RMDIR 3
+#define OP_READ 4
+#define OP_WRITE 5
+#define OP_MKNOD 6
+#define OP_UNLINK 7
+#define OP_TRUNCATE 8
+#define OP_OPEN 9
+#define OP_FLUSH 10
+#define OP_RELEASE 11
+#define OP_FSYNC 12
+#define OP_LOOKUP 13
+#define OP_CREATE 14
+#define OP_SETATTR 15	//-o lowlevel setattr that does not change the size, one that does counts as truncate
+#define OP_COUNT 16
+
+static const char *op_names[OP_COUNT] = { "getattr", "readdir", "mkdir", "rmdir", "read", "write", "mknod", "unlink", "truncate", "open", "flush", "release", "fsync", "lookup", "create", "setattr" };
+
+//What /.stats counts inside the handlers
+#define COUNT_BITMAP_SCANS 0	//scan_bitmap() calls
+#define COUNT_BITMAP_WORDS 1	//bitmap words those looked at
+#define COUNT_BLOCKS_ALLOCATED 2
+#define COUNT_BLOCKS_FREED 3
+#define COUNT_DIRECTORY_LOOKUPS 4	//locate_directory() calls
+#define COUNT_DIRECTORY_PROBES 5	//directory index slots those looked at
+#define COUNT_FILE_LOOKUPS 6	//locate_file() calls
+#define COUNT_FILE_PROBES 7	//file index slots those looked at
+#define COUNT_PATH_CACHE_HITS 8
+#define COUNT_PATH_CACHE_MISSES 9
+#define COUNT_CACHE_HITS 10	//blocks a read or write found in the block cache
+#define COUNT_CACHE_MISSES 11	//blocks it had to read from .disk first
+#define COUNT_READAHEAD_FETCHED 12	//blocks readahead put in the cache
+#define COUNT_READAHEAD_HITS 13	//of those, how many a read then used
+#define COUNT_READAHEAD_WASTED 14	//of those, how many left the cache, or were still in it at unmount, without being read
+#define COUNT_BYTES_READ 15	//bytes of .disk file data was read from, a compressed chunk counts what it takes on disk
+#define COUNT_BYTES_WRITTEN 16	//bytes of .disk file data was written to
+#define COUNT_JOURNAL_COMMITS 17	//transactions written to .journal
+#define COUNT_JOURNAL_SYNCS 18	//fdatasyncs of .journal
+#define COUNT_CHUNKS_COMPRESSED 19	//chunks -o compress stored compressed
+#define COUNT_CHUNKS_INCOMPRESSIBLE 20	//chunks it left raw because they would not save a block
+#define COUNT_CHUNKS_EXPANDED 21	//compressed chunks stored raw again so a write or truncate could change them
+#define COUNT_BLOCKS_DEDUPED 22	//whole blocks -o dedup pointed at a block already holding their data instead of writing
+#define COUNT_BLOCKS_COPIED 23	//shared blocks a write or truncate gave the file its own copy of
+#define COUNT_IO_BATCHES 24	//batches of reads or writes sent through an io_uring together
+#define COUNT_IO_REQUESTS 25	//requests in those, over io_batches it is how deep the queue got
+#define COUNTER_COUNT 26
+
+static const char *counter_names[COUNTER_COUNT] = { "bitmap_scans", "bitmap_words", "blocks_allocated", "blocks_freed", "directory_lookups", "directory_probes",
+	"file_lookups", "file_probes", "path_cache_hits", "path_cache_misses", "cache_hits", "cache_misses", "readahead_fetched", "readahead_hits",
+	"readahead_wasted", "bytes_read", "bytes_written", "journal_commits", "journal_syncs", "chunks_compressed", "chunks_incompressible", "chunks_expanded",
+	"blocks_deduped", "blocks_copied_on_write", "io_batches", "io_requests" };
+
+//How many latency buckets each handler has, bucket n counts the calls that took under 2^n ns, the last one also the slower ones
+#define LATENCY_BUCKETS 32
+
+//How big the text of /.stats can get
+#define STATS_TEXT_SIZE 32768
+
+//The file that shows them, truncating it starts them over
+#define STATS_PATH "/.stats"
+
+//Its inode number with -o lowlevel, past what any file of .disk can have
+#define STATS_INO ((fuse_ino_t) -1)
+
+struct thread_stats	//what the handlers on one thread counted, only that thread adds to it
+{
+	uint64_t calls[OP_COUNT];
+	uint64_t ns[OP_COUNT];	//time spent in each handler
+	uint64_t latency[OP_COUNT][LATENCY_BUCKETS];
+	uint64_t counters[COUNTER_COUNT];
+	struct thread_stats *next;	//in stats_threads
+};
+
+typedef struct thread_stats thread_stats;
+
+static __thread thread_stats *my_stats = NULL;	//the stats of this thread, NULL until it counts something
+static thread_stats *stats_threads = NULL;	//the stats of every thread that counted something and is still running
+static thread_stats stats_retired;	//what the threads that exited counted
+static thread_stats stats_baseline;	//the totals at the last truncate of /.stats, it shows what was counted since
+static pthread_key_t stats_key;	//its destructor folds the stats of a thread that exits into stats_retired
+static pthread_once_t stats_key_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;	//guards the list, stats_retired and stats_baseline, no other lock is taken while it is held
+
+//How many bytes .journal can hold before it is checkpointed and starts over
+#define JOURNAL_SIZE (1024 * 1024)
+
+//Where the first transaction starts in .journal, the header is alone in the first block
+#define JOURNAL_START BLOCK_SIZE
+
+//Most bytes of ranges and their data one transaction can hold
+#define JOURNAL_BUFFER_SIZE 16384
+
+//Most ranges one transaction can hold, a transaction with more (an unlink of a big file can free blocks in many bitmap words) is not logged and its commit checkpoints instead
+#define JOURNAL_MAX_RANGES 200
+
+#define JOURNAL_MAGIC 0x6373313535304a4eULL
+
+//Which file a journal range is in
+#define JOURNAL_DISK 0
+#define JOURNAL_DIRECTORIES 1
+
+struct journal_header	//first block of .journal, only transactions with this sequence are replayed
+{
+	uint64_t magic;
+	uint64_t sequence;
+};
+
+typedef struct journal_header journal_header;
+
+struct journal_transaction	//put in .journal before the ranges of one transaction
+{
+	uint64_t magic;
+	uint64_t sequence;
+	uint32_t count;	//how many ranges follow
+	uint32_t length;	//how many bytes of ranges and data follow
+	uint64_t checksum;	//of the bytes that follow, a torn transaction does not match and ends the replay
+};
+
+typedef struct journal_transaction journal_transaction;
+
+struct journal_range	//put in .journal before the new contents of one range
+{
+	uint32_t target;	//JOURNAL_DISK or JOURNAL_DIRECTORIES
+	uint32_t length;
+	uint64_t offset;
 };
 
-typedef struct meta_entry meta_entry;
+typedef struct journal_range journal_range;
+
+struct cs1550_transaction	//the metadata ranges one handler changed, their contents are taken when it commits
+{
+	int count;	//how many ranges are in ranges
+	int overflow;	//set when a range did not fit, the commit checkpoints instead
+	size_t bytes;	//how many bytes the ranges and their headers will take in .journal
+	journal_range ranges[JOURNAL_MAX_RANGES];
+};
+
+typedef struct cs1550_transaction cs1550_transaction;
+
+static __thread cs1550_transaction *transaction = NULL;	//the transaction the handler on this thread is building, NULL if there is none
+static int journal_fd = -1;	//.journal, -1 if it could not be opened and every handler syncs the bitmap itself
+static uint64_t journal_sequence = 0;	//sequence of the transactions in .journal now
+static off_t journal_tail = JOURNAL_START;	//where the next transaction goes in .journal
+static long journal_lsn = 0;	//how many bytes of transactions have been written to .journal since mount
+static long journal_synced = 0;	//how many of those are known to be durable, moved with atomics since sync_journal() does it without journal_lock
+static int journal_syncing = 0;	//set while a thread is in fdatasync for the others
+static int journal_open = 0;	//how many transactions have begun and not yet committed
+static int journal_draining = 0;	//how many checkpoints are waiting for journal_open to reach 0, no transaction begins meanwhile
+static char journal_buffer[JOURNAL_BUFFER_SIZE];	//one transaction on its way to or from .journal
+static pthread_mutex_t journal_lock = PTHREAD_MUTEX_INITIALIZER;	//guards everything above but transaction, taken after the directory locks and before the allocator lock
+static pthread_cond_t journal_synced_cond = PTHREAD_COND_INITIALIZER;	//broadcast when journal_synced moves
+static pthread_cond_t journal_idle_cond = PTHREAD_COND_INITIALIZER;	//broadcast when journal_open or journal_draining drops
+
+struct cs1550_config	//options given with -o when mounting
+{
+	int use_mmap;	//-o mmap maps .disk instead of using pread and pwrite, .directories and the bitmap are always read into memory so nothing reaches them before .journal has it
+	unsigned int cache_blocks;	//-o cache_blocks=N is how many blocks the cache holds, 0 turns it off
+	int lowlevel;	//-o lowlevel serves the kernel by inode number through fuse_lowlevel_ops
+	unsigned int readahead_blocks;	//-o readahead_blocks=N caps how far ahead of a sequential reader the cache is filled, 0 turns it off
+	unsigned int delalloc_bytes;	//-o delalloc_bytes=N is how many bytes of appends can wait in memory for blocks, 0 gives every write its blocks right away
+	int compress;	//-o compress stores the chunks a write touches compressed when they shrink by a block, compressed files are read either way
+	int dedup;	//-o dedup points whole blocks written at a block that already holds the same data, shared blocks are copied on write either way
+	unsigned int inline_bytes;	//-o inline_bytes=N keeps files of up to N bytes (INLINE_BYTES at most) in their inode with no data block, 0 turns it off
+	unsigned int io_depth;	//-o io_depth=N is how many reads and writes of a batch each thread keeps in flight in its io_uring, 0 sends them one preadv or pwritev at a time
+};
+
+static struct cs1550_config config;
+
+static struct fuse_opt cs1550_opts[] =
+{
+	{ "mmap", offsetof(struct cs1550_config, use_mmap), 1 },
+	{ "cache_blocks=%u", offsetof(struct cs1550_config, cache_blocks), 0 },
+	{ "lowlevel", offsetof(struct cs1550_config, lowlevel), 1 },
+	{ "readahead_blocks=%u", offsetof(struct cs1550_config, readahead_blocks), 0 },
+	{ "delalloc_bytes=%u", offsetof(struct cs1550_config, delalloc_bytes), 0 },
+	{ "compress", offsetof(struct cs1550_config, compress), 1 },
+	{ "dedup", offsetof(struct cs1550_config, dedup), 1 },
+	{ "inline_bytes=%u", offsetof(struct cs1550_config, inline_bytes), 0 },
+	{ "io_depth=%u", offsetof(struct cs1550_config, io_depth), 0 },
+	FUSE_OPT_END
+};
+
+//fuction prototypes
+int locate_directory(char *directory);
+int locate_file(int index_of_directory, char *filename, char *extension);
+long get_first_free_block(void);
+int is_next_block_free(long start_address);
+long find_next_free_block(long start_address);
+long allocate_block(long goal);
+int load_file_map(struct cs1550_file_directory *file, cs1550_file_map *map);
+int store_file_map(cs1550_file_map *map);
+int write_empty_inode(long address);
+long get_file_block(cs1550_file_map *map, long index);
+int grow_file(cs1550_file_map *map, long blocks);
+void free_file_blocks(struct cs1550_file_directory *file);
+int copy_blocks(cs1550_file_map *map, char *buf, size_t size, off_t offset, int writing);
+void read_ahead(open_file *handle, cs1550_file_map *map, off_t offset, size_t size);
+int flush_pending(meta_entry *attribute);
+void write_directory_entry(cs1550_directory_entry current_directory, int index);
+int journal_note(int target, off_t offset, size_t length);
+void begin_transaction(cs1550_transaction *tx);
+long commit_transaction(void);
+int wait_for_journal(long lsn);
+long journal_durable(void);
+long sync_journal(void);
+
+static uint64_t stats_clock(void)	//nanoseconds from some fixed point, what handlers are timed with
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t) now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static void add_stats(thread_stats *into, thread_stats *from)	//adds every count of from to into
+{
+	int op;
+	int bucket;
+
+	for(op = 0; op < OP_COUNT; op++)
+	{
+		into->calls[ op ] += __atomic_load_n(&from->calls[ op ], __ATOMIC_RELAXED);	//from can be a running thread's stats, still counting
+		into->ns[ op ] += __atomic_load_n(&from->ns[ op ], __ATOMIC_RELAXED);
+		for(bucket = 0; bucket < LATENCY_BUCKETS; bucket++)
+		{
+			into->latency[ op ][ bucket ] += __atomic_load_n(&from->latency[ op ][ bucket ], __ATOMIC_RELAXED);
+		}
+	}
+	for(op = 0; op < COUNTER_COUNT; op++)
+	{
+		into->counters[ op ] += __atomic_load_n(&from->counters[ op ], __ATOMIC_RELAXED);
+	}
+}
+
+static void retire_stats(void *stats)	//destructor of stats_key, moves what a thread that exits counted into stats_retired
+{
+	thread_stats **link;
+
+	pthread_mutex_lock(&stats_lock);
+	for(link = &stats_threads; *link != NULL; link = &(*link)->next)
+	{
+		if( *link == stats )
+		{
+			*link = ((thread_stats *) stats)->next;
+			break;
+		}
+	}
+	add_stats(&stats_retired, stats);
+	pthread_mutex_unlock(&stats_lock);
+	free(stats);
+}
+
+static void make_stats_key(void)
+{
+	pthread_key_create(&stats_key, retire_stats);
+}
+
+static thread_stats *stats_of_thread(void)	//the stats of this thread, made the first time it counts something, NULL if there is no memory for them
+{
+	if( my_stats == NULL )
+	{
+		my_stats = calloc(1, sizeof(thread_stats));
+		if( my_stats == NULL )
+		{
+			return NULL;
+		}
+		pthread_once(&stats_key_once, make_stats_key);
+		pthread_setspecific(stats_key, my_stats);
+
+		pthread_mutex_lock(&stats_lock);
+		my_stats->next = stats_threads;
+		stats_threads = my_stats;
+		pthread_mutex_unlock(&stats_lock);
+	}
+	return my_stats;
+}
+
+static void count_stat(int counter, uint64_t amount)	//adds amount to a counter of this thread, no lock is taken
+{
+	thread_stats *stats = stats_of_thread();
+
+	if( stats != NULL )
+	{
+		__atomic_fetch_add(&stats->counters[ counter ], amount, __ATOMIC_RELAXED);	//relaxed, /.stats only needs each count whole
+	}
+}
+
+static void time_op(int op, uint64_t started)	//counts one call of the handler op that started at started, by stats_clock()
+{
+	thread_stats *stats = stats_of_thread();
+	uint64_t ns = stats_clock() - started;
+	int bucket = ns == 0 ? 0 : 64 - __builtin_clzll(ns);	//ns < 2^bucket
+
+	if( stats != NULL )
+	{
+		__atomic_fetch_add(&stats->calls[ op ], 1, __ATOMIC_RELAXED);
+		__atomic_fetch_add(&stats->ns[ op ], ns, __ATOMIC_RELAXED);
+		__atomic_fetch_add(&stats->latency[ op ][ bucket < LATENCY_BUCKETS ? bucket : LATENCY_BUCKETS - 1 ], 1, __ATOMIC_RELAXED);
+	}
+}
+
+static void total_stats(thread_stats *total)	//sums what every thread counted since mount
+{
+	thread_stats *stats;
+
+	pthread_mutex_lock(&stats_lock);
+	memcpy(total, &stats_retired, sizeof(thread_stats));
+	for(stats = stats_threads; stats != NULL; stats = stats->next)	//counts still going up are read as they are
+	{
+		add_stats(total, stats);
+	}
+	pthread_mutex_unlock(&stats_lock);
+}
+
+static void reset_stats(void)	//makes /.stats start over from 0
+{
+	thread_stats total;
+
+	total_stats(&total);
+	pthread_mutex_lock(&stats_lock);
+	memcpy(&stats_baseline, &total, sizeof(thread_stats));
+	pthread_mutex_unlock(&stats_lock);
+}
+
+static uint64_t latency_percentile(uint64_t *latency, uint64_t calls, int percent)	//upper bound in ns of the bucket the percent-th percentile call fell in, 0 with no calls
+{
+	uint64_t seen = 0;
+	int bucket;
+
+	for(bucket = 0; bucket < LATENCY_BUCKETS && calls > 0; bucket++)
+	{
+		seen += latency[ bucket ];
+		if( seen * 100 >= calls * percent )
+		{
+			return (uint64_t) 1 << bucket;
+		}
+	}
+	return calls > 0 ? (uint64_t) 1 << (LATENCY_BUCKETS - 1) : 0;
+}
+
+static size_t render_stats(char *text, size_t size)	//writes the text of /.stats into text, which holds size chars, returns how many it wrote
+{
+	thread_stats now;
+	uint64_t latency[LATENCY_BUCKETS];
+	size_t used = 0;
+	int op;
+	int bucket;
+
+	total_stats(&now);
+	pthread_mutex_lock(&stats_lock);
+	for(op = 0; op < OP_COUNT; op++)	//only what was counted since the last reset
+	{
+		now.calls[ op ] -= stats_baseline.calls[ op ];
+		now.ns[ op ] -= stats_baseline.ns[ op ];
+		for(bucket = 0; bucket < LATENCY_BUCKETS; bucket++)
+		{
+			now.latency[ op ][ bucket ] -= stats_baseline.latency[ op ][ bucket ];
+		}
+	}
+	for(op = 0; op < COUNTER_COUNT; op++)
+	{
+		now.counters[ op ] -= stats_baseline.counters[ op ];
+	}
+	pthread_mutex_unlock(&stats_lock);
+
+	used += snprintf(text + used, size - used, "# op NAME calls N ns TOTAL p50_ns P p99_ns P buckets B0 .. B%d, Bn counts calls under 2^n ns\n", LATENCY_BUCKETS - 1);
+	for(op = 0; op < OP_COUNT && used < size; op++)
+	{
+		memcpy(latency, now.latency[ op ], sizeof(latency));
+		used += snprintf(text + used, size - used, "op %s calls %llu ns %llu p50_ns %llu p99_ns %llu buckets", op_names[ op ],
+			(unsigned long long) now.calls[ op ], (unsigned long long) now.ns[ op ],
+			(unsigned long long) latency_percentile(latency, now.calls[ op ], 50), (unsigned long long) latency_percentile(latency, now.calls[ op ], 99));
+		for(bucket = 0; bucket < LATENCY_BUCKETS && used < size; bucket++)
+		{
+			used += snprintf(text + used, size - used, " %llu", (unsigned long long) latency[ bucket ]);
+		}
+		used += used < size ? snprintf(text + used, size - used, "\n") : 0;
+	}
+	for(op = 0; op < COUNTER_COUNT && used < size; op++)
+	{
+		used += snprintf(text + used, size - used, "counter %s %llu\n", counter_names[ op ], (unsigned long long) now.counters[ op ]);
+	}
+	return used < size ? used : size - 1;
+}
+
+static int read_at(int fd, void *data, size_t size, off_t offset)	//reads all size bytes at offset of fd, returns 0 or -EIO
+{
+	ssize_t done;	//bytes one pread got
+
+	while( size > 0 )
+	{
+		done = pread(fd, data, size, offset);
+		if( done < 0 && errno == EINTR )	//interrupted, try again
+		{
+			continue;
+		}
+		if( done <= 0 )	//error or past the end of the file
+		{
+			return -EIO;
+		}
+		data = (char *) data + done;
+		size -= done;
+		offset += done;
+	}
+	return 0;
+}
+
+static int write_at(int fd, const void *data, size_t size, off_t offset)	//writes all size bytes at offset of fd, returns 0 or -EIO
+{
+	ssize_t done;	//bytes one pwrite put
+
+	while( size > 0 )
+	{
+		done = pwrite(fd, data, size, offset);
+		if( done < 0 && errno == EINTR )	//interrupted, try again
+		{
+			continue;
+		}
+		if( done <= 0 )
+		{
+			return -EIO;
+		}
+		data = (const char *) data + done;
+		size -= done;
+		offset += done;
+	}
+	return 0;
+}
+
+static void skip_vector(struct iovec **vector, int *count, size_t done)	//moves vector and count past the first done bytes of the buffers
+{
+	while( *count > 0 && done >= (*vector)->iov_len )	//skip the buffers that are done
+	{
+		done -= (*vector)->iov_len;
+		(*vector)++;
+		(*count)--;
+	}
+	if( *count > 0 )	//stopped part way into this one
+	{
+		(*vector)->iov_base = (char *) (*vector)->iov_base + done;
+		(*vector)->iov_len -= done;
+	}
+}
+
+static int vector_at(int fd, struct iovec *vector, int count, off_t offset, int writing)	//reads (or writes) the count buffers of vector one after another at offset of fd with preadv (or pwritev), vector is used up, returns 0 or -EIO
+{
+	ssize_t done;	//bytes one call moved
+
+	while( count > 0 )
+	{
+		done = writing ? pwritev(fd, vector, count, offset) : preadv(fd, vector, count, offset);
+		if( done < 0 && errno == EINTR )	//interrupted, try again
+		{
+			continue;
+		}
+		if( done <= 0 )	//error or past the end of the file
+		{
+			return -EIO;
+		}
+		offset += done;
+		skip_vector(&vector, &count, done);
+	}
+	return 0;
+}
+
+static void free_ring(void *data)	//unmaps and closes an io_uring, also the destructor of ring_key
+{
+	io_ring *ring = data;
+
+	if( ring->sqes != MAP_FAILED )
+	{
+		munmap(ring->sqes, ring->sqes_size);
+	}
+	if( ring->cq_ring != MAP_FAILED )
+	{
+		munmap(ring->cq_ring, ring->cq_ring_size);
+	}
+	if( ring->sq_ring != MAP_FAILED )
+	{
+		munmap(ring->sq_ring, ring->sq_ring_size);
+	}
+	close(ring->fd);
+	free(ring);
+}
+
+static void make_ring_key(void)
+{
+	pthread_key_create(&ring_key, free_ring);
+}
+
+static io_ring *make_ring(unsigned int entries)	//sets up an io_uring of entries requests and maps its rings, returns NULL with errno set if the kernel will not give us one
+{
+	struct io_uring_params params;
+	io_ring *ring = malloc(sizeof(io_ring));
+	int error;
+
+	if( ring == NULL )
+	{
+		return NULL;
+	}
+
+	memset(&params, 0, sizeof(params));
+	ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+	if( ring->fd < 0 )	//too old a kernel, or seccomp or io_uring_disabled say no
+	{
+		error = errno;
+		free(ring);
+		errno = error;
+		return NULL;
+	}
+
+	ring->entries = params.sq_entries;
+	ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+	ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+	ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if( ring->sq_ring == MAP_FAILED || ring->cq_ring == MAP_FAILED || ring->sqes == MAP_FAILED )
+	{
+		error = errno;
+		free_ring(ring);
+		errno = error;
+		return NULL;
+	}
+
+	ring->sq_head = (unsigned int *) ((char *) ring->sq_ring + params.sq_off.head);
+	ring->sq_tail = (unsigned int *) ((char *) ring->sq_ring + params.sq_off.tail);
+	ring->sq_mask = (unsigned int *) ((char *) ring->sq_ring + params.sq_off.ring_mask);
+	ring->sq_array = (unsigned int *) ((char *) ring->sq_ring + params.sq_off.array);
+	ring->cq_head = (unsigned int *) ((char *) ring->cq_ring + params.cq_off.head);
+	ring->cq_tail = (unsigned int *) ((char *) ring->cq_ring + params.cq_off.tail);
+	ring->cq_mask = (unsigned int *) ((char *) ring->cq_ring + params.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *) ((char *) ring->cq_ring + params.cq_off.cqes);
+	return ring;
+}
+
+static io_ring *ring_of_thread(void)	//the io_uring of this thread, made the first time it sends a batch, NULL if there is none
+{
+	if( io_depth == 0 )
+	{
+		return NULL;
+	}
+	if( my_ring == NULL && !my_ring_failed )
+	{
+		my_ring = make_ring(io_depth);
+		if( my_ring == NULL )
+		{
+			my_ring_failed = 1;	//not tried again for every batch
+			return NULL;
+		}
+		pthread_once(&ring_key_once, make_ring_key);
+		pthread_setspecific(ring_key, my_ring);
+	}
+	return my_ring;
+}
+
+static void submit_request(io_ring *ring, io_request *request, int index)	//puts request in the submission ring as the index-th request of its batch, the kernel takes it at the next io_uring_enter
+{
+	unsigned int tail = *ring->sq_tail;	//only this thread moves it
+	unsigned int entry = tail & *ring->sq_mask;
+	struct io_uring_sqe *sqe = &ring->sqes[ entry ];
+
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = request->writing ? IORING_OP_WRITEV : IORING_OP_READV;
+	sqe->fd = request->fd;
+	sqe->addr = (uintptr_t) request->vector;
+	sqe->len = request->count;
+	sqe->off = request->offset;
+	sqe->user_data = index;
+	ring->sq_array[ entry ] = entry;
+	__atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);	//the entry is filled in before the kernel can see it
+}
+
+static void finish_request(io_request *request, int done)	//sets res of a request the kernel moved done bytes of (or failed with -done), what it left is done with preadv or pwritev
+{
+	struct iovec *vector = request->vector;
+	int count = request->count;
+
+	if( done < 0 )	//failed or was cut short, try it again the plain way where a real error fails again
+	{
+		done = 0;
+	}
+	skip_vector(&vector, &count, done);
+	request->res = vector_at(request->fd, vector, count, request->offset + done, request->writing);	//returns 0 right away when it all went
+}
+
+static void set_request(io_request *request, int fd, struct iovec *vector, int count, off_t offset, int writing)	//fills in one request of a batch
+{
+	request->fd = fd;
+	request->vector = vector;
+	request->count = count;
+	request->offset = offset;
+	request->writing = writing;
+	request->res = 0;
+}
+
+static int run_batch(io_request *requests, int count)	//does the count requests, all in flight at once through this thread's io_uring if there is one and one at a time if not, vectors are used up, returns 0 or -EIO if any failed
+{
+	io_ring *ring = count > 1 ? ring_of_thread() : NULL;	//one request is just as well one preadv or pwritev
+	int limit = ring != NULL ? count : 0;	//requests that go through the ring, the ones after are done the plain way
+	int submitted = 0;	//requests put in the submission ring so far
+	int completed = 0;	//requests whose completion has been taken
+	unsigned int waiting;	//submissions the kernel has not taken yet
+	unsigned int head;
+	struct io_uring_cqe *cqe;
+	int index;
+	int res = 0;
+
+	if( limit > 0 )
+	{
+		count_stat(COUNT_IO_BATCHES, 1);
+		count_stat(COUNT_IO_REQUESTS, count);
+	}
+
+	while( completed < limit )
+	{
+		while( submitted < limit && submitted - completed < (int) ring->entries )	//as many in flight as the ring holds
+		{
+			submit_request(ring, &requests[ submitted ], submitted);
+			submitted++;
+		}
+
+		waiting = *ring->sq_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+		if( syscall(__NR_io_uring_enter, ring->fd, waiting, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY && waiting > 0 )
+		{
+			//the kernel will not take them, take them back out and leave them and the rest to preadv and pwritev
+			waiting = *ring->sq_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+			__atomic_store_n(ring->sq_tail, *ring->sq_tail - waiting, __ATOMIC_RELEASE);
+			submitted -= waiting;
+			limit = submitted;
+		}
+
+		for(head = *ring->cq_head; head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE); head++)	//take what has completed
+		{
+			cqe = &ring->cqes[ head & *ring->cq_mask ];
+			finish_request(&requests[ cqe->user_data ], cqe->res);
+			completed++;
+		}
+		__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);	//the kernel can reuse those entries
+	}
+
+	for(index = limit; index < count; index++)
+	{
+		finish_request(&requests[ index ], 0);
+	}
+	for(index = 0; index < count; index++)
+	{
+		res = requests[ index ].res != 0 ? -EIO : res;
+	}
+	return res;
+}
+
+static void start_io(unsigned int depth)	//sends batches through an io_uring of depth requests on each thread, or one request at a time when depth is 0 or the kernel will not give us one
+{
+	io_depth = depth;
+	if( io_depth > 0 && ring_of_thread() == NULL )	//every thread would be told the same
+	{
+		fprintf(stderr, "cs1550 io_uring: %s, using preadv and pwritev\n", strerror(errno));
+		io_depth = 0;
+	}
+}
+
+static long block_hash(long block, long size)	//slot of a block_table of size slots where the probe for block starts
+{
+	return (long) (((uint64_t) block * 0x9e3779b97f4a7c15ULL) >> 32) & (size - 1);
+}
+
+static int start_block_table(block_table *table, long entries)	//makes table empty with room for entries blocks while at most half full, returns 0 or -ENOMEM
+{
+	long slot;
+
+	table->size = BLOCK_TABLE_START_SIZE;
+	while( table->size < entries * 2 )
+	{
+		table->size *= 2;
+	}
+	table->slots = malloc(table->size * sizeof(block_entry));
+	if( table->slots == NULL )
+	{
+		table->size = 0;
+		return -ENOMEM;
+	}
+	for(slot = 0; slot < table->size; slot++)
+	{
+		table->slots[ slot ].block = -1;
+	}
+	table->used = 0;
+	return 0;
+}
+
+static void stop_block_table(block_table *table)	//frees what table holds
+{
+	free(table->slots);
+	table->slots = NULL;
+	table->size = 0;
+	table->used = 0;
+}
+
+static block_entry *find_block_entry(block_table *table, long block)	//the entry of block in table, NULL if it has none
+{
+	long slot;
+
+	if( table->size == 0 )
+	{
+		return NULL;
+	}
+	for(slot = block_hash(block, table->size); table->slots[ slot ].block != -1; slot = (slot + 1) & (table->size - 1))
+	{
+		if( table->slots[ slot ].block == block )
+		{
+			return &table->slots[ slot ];
+		}
+	}
+	return NULL;
+}
+
+static block_entry *add_block_entry(block_table *table, long block)	//the entry of block in table, made with a value of 0 if it had none, the table grows once three quarters full, returns NULL if there is no memory for that
+{
+	block_entry *entry = find_block_entry(table, block);
+	block_table grown;
+	long slot;
+
+	if( entry != NULL )
+	{
+		return entry;
+	}
+	if( (table->used + 1) * 4 > table->size * 3 )
+	{
+		if( start_block_table(&grown, table->used + 1) != 0 )
+		{
+			return NULL;
+		}
+		for(slot = 0; slot < table->size; slot++)
+		{
+			if( table->slots[ slot ].block != -1 )
+			{
+				*add_block_entry(&grown, table->slots[ slot ].block) = table->slots[ slot ];
+			}
+		}
+		free(table->slots);
+		*table = grown;
+	}
+
+	for(slot = block_hash(block, table->size); table->slots[ slot ].block != -1; slot = (slot + 1) & (table->size - 1));
+	table->slots[ slot ].block = block;
+	table->slots[ slot ].value = 0;
+	table->used++;
+	return &table->slots[ slot ];
+}
+
+static void remove_block_entry(block_table *table, block_entry *entry)	//takes entry out of table, the entries after it that probed past it move back so no probe stops early
+{
+	long hole = entry - table->slots;
+	long slot;
+	long home;
+
+	for(slot = (hole + 1) & (table->size - 1); table->slots[ slot ].block != -1; slot = (slot + 1) & (table->size - 1))
+	{
+		home = block_hash(table->slots[ slot ].block, table->size);
+		if( ((slot - home) & (table->size - 1)) >= ((slot - hole) & (table->size - 1)) )	//the hole is between where its probe starts and where it is
+		{
+			table->slots[ hole ] = table->slots[ slot ];
+			hole = slot;
+		}
+	}
+	table->slots[ hole ].block = -1;
+	table->used--;
+}
+
+static int cache_find(long block)	//slot of cache block is in, -1 if it is not cached, cache_lock must be held
+{
+	block_entry *entry = find_block_entry(&cache_slot_of, block);
+
+	return entry != NULL ? (int) entry->value : -1;
+}
+
+static void cache_touch(int slot)	//moves slot to the most recently used end of the list
+{
+	cache_block *entry = &cache[ slot ];
+
+	if( slot == cache_newest )
+	{
+		return;
+	}
+
+	//take it out of the list, it is not the newest so entry->newer is a slot
+	if( entry->older != -1 )
+	{
+		cache[ entry->older ].newer = entry->newer;
+	}
+	else
+	{
+		cache_oldest = entry->newer;
+	}
+	cache[ entry->newer ].older = entry->older;
+
+	//and put it back in at the newest end
+	entry->older = cache_newest;
+	entry->newer = -1;
+	cache[ cache_newest ].newer = slot;
+	cache_newest = slot;
+}
+
+static void cache_drop(int slot)	//empties slot without writing it, the slot keeps its place in the list
+{
+	if( cache[ slot ].block != -1 )
+	{
+		remove_block_entry(&cache_slot_of, find_block_entry(&cache_slot_of, cache[ slot ].block));
+	}
+	if( cache[ slot ].dirty )
+	{
+		cache_dirty_count--;
+	}
+	if( cache[ slot ].prefetched )	//read ahead for nothing
+	{
+		count_stat(COUNT_READAHEAD_WASTED, 1);
+	}
+	cache[ slot ].block = -1;
+	cache[ slot ].dirty = 0;
+	cache[ slot ].prefetched = 0;
+	cache[ slot ].pins = 0;
+	cache[ slot ].lsn = 0;
+}
+
+static int write_cache_batch(int runs, int first)	//writes the runs of cache_batch, their blocks are those of cache_run from first on, and marks the slots of the runs that went clean, returns 0 or -EIO
+{
+	int run;
+	int count;
+	int res = run_batch(cache_batch, runs);
+
+	for(run = 0; run < runs; run++)
+	{
+		if( cache_batch[ run ].res == 0 )	//the slots of a run that failed stay dirty so the next write back tries again
+		{
+			for(count = 0; count < cache_batch[ run ].count; count++)
+			{
+				cache[ cache_run_slots[ first + count ] ].dirty = 0;
+				cache[ cache_run_slots[ first + count ] ].lsn = 0;
+			}
+			cache_dirty_count -= cache_batch[ run ].count;
+		}
+		first += cache_batch[ run ].count;
+	}
+	return res;
+}
+
+static int compare_slot_blocks(const void *a, const void *b)	//orders slots of cache by the block they hold, for qsort()
+{
+	long first = cache[ *(const int *) a ].block;
+	long second = cache[ *(const int *) b ].block;
+
+	return first < second ? -1 : first > second;
+}
+
+static void set_write_back(io_request *request, int first, int count)	//makes request write the count slots of cache_run from first on where they go, a record of .directories is always alone
+{
+	long key = cache[ cache_run_slots[ first ] ].block;
+
+	if( key < -1 )
+	{
+		set_request(request, directory_fd, &cache_run[ first ], 1, (off_t) KEY_RECORD(key) * sizeof(cs1550_directory_entry), 1);
+	}
+	else
+	{
+		set_request(request, disk_fd, &cache_run[ first ], count, (off_t) key * BLOCK_SIZE, 1);
+	}
+}
+
+static int write_back_locked(long durable)	//writes every dirty block .journal is durable for, up to durable, to .disk in block order, blocks next to each other on disk go in one pwritev and up to IO_BATCH_RUNS of those in one batch. blocks transactions have pinned wait too, only a checkpoint, which gives LONG_MAX, writes them. cache_lock must be held, returns 0 or -EIO
+{
+	int dirty = 0;	//how many dirty slots can go, put in cache_run_slots in block order
+	int seen = 0;	//how many dirty slots were looked at
+	int run_start = 0;	//first of them in the run being put together
+	int written = 0;	//first of them not in a batch yet
+	int runs = 0;	//how many runs are in cache_batch
+	int index;
+	int slot;
+	int res = 0;
+
+	for(slot = 0; slot < cache_size && seen < cache_dirty_count; slot++)
+	{
+		if( !cache[ slot ].dirty )
+		{
+			continue;
+		}
+		seen++;
+		if( durable == LONG_MAX || (cache[ slot ].pins == 0 && cache[ slot ].lsn <= durable) )
+		{
+			cache_run_slots[ dirty++ ] = slot;
+		}
+	}
+	qsort(cache_run_slots, dirty, sizeof(int), compare_slot_blocks);
+
+	for(index = 0; index < dirty; index++)
+	{
+		cache_run[ index ].iov_base = &cache[ cache_run_slots[ index ] ].data;
+		cache_run[ index ].iov_len = cache[ cache_run_slots[ index ] ].block < -1 ? sizeof(cs1550_directory_entry) : BLOCK_SIZE;
+	}
+
+	for(index = 1; index <= dirty; index++)	//the run ends before index once its block is not the next one on disk or the run is full
+	{
+		if( index < dirty && index - run_start < CACHE_RUN_BLOCKS && cache[ cache_run_slots[ index - 1 ] ].block >= 0 && cache[ cache_run_slots[ index ] ].block == cache[ cache_run_slots[ index - 1 ] ].block + 1 )
+		{
+			continue;
+		}
+		set_write_back(&cache_batch[ runs++ ], run_start, index - run_start);
+		run_start = index;
+		if( runs == IO_BATCH_RUNS || index == dirty )
+		{
+			res = write_cache_batch(runs, written) != 0 ? -EIO : res;
+			runs = 0;
+			written = index;
+		}
+	}
+	return res;
+}
+
+static int write_back_cache(long durable)	//writes every dirty block of the cache that can go to .disk, see write_back_locked(), returns 0 or -EIO
+{
+	int res;
+
+	if( cache == NULL )
+	{
+		return 0;
+	}
+
+	pthread_mutex_lock(&cache_lock);
+	res = write_back_locked(durable);
+	pthread_mutex_unlock(&cache_lock);
+	return res;
+}
+
+static int cache_evictable(void)	//least recently used slot that is clean and not pinned, -1 if there is none
+{
+	int slot;
+
+	for(slot = cache_oldest; slot != -1 && (cache[ slot ].dirty || cache[ slot ].pins > 0); slot = cache[ slot ].newer);
+	return slot;
+}
+
+static int cache_claim(long block)	//gives block (or RECORD_KEY() of a record) the least recently used slot that can be emptied and makes it the newest, returns the slot (its data is not filled in) or -1
+{
+	long durable = journal_durable();
+	int slot;
+
+	for(slot = cache_oldest; slot != -1 && (cache[ slot ].pins > 0 || cache[ slot ].lsn > durable); slot = cache[ slot ].newer);	//the oldest slot write back could empty, the pinned ones before it would not go anyway
+	if( slot != -1 && cache[ slot ].dirty && write_back_locked(durable) != 0 )	//write back everything rather than just this block so the writes go out in runs
+	{
+		return -1;
+	}
+
+	slot = cache_evictable();
+	if( slot == -1 && write_back_locked(sync_journal()) == 0 )	//every slot waits for .journal or a transaction, the ones that wait for .journal can go once it is durable
+	{
+		slot = cache_evictable();
+	}
+	if( slot == -1 )
+	{
+		return -1;
+	}
+
+	cache_drop(slot);
+	cache[ slot ].block = block;
+	add_block_entry(&cache_slot_of, block)->value = slot;	//it has room for every slot
+	cache_touch(slot);
+	return slot;
+}
+
+static int cache_missing(const block_run *runs, int count, long block)	//whether block is neither cached nor in the count runs a batch is being put together from
+{
+	int run;
+
+	if( cache_find(block) != -1 )
+	{
+		return 0;
+	}
+	for(run = 0; run < count; run++)	//a block -o dedup shared can come up twice
+	{
+		if( block >= runs[ run ].block && block < runs[ run ].block + runs[ run ].count )
+		{
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static int gather_misses(const disk_span *spans, int count, int *span, long *block, block_run *runs, long *total)	//puts the blocks the spans need from block of span on that are not cached in runs, moves span and block past the ones looked at, sets total to how many blocks it put in, returns how many runs
+{
+	long limit = CACHE_RUN_BLOCKS < cache_size / 2 + 1 ? CACHE_RUN_BLOCKS : cache_size / 2 + 1;	//half the slots, so the ones claimed first are not claimed again for the last ones even with some pinned
+	long last;	//last block of the span
+	int used = 0;	//how many runs there are
+
+	*total = 0;
+	while( *span < count && *total < limit )
+	{
+		last = (spans[ *span ].offset + (off_t) spans[ *span ].size - 1) / BLOCK_SIZE;
+		for( ; *block <= last && *total < limit; (*block)++)
+		{
+			if( !cache_missing(runs, used, *block) )
+			{
+				continue;
+			}
+			if( used > 0 && runs[ used - 1 ].block + runs[ used - 1 ].count == *block )
+			{
+				runs[ used - 1 ].count++;
+			}
+			else if( used < IO_BATCH_RUNS )
+			{
+				runs[ used ].block = *block;
+				runs[ used ].count = 1;
+				used++;
+			}
+			else	//the batch is full, the next one starts with this block
+			{
+				return used;
+			}
+			(*total)++;
+		}
+		if( *block > last )
+		{
+			(*span)++;
+			*block = *span < count ? spans[ *span ].offset / BLOCK_SIZE : 0;
+		}
+	}
+	return used;
+}
+
+static int cache_fill(const block_run *runs, int count)	//reads the blocks of the count runs, none of them cached and CACHE_RUN_BLOCKS at most in all, straight into their slots with one batch of one preadv per run, returns 0 or -EIO
+{
+	int slots[CACHE_RUN_BLOCKS];	//slot each block is read into
+	struct iovec vector[CACHE_RUN_BLOCKS];	//data of those slots
+	io_request batch[IO_BATCH_RUNS];
+	int claimed = 0;	//how many slots were claimed
+	int run;
+	long index;
+
+	for(run = 0; run < count; run++)	//claim first, claiming can write back which uses cache_run and cache_run_slots
+	{
+		set_request(&batch[ run ], disk_fd, &vector[ claimed ], runs[ run ].count, (off_t) runs[ run ].block * BLOCK_SIZE, 0);
+		for(index = 0; index < runs[ run ].count; index++)
+		{
+			slots[ claimed ] = cache_claim(runs[ run ].block + index);
+			if( slots[ claimed ] == -1 )
+			{
+				break;
+			}
+			cache[ slots[ claimed ] ].pins++;	//so the claims after it do not take it back
+			vector[ claimed ].iov_base = &cache[ slots[ claimed ] ].data;
+			vector[ claimed ].iov_len = BLOCK_SIZE;
+			claimed++;
+		}
+		if( index < runs[ run ].count )
+		{
+			break;
+		}
+	}
+
+	if( run < count || run_batch(batch, count) != 0 )
+	{
+		for(index = 0; index < claimed; index++)
+		{
+			cache_drop(slots[ index ]);
+		}
+		return -EIO;
+	}
+	for(index = 0; index < claimed; index++)
+	{
+		cache[ slots[ index ] ].pins--;
+	}
+	return 0;
+}
+
+static int cache_io(disk_span *spans, int count, int writing)	//reads (or writes, or with WRITE_PINNED writes and pins) the count spans of .disk through the cache, the blocks a read misses in any of them are read in one batch, returns 0 or -EIO
+{
+	block_run filled[IO_BATCH_RUNS];	//blocks the last batch read, they are not hits when they are copied
+	int filled_runs = 0;	//how many runs are in filled
+	int next_run = 0;	//run of filled the next of those blocks is in
+	long next_index = 0;	//and which block of that run it is
+	long missing;	//how many blocks the batch read
+	int from_span;	//where gather_misses() starts, it moves them
+	long from_block;
+	int span;
+	char *data;
+	size_t size;
+	off_t offset;
+	long block;	//block the next byte is in
+	size_t in_block;	//where in the block the next byte is
+	size_t length;	//how many bytes are copied in this block
+	int hit;	//set when the block was already cached
+	int slot;
+	int res = 0;
+
+	pthread_mutex_lock(&cache_lock);
+
+	for(span = 0; span < count && res == 0; span++)
+	{
+		data = spans[ span ].data;
+		size = spans[ span ].size;
+		offset = spans[ span ].offset;
+		block = offset / BLOCK_SIZE;
+
+		while( size > 0 )
+		{
+			in_block = offset % BLOCK_SIZE;
+			length = BLOCK_SIZE - in_block < size ? BLOCK_SIZE - in_block : size;
+			slot = cache_find(block);
+			hit = slot != -1;
+
+			if( slot == -1 && writing && length == BLOCK_SIZE )	//the whole block is overwritten so what is on disk does not matter
+			{
+				slot = cache_claim(block);
+			}
+			else if( slot == -1 )	//read the missing blocks of this span and the ones after in one go, a write only misses part of this one
+			{
+				from_span = span;
+				from_block = block;
+				filled[ 0 ].block = block;
+				filled[ 0 ].count = 1;
+				missing = 1;
+				filled_runs = writing ? 1 : gather_misses(spans, count, &from_span, &from_block, filled, &missing);
+				next_run = 0;
+				next_index = 0;
+				if( cache_fill(filled, filled_runs) == 0 )
+				{
+					slot = cache_find(block);
+					count_stat(COUNT_CACHE_MISSES, missing);
+				}
+				else
+				{
+					filled_runs = 0;
+				}
+			}
+
+			if( slot == -1 )
+			{
+				res = -EIO;
+				break;
+			}
+
+			if( next_run < filled_runs && block == filled[ next_run ].block + next_index )	//read by this call, the filled blocks come up in the order they were gathered
+			{
+				if( ++next_index == filled[ next_run ].count )
+				{
+					next_run++;
+					next_index = 0;
+				}
+			}
+			else if( hit )
+			{
+				count_stat(COUNT_CACHE_HITS, 1);
+			}
+
+			cache_touch(slot);
+			if( cache[ slot ].prefetched )	//readahead got here first
+			{
+				count_stat(COUNT_READAHEAD_HITS, !writing);
+				cache[ slot ].prefetched = 0;
+			}
+			if( writing )
+			{
+				memcpy(cache[ slot ].data.data + in_block, data, length);
+				if( !cache[ slot ].dirty )
+				{
+					cache[ slot ].dirty = 1;
+					cache_dirty_count++;
+				}
+				cache[ slot ].pins += writing == WRITE_PINNED;
+			}
+			else
+			{
+				memcpy(data, cache[ slot ].data.data + in_block, length);
+			}
+
+			data += length;
+			size -= length;
+			offset += length;
+			block++;
+		}
+	}
+
+	pthread_mutex_unlock(&cache_lock);
+	return res;
+}
+
+static void forget_cached_block(long block)	//drops block from the cache without writing it, used when the block is freed
+{
+	int slot;
+
+	if( cache == NULL )
+	{
+		return;
+	}
+
+	pthread_mutex_lock(&cache_lock);
+	slot = cache_find(block);
+	if( slot != -1 )
+	{
+		cache_drop(slot);
+	}
+	pthread_mutex_unlock(&cache_lock);
+}
+
+static int cache_record(int index, const cs1550_directory_entry *record, int pin)	//puts record index of .directories in the cache to be written back like a block, pinned for the transaction of this thread if pin is set, returns 0 or -EIO
+{
+	int slot;
+
+	pthread_mutex_lock(&cache_lock);
+	slot = cache_find(RECORD_KEY(index));
+	if( slot == -1 )
+	{
+		slot = cache_claim(RECORD_KEY(index));
+	}
+	if( slot != -1 )
+	{
+		cache_touch(slot);
+		cache[ slot ].record = *record;
+		if( !cache[ slot ].dirty )
+		{
+			cache[ slot ].dirty = 1;
+			cache_dirty_count++;
+		}
+		cache[ slot ].pins += pin;
+	}
+	pthread_mutex_unlock(&cache_lock);
+	return slot != -1 ? 0 : -EIO;
+}
+
+static void cache_unpin(long key, long lsn)	//a transaction that pinned the block or record key committed at lsn, it can be written back once the others have and .journal is durable up to there
+{
+	int slot;
+
+	if( cache == NULL )
+	{
+		return;
+	}
+
+	pthread_mutex_lock(&cache_lock);
+	slot = cache_find(key);
+	if( slot != -1 && cache[ slot ].pins > 0 )	//freeing the block dropped it, pins and all
+	{
+		cache[ slot ].pins--;
+		if( lsn > cache[ slot ].lsn )
+		{
+			cache[ slot ].lsn = lsn;
+		}
+	}
+	pthread_mutex_unlock(&cache_lock);
+}
+
+static void *cache_writer(void *arg)	//write back thread, writes the dirty blocks every CACHE_FLUSH_SECONDS until unmount
+{
+	struct timespec wake;	//when to write back next
+	long durable;	//how far .journal is durable
+
+	(void) arg;
+
+	pthread_mutex_lock(&cache_lock);
+	while( cache_writer_running )
+	{
+		clock_gettime(CLOCK_REALTIME, &wake);
+		wake.tv_sec += CACHE_FLUSH_SECONDS;
+		pthread_cond_timedwait(&cache_writer_wake, &cache_lock, &wake);
+
+		if( cache_writer_running && cache_dirty_count > 0 )
+		{
+			pthread_mutex_unlock(&cache_lock);	//the cache is not held up while .journal syncs
+			durable = sync_journal();	//what the blocks transactions changed wait for
+			pthread_mutex_lock(&cache_lock);
+			write_back_locked(durable);
+		}
+	}
+	pthread_mutex_unlock(&cache_lock);
+	return NULL;
+}
+
+static void start_cache(unsigned int blocks)	//makes a cache of blocks slots and starts the write back thread
+{
+	int slot;
+
+	if( blocks > block_count )	//more slots than blocks would never be used
+	{
+		blocks = block_count;
+	}
+
+	cache = malloc(blocks * sizeof(cache_block));
+	cache_run = malloc(blocks * sizeof(struct iovec));	//every slot can be dirty at once
+	cache_run_slots = malloc(blocks * sizeof(int));
+	if( cache == NULL || start_block_table(&cache_slot_of, blocks) != 0 || cache_run == NULL || cache_run_slots == NULL )
+	{
+		perror("cache");	//go without it
+		free(cache);
+		stop_block_table(&cache_slot_of);
+		free(cache_run);
+		free(cache_run_slots);
+		cache = NULL;
+		cache_run = NULL;
+		cache_run_slots = NULL;
+		return;
+	}
+
+	cache_size = blocks;
+	for(slot = 0; slot < cache_size; slot++)	//every slot starts empty and in the list, oldest first
+	{
+		cache[ slot ].block = -1;
+		cache[ slot ].dirty = 0;
+		cache[ slot ].prefetched = 0;
+		cache[ slot ].pins = 0;
+		cache[ slot ].lsn = 0;
+		cache[ slot ].older = slot - 1;
+		cache[ slot ].newer = slot + 1 < cache_size ? slot + 1 : -1;
+	}
+	cache_oldest = 0;
+	cache_newest = cache_size - 1;
+	cache_dirty_count = 0;
+
+	cache_writer_running = 1;
+	if( pthread_create(&cache_writer_thread, NULL, cache_writer, NULL) != 0 )
+	{
+		perror("cache writer");	//dirty blocks still go out on flush, fsync and unmount
+		cache_writer_running = 0;
+	}
+}
+
+static void stop_cache(void)	//stops the write back thread, writes back the dirty blocks and frees the cache
+{
+	int was_running;
+
+	if( cache == NULL )
+	{
+		return;
+	}
+
+	pthread_mutex_lock(&cache_lock);
+	was_running = cache_writer_running;
+	cache_writer_running = 0;
+	pthread_cond_signal(&cache_writer_wake);
+	pthread_mutex_unlock(&cache_lock);
+
+	if( was_running )
+	{
+		pthread_join(cache_writer_thread, NULL);
+	}
+
+	write_back_cache(sync_journal());
+
+	free(cache);
+	stop_block_table(&cache_slot_of);
+	free(cache_run);
+	free(cache_run_slots);
+	cache = NULL;
+	cache_run = NULL;
+	cache_run_slots = NULL;
+	cache_size = 0;
+	cache_data = 0;
+}
+
+static void prefetch_runs(const block_run *queued, int count)	//puts the blocks of the count runs in the cache, reading the ones it does not have yet in batches
+{
+	disk_span spans[READAHEAD_QUEUE_SIZE];	//where the runs are, nothing is copied out
+	block_run runs[IO_BATCH_RUNS];	//blocks of them one batch reads
+	int used;	//how many runs are in runs
+	int span = 0;	//span the next batch starts in
+	long block;	//and the block it starts at, gather_misses() moves both
+	long missing;	//how many blocks the batch reads
+	int run;
+	long index;
+
+	for(run = 0; run < count; run++)
+	{
+		spans[ run ].data = NULL;
+		spans[ run ].size = (size_t) queued[ run ].count * BLOCK_SIZE;
+		spans[ run ].offset = (off_t) queued[ run ].block * BLOCK_SIZE;
+	}
+
+	pthread_mutex_lock(&cache_lock);
+	block = queued[ 0 ].block;
+	while( (used = gather_misses(spans, count, &span, &block, runs, &missing)) > 0 && cache_fill(runs, used) == 0 )	//blocks already there, maybe written since, are left as they are
+	{
+		count_stat(COUNT_READAHEAD_FETCHED, missing);
+		for(run = 0; run < used; run++)
+		{
+			for(index = 0; index < runs[ run ].count; index++)
+			{
+				cache[ cache_find(runs[ run ].block + index) ].prefetched = 1;
+			}
+		}
+
+	}
+	pthread_mutex_unlock(&cache_lock);
+}
+
+static void *readahead_worker(void *arg)	//readahead thread, fills the cache with the queued runs, all that are waiting at once, until unmount
+{
+	block_run runs[READAHEAD_QUEUE_SIZE];	//every run that was queued, fetched together
+	int count;
+
+	(void) arg;
+
+	pthread_mutex_lock(&readahead_lock);
+	while( readahead_running )
+	{
+		if( readahead_queued == 0 )
+		{
+			pthread_cond_wait(&readahead_wake, &readahead_lock);
+			continue;
+		}
+
+		for(count = 0; readahead_queued > 0; count++)
+		{
+			runs[ count ] = readahead_queue[ readahead_head ];
+			readahead_head = (readahead_head + 1) % READAHEAD_QUEUE_SIZE;
+			readahead_queued--;
+		}
+
+		pthread_mutex_unlock(&readahead_lock);	//reads go on while the runs are fetched
+		prefetch_runs(runs, count);
+		pthread_mutex_lock(&readahead_lock);
+	}
+	pthread_mutex_unlock(&readahead_lock);
+	return NULL;
+}
+
+static void queue_readahead(long block, long count)	//asks the readahead thread for the count blocks from block on, dropped if it is too far behind
+{
+	pthread_mutex_lock(&readahead_lock);
+	if( readahead_running && readahead_queued < READAHEAD_QUEUE_SIZE )
+	{
+		readahead_queue[ (readahead_head + readahead_queued) % READAHEAD_QUEUE_SIZE ].block = block;
+		readahead_queue[ (readahead_head + readahead_queued) % READAHEAD_QUEUE_SIZE ].count = count;
+		readahead_queued++;
+		pthread_cond_signal(&readahead_wake);
+	}
+	pthread_mutex_unlock(&readahead_lock);
+}
+
+static void start_readahead(unsigned int blocks)	//starts the readahead thread with windows of up to blocks, there has to be a cache to read ahead into
+{
+	readahead_limit = blocks < (unsigned int) cache_size / 4 ? blocks : cache_size / 4;	//so one reader does not push out its own readahead
+	if( readahead_limit == 0 )
+	{
+		return;
+	}
+
+	readahead_running = 1;
+	if( pthread_create(&readahead_thread, NULL, readahead_worker, NULL) != 0 )
+	{
+		perror("readahead");	//reads just wait for the disk
+		readahead_running = 0;
+		readahead_limit = 0;
+	}
+}
+
+static void stop_readahead(void)	//stops the readahead thread and says how well readahead did, before the cache goes
+{
+	thread_stats total;	//what every thread counted
+	int slot;
+
+	if( !readahead_running )
+	{
+		return;
+	}
+
+	pthread_mutex_lock(&readahead_lock);
+	readahead_running = 0;
+	readahead_queued = 0;
+	pthread_cond_signal(&readahead_wake);
+	pthread_mutex_unlock(&readahead_lock);
+	pthread_join(readahead_thread, NULL);
+	readahead_limit = 0;
+
+	pthread_mutex_lock(&cache_lock);
+	for(slot = 0; slot < cache_size; slot++)	//still waiting for a read that never came
+	{
+		count_stat(COUNT_READAHEAD_WASTED, cache[ slot ].prefetched);
+		cache[ slot ].prefetched = 0;
+	}
+	pthread_mutex_unlock(&cache_lock);
+
+	total_stats(&total);	//since mount, not since /.stats was last reset
+	if( total.counters[ COUNT_READAHEAD_FETCHED ] > 0 )
+	{
+		fprintf(stderr, "cs1550 readahead: %llu blocks fetched, %llu read, %llu wasted\n", (unsigned long long) total.counters[ COUNT_READAHEAD_FETCHED ],
+			(unsigned long long) total.counters[ COUNT_READAHEAD_HITS ], (unsigned long long) total.counters[ COUNT_READAHEAD_WASTED ]);
+	}
+}
+
+static int disk_io(disk_span *spans, int count, int writing)	//reads (or writes) the count spans of .disk, IO_BATCH_RUNS at most, through the mapping or the cache if there is one and otherwise in one batch, returns 0 or -EIO
+{
+	struct iovec vector[IO_BATCH_RUNS];	//one buffer per span
+	io_request batch[IO_BATCH_RUNS];
+	int requests = 0;	//how many are in batch
+	int cached = cache_data;	//set while every span is in blocks, the bitmap does not go through the cache
+	int span;
+
+	for(span = 0; span < count; span++)
+	{
+		if( disk_map != NULL && (spans[ span ].offset < 0 || spans[ span ].offset + (off_t) spans[ span ].size > disk_size) )
+		{
+			return -EIO;
+		}
+		cached = cached && spans[ span ].size > 0 && spans[ span ].offset >= 0 && spans[ span ].offset + (off_t) spans[ span ].size <= (off_t) block_count * BLOCK_SIZE;
+	}
+
+	if( disk_map != NULL )	//a read or write is just a copy out of or into the mapping, msync makes a write durable
+	{
+		for(span = 0; span < count; span++)
+		{
+			if( writing )
+			{
+				memcpy(disk_map + spans[ span ].offset, spans[ span ].data, spans[ span ].size);
+			}
+			else
+			{
+				memcpy(spans[ span ].data, disk_map + spans[ span ].offset, spans[ span ].size);
+			}
+		}
+		return 0;
+	}
+	if( cached )	//a write only marks the blocks dirty, they are written back later
+	{
+		return cache_io(spans, count, writing);
+	}
+
+	for(span = 0; span < count; span++)
+	{
+		if( spans[ span ].size > 0 )
+		{
+			vector[ requests ].iov_base = spans[ span ].data;
+			vector[ requests ].iov_len = spans[ span ].size;
+			set_request(&batch[ requests ], disk_fd, &vector[ requests ], 1, spans[ span ].offset, writing);
+			requests++;
+		}
+	}
+	return run_batch(batch, requests);
+}
+
+static int read_disk(void *data, size_t size, off_t offset)	//reads size bytes at offset of .disk, returns 0 or -EIO
+{
+	disk_span span;
+
+	span.data = data;
+	span.size = size;
+	span.offset = offset;
+	return disk_io(&span, 1, 0);
+}
+
+static int write_disk(const void *data, size_t size, off_t offset)	//writes size bytes at offset of .disk, returns 0 or -EIO
+{
+	disk_span span;
+
+	span.data = (char *) data;	//only read from
+	span.size = size;
+	span.offset = offset;
+	return disk_io(&span, 1, 1);
+}
+
+static int read_metadata(void *data, size_t size, off_t offset)	//reads size bytes of an inode or indirect block at offset of .disk, from the cache whenever there is one since newer copies wait there for .journal, returns 0 or -EIO
+{
+	disk_span span;
+
+	span.data = data;
+	span.size = size;
+	span.offset = offset;
+	return cache != NULL ? cache_io(&span, 1, 0) : disk_io(&span, 1, 0);
+}
+
+static int write_metadata(const void *data, size_t size, off_t offset)	//writes size bytes of an inode or indirect block at offset of .disk as part of the transaction of this thread, it waits in the cache until .journal has it, returns 0 or -EIO
+{
+	disk_span span;
+	int pin = journal_note(JOURNAL_DISK, offset, size);
+
+	span.data = (char *) data;	//only read from
+	span.size = size;
+	span.offset = offset;
+	return cache != NULL ? cache_io(&span, 1, pin ? WRITE_PINNED : 1) : disk_io(&span, 1, 1);
+}
+
+static unsigned long hash_name(const char *name)	//FNV-1a hash of a nul terminated name
+{
+	unsigned long hash = 2166136261UL;
+
+	while( *name != '\0' )
+	{
+		hash ^= (unsigned char) *name++;
+		hash *= 16777619UL;
+	}
+	return hash;
+}
+
+static void index_directory(int index)	//puts the directory at index of directory_table into directory_index
+{
+	unsigned long slot = hash_name( directory_table[ index ].dname + 1 ) & (directory_index_size - 1);
+
+	while( directory_index[ slot ] != -1 )	//linear probing until an empty slot
+	{
+		slot = (slot + 1) & (directory_index_size - 1);
+	}
+	directory_index[ slot ] = index;
+}
+
+static int is_directory_record(int index)	//returns 1 if the record at index of directory_table starts a directory, 0 if it only holds more files of one
+{
+	return directory_table[ index ].dname[0] == '/';
+}
+
+static int rebuild_directory_index(int size)	//makes directory_index size slots big and reinserts every directory, the old index stays if there is no memory, returns 0 or -ENOMEM
+{
+	int *index = malloc(size * sizeof(int));
+	int count;
+
+	if( index == NULL )
+	{
+		return -ENOMEM;
+	}
+	free(directory_index);
+	directory_index = index;
+	directory_index_size = size;
+
+	for(count = 0; count < size; count++)
+	{
+		directory_index[ count ] = -1;	//empty slot
+	}
+	for(count = 0; count < directory_count; count++)
+	{
+		if( is_directory_record(count) )
+		{
+			index_directory(count);
+		}
+	}
+	return 0;
+}
+
+static int add_record_state(void)	//gives every record of directory_table that does not have them yet a lock and an empty contents_of, the locks themselves never move, what was given stays if there is no memory for the rest, returns 0 or -ENOMEM
+{
+	pthread_rwlock_t **locks;
+	directory_contents *contents;
+
+	if( directory_count > directory_lock_count )
+	{
+		locks = realloc(directory_locks, directory_count * sizeof(pthread_rwlock_t *));
+		if( locks == NULL )
+		{
+			return -ENOMEM;
+		}
+		directory_locks = locks;
+		for( ; directory_lock_count < directory_count; directory_lock_count++)
+		{
+			directory_locks[ directory_lock_count ] = malloc(sizeof(pthread_rwlock_t));
+			if( directory_locks[ directory_lock_count ] == NULL )
+			{
+				return -ENOMEM;
+			}
+			pthread_rwlock_init(directory_locks[ directory_lock_count ], NULL);
+		}
+	}
+
+	if( directory_count > contents_count )
+	{
+		contents = realloc(contents_of, directory_count * sizeof(directory_contents));
+		if( contents == NULL )
+		{
+			return -ENOMEM;
+		}
+		contents_of = contents;
+		memset(&contents_of[ contents_count ], 0, (directory_count - contents_count) * sizeof(directory_contents));
+		contents_count = directory_count;
+	}
+	return 0;
+}
+
+static int append_directory_table(cs1550_directory_entry *new_directory)	//adds a record to the in memory table, and to the index if it starts a directory, nothing changes if there is no memory for it, returns its index or -ENOMEM
+{
+	cs1550_directory_entry *table;
+	int capacity;
+	int res;
+
+	if( directory_count == directory_capacity )	//table is full so double it
+	{
+		capacity = directory_capacity == 0 ? DIRECTORY_INDEX_START_SIZE / 2 : directory_capacity * 2;
+		table = realloc(directory_table, capacity * sizeof(cs1550_directory_entry));
+		if( table == NULL )
+		{
+			return -ENOMEM;
+		}
+		directory_table = table;
+		directory_capacity = capacity;
+	}
+	if( (directory_count + 1) * 2 > directory_index_size )	//keep the index at most half full so probes stay short
+	{
+		res = rebuild_directory_index(directory_index_size * 2);
+		if( res != 0 )
+		{
+			return res;
+		}
+	}
+
+	directory_table[ directory_count ] = *new_directory;
+	directory_count++;
+	res = add_record_state();
+	if( res != 0 )	//the record is not used until it has its lock and contents
+	{
+		directory_count--;
+		return res;
+	}
+
+	if( is_directory_record(directory_count - 1) )
+	{
+		index_directory(directory_count - 1);
+	}
+	return directory_count - 1;
+}
+
+static unsigned long hash_file_name(const char *filename, const char *extension)	//hash of filename.extension, what the file index of a directory is keyed by
+{
+	return hash_name(filename) * 31 + hash_name(extension);
+}
+
+static int file_record(int index_of_directory, int file_index)	//returns the index in directory_table of the record file file_index of the directory is in
+{
+	return contents_of[ index_of_directory ].records[ file_index / MAX_FILES_IN_DIR ];
+}
+
+static struct cs1550_file_directory *get_file(int index_of_directory, int file_index)	//returns the entry of file file_index of the directory, in whichever of its records it is
+{
+	return &directory_table[ file_record(index_of_directory, file_index) ].files[ file_index % MAX_FILES_IN_DIR ];
+}
+
+static unsigned long file_home(int index_of_directory, int file_index)	//slot of the file index the file hashes to
+{
+	struct cs1550_file_directory *file = get_file(index_of_directory, file_index);
+
+	return hash_file_name(file->fname, file->fext) & (contents_of[ index_of_directory ].index_size - 1);
+}
+
+static void index_file(int index_of_directory, int file_index)	//puts file file_index of the directory into its file index
+{
+	directory_contents *contents = &contents_of[ index_of_directory ];
+	unsigned long slot = file_home(index_of_directory, file_index);
+
+	while( contents->index[ slot ] != -1 )	//linear probing until an empty slot
+	{
+		slot = (slot + 1) & (contents->index_size - 1);
+	}
+	contents->index[ slot ] = file_index;
+}
+
+static int rebuild_file_index(int index_of_directory, int size)	//makes the file index of the directory size slots big and reinserts every file, the old index stays if there is no memory, returns 0 or -ENOMEM
+{
+	directory_contents *contents = &contents_of[ index_of_directory ];
+	int *index = malloc(size * sizeof(int));
+	int count;
+
+	if( index == NULL )
+	{
+		return -ENOMEM;
+	}
+	free(contents->index);
+	contents->index = index;
+	contents->index_size = size;
+
+	for(count = 0; count < size; count++)
+	{
+		contents->index[ count ] = -1;	//empty slot
+	}
+	for(count = 0; count < contents->nFiles; count++)
+	{
+		index_file(index_of_directory, count);
+	}
+	return 0;
+}
+
+static unsigned long find_file_slot(int index_of_directory, int file_index)	//returns the slot of the file index holding file_index, which has to be in it
+{
+	directory_contents *contents = &contents_of[ index_of_directory ];
+	unsigned long slot = file_home(index_of_directory, file_index);
+
+	while( contents->index[ slot ] != file_index )
+	{
+		slot = (slot + 1) & (contents->index_size - 1);
+	}
+	return slot;
+}
+
+static void unindex_file(int index_of_directory, int file_index)	//takes file file_index out of the file index, moving later probes back so no tombstone is left
+{
+	directory_contents *contents = &contents_of[ index_of_directory ];
+	unsigned long mask = contents->index_size - 1;
+	unsigned long hole = find_file_slot(index_of_directory, file_index);
+	unsigned long slot = hole;
+	unsigned long home;
+
+	for( ; ; )
+	{
+		slot = (slot + 1) & mask;
+		if( contents->index[ slot ] == -1 )
+		{
+			break;
+		}
+
+		//the file in slot can fill the hole only if its probe from home passed over the hole
+		home = file_home(index_of_directory, contents->index[ slot ]);
+		if( ((slot - home) & mask) >= ((slot - hole) & mask) )
+		{
+			contents->index[ hole ] = contents->index[ slot ];
+			hole = slot;
+		}
+	}
+	contents->index[ hole ] = -1;
+}
+
+static inode_owner *find_owner(long block)	//the owner of the inode at block, NULL if nothing holds the file, owner_lock must be held
+{
+	inode_owner *owner;
+
+	for(owner = owner_table[ block & (owner_table_size - 1) ]; owner != NULL && owner->block != block; owner = owner->next);
+	return owner;
+}
+
+static inode_owner *hold_owner(long block, int index_of_directory, int file_index)	//the owner of the inode at block, made for file file_index of the directory if nothing held the file, NULL if there is no memory for it, owner_lock must be held
+{
+	inode_owner *owner = find_owner(block);
+	inode_owner **grown;
+	inode_owner *next;
+	long slot;
+
+	if( owner != NULL )
+	{
+		return owner;
+	}
+
+	if( owner_count >= owner_table_size )	//keep the chains short, the old table is used on if there is no memory for a bigger one
+	{
+		grown = calloc(owner_table_size * 2, sizeof(inode_owner *));
+		if( grown != NULL )
+		{
+			for(slot = 0; slot < owner_table_size; slot++)
+			{
+				for(owner = owner_table[ slot ]; owner != NULL; owner = next)
+				{
+					next = owner->next;
+					owner->next = grown[ owner->block & (owner_table_size * 2 - 1) ];
+					grown[ owner->block & (owner_table_size * 2 - 1) ] = owner;
+				}
+			}
+			free(owner_table);
+			owner_table = grown;
+			owner_table_size *= 2;
+		}
+	}
+
+	owner = malloc(sizeof(inode_owner));
+	if( owner == NULL )
+	{
+		return NULL;
+	}
+	owner->block = block;
+	owner->index_of_directory = index_of_directory;
+	owner->file_index = file_index;
+	owner->lookups = 0;
+	owner->opens = 0;
+	owner->orphaned = 0;
+	owner->map_version = 1;
+	owner->pending = NULL;
+	owner->next = owner_table[ block & (owner_table_size - 1) ];
+	owner_table[ block & (owner_table_size - 1) ] = owner;
+	owner_count++;
+	return owner;
+}
+
+static void put_owner(inode_owner *owner)	//takes owner out of owner_table and frees it if nothing holds the file anymore, owner_lock must be held
+{
+	inode_owner **link;
+
+	if( owner->lookups > 0 || owner->opens > 0 || owner->orphaned || owner->pending != NULL )
+	{
+		return;
+	}
+	for(link = &owner_table[ owner->block & (owner_table_size - 1) ]; *link != owner; link = &(*link)->next);
+	*link = owner->next;
+	free(owner);
+	owner_count--;
+}
+
+static void set_owner(int index_of_directory, int file_index)	//records that file file_index of the directory owns its inode block, if something holds the file, the directory must be locked for writing
+{
+	long block = get_file(index_of_directory, file_index)->nInodeBlock / BLOCK_SIZE;
+	inode_owner *owner;
+
+	pthread_mutex_lock(&owner_lock);
+	owner = find_owner(block);
+	if( owner != NULL )
+	{
+		owner->index_of_directory = index_of_directory;
+		owner->file_index = file_index;
+	}
+	pthread_mutex_unlock(&owner_lock);
+}
+
+static int disown_inode(long block)	//records that the file whose inode is block was unlinked, returns 1 if its blocks can be freed now and 0 if the kernel still holds lookups of it or it is open
+{
+	inode_owner *owner;
+	int free_now = 1;
+
+	pthread_mutex_lock(&owner_lock);
+	owner = find_owner(block);
+	if( owner != NULL )
+	{
+		owner->index_of_directory = -1;
+		owner->file_index = -1;
+		free_now = owner->lookups == 0 && owner->opens == 0;
+		owner->orphaned = !free_now;
+	}
+	pthread_mutex_unlock(&owner_lock);
+
+	return free_now;
+}
+
+static int hold_inode(long block, int index_of_directory, int file_index)	//counts one more lookup of file file_index of the directory, whose inode is block, the directory must be locked so it can not be unlinked meanwhile, returns 0 or -ENOMEM
+{
+	inode_owner *owner;
+
+	pthread_mutex_lock(&owner_lock);
+	owner = hold_owner(block, index_of_directory, file_index);
+	if( owner != NULL )
+	{
+		owner->lookups++;
+	}
+	pthread_mutex_unlock(&owner_lock);
+	return owner != NULL ? 0 : -ENOMEM;
+}
+
+static open_file *pending_of(struct cs1550_file_directory *file)	//the open holding appends to file that have no blocks yet, NULL if there is none, the file must be locked
+{
+	inode_owner *owner;
+	open_file *handle;
+
+	pthread_mutex_lock(&owner_lock);
+	owner = find_owner(file->nInodeBlock / BLOCK_SIZE);
+	handle = owner != NULL ? owner->pending : NULL;
+	pthread_mutex_unlock(&owner_lock);
+	return handle;
+}
+
+static size_t file_size(struct cs1550_file_directory *file)	//how big file is to everyone, what it has on disk and what is appended in memory, the file must be locked
+{
+	open_file *handle = pending_of(file);
+
+	return file->fsize + (handle != NULL ? handle->pending_size : 0);
+}
+
+static void clear_pending(long block)	//empties the pending data held for the file whose inode is block, once it is written or the file is freed, its directory must be locked for writing
+{
+	inode_owner *owner;
+	open_file *handle;
+
+	pthread_mutex_lock(&owner_lock);
+	owner = find_owner(block);
+	handle = owner != NULL ? owner->pending : NULL;
+	if( handle != NULL )
+	{
+		owner->pending = NULL;
+		pending_total -= handle->pending_size;
+		put_owner(owner);
+	}
+	pthread_mutex_unlock(&owner_lock);
+
+	if( handle != NULL )
+	{
+		free(handle->pending);
+		handle->pending = NULL;
+		handle->pending_size = 0;
+		handle->pending_capacity = 0;
+	}
+}
+
+static int hold_pending(open_file *handle, struct cs1550_file_directory *file, const char *buf, size_t size)	//appends size bytes of buf to what handle holds for file, no other open may hold any, the directory must be locked for writing, returns 0 or -ENOMEM if they do not fit in memory
+{
+	long block = file->nInodeBlock / BLOCK_SIZE;
+	size_t capacity = handle->pending_capacity > 0 ? handle->pending_capacity : BLOCK_SIZE;
+	char *grown;
+
+	pthread_mutex_lock(&owner_lock);
+	if( pending_total + size > config.delalloc_bytes )	//memory is running low, this write gets its blocks now
+	{
+		pthread_mutex_unlock(&owner_lock);
+		return -ENOMEM;
+	}
+	pending_total += size;
+	pthread_mutex_unlock(&owner_lock);
+
+	while( capacity < handle->pending_size + size )
+	{
+		capacity *= 2;
+	}
+	if( capacity != handle->pending_capacity )
+	{
+		grown = realloc(handle->pending, capacity);
+		if( grown == NULL )
+		{
+			pthread_mutex_lock(&owner_lock);
+			pending_total -= size;
+			pthread_mutex_unlock(&owner_lock);
+			return -ENOMEM;
+		}
+		handle->pending = grown;
+		handle->pending_capacity = capacity;
+	}
+
+	memcpy(handle->pending + handle->pending_size, buf, size);
+	handle->pending_size += size;
+
+	pthread_mutex_lock(&owner_lock);
+	find_owner(block)->pending = handle;	//it is open, so it has an owner
+	pthread_mutex_unlock(&owner_lock);
+	return 0;
+}
+
+static int open_directory(int index_of_directory)	//fills contents_of for the directory that starts at index_of_directory by following its chain of records, returns 0 or -ENOMEM
+{
+	directory_contents *contents = &contents_of[ index_of_directory ];
+	int record = index_of_directory;
+	int size = FILE_INDEX_START_SIZE;
+	int *records;
+	int count;
+
+	contents->record_count = 0;
+	contents->nFiles = 0;
+
+	do
+	{
+		records = realloc(contents->records, (contents->record_count + 1) * sizeof(int));
+		if( records == NULL )
+		{
+			return -ENOMEM;
+		}
+		contents->records = records;
+		contents->records[ contents->record_count++ ] = record;
+		contents->nFiles += directory_table[ record ].nFiles;
+		record = directory_table[ record ].nNextRecord;
+	}
+	while( record > 0 && record < directory_count );
+
+	for(count = 0; count < contents->nFiles; count++)	//every file owns its inode
+	{
+		set_owner(index_of_directory, count);
+	}
+
+	while( contents->nFiles * 2 > size )	//keep the index at most half full
+	{
+		size *= 2;
+	}
+	return rebuild_file_index(index_of_directory, size);
+}
+
+static void close_directories(void)	//frees contents_of, called at unmount
+{
+	int count;
+
+	for(count = 0; count < contents_count; count++)
+	{
+		free(contents_of[ count ].records);
+		free(contents_of[ count ].index);
+	}
+	free(contents_of);
+	contents_of = NULL;
+	contents_count = 0;
+}
+
+static void load_directory_table(void)	//reads all of .directories into directory_table, called once at mount
+{
+	cs1550_directory_entry current_directory;	//directory to be read
+	int size = DIRECTORY_INDEX_START_SIZE;	//slots for the index
+	int count;
+	int res;
+
+	directory_count = 0;
+
+	res = rebuild_directory_index(size);
+
+	//reads one directory_entry struct after another until the end of .directories
+	while( res == 0 && read_at(directory_fd, &current_directory, sizeof(current_directory), (off_t) directory_count * sizeof(current_directory)) == 0 )
+	{
+		res = append_directory_table(&current_directory) < 0 ? -ENOMEM : 0;
+	}
+
+	for(count = 0; res == 0 && count < directory_count; count++)	//only now are the records every chain goes through loaded
+	{
+		if( is_directory_record(count) )
+		{
+			res = open_directory(count);
+		}
+	}
+
+	if( res != 0 )	//a directory left out would look empty
+	{
+		errno = -res;
+		perror("directory table");
+		exit(1);
+	}
+}
+
+static cs1550_directory_entry get_directory_entry(int index)	//returns the directory entry at the index
+{
+	return directory_table[ index ];
+}
+
+int locate_directory(char *directory)	//locates and returns index of struct in .directories, -1 means not located
+{
+	unsigned long slot = hash_name(directory) & (directory_index_size - 1);
+
+	count_stat(COUNT_DIRECTORY_LOOKUPS, 1);
+	while( directory_index[ slot ] != -1 )	//probe until an empty slot
+	{
+		count_stat(COUNT_DIRECTORY_PROBES, 1);
+		if( strcmp(directory_table[ directory_index[ slot ] ].dname+1, directory) == 0 )	//checks if this is the directory we are looking for
+		{
+			return directory_index[ slot ];
+		}
+		slot = (slot + 1) & (directory_index_size - 1);
+	}
+	return -1;
+}
+
+int locate_file(int index_of_directory, char *filename, char *extension)	//locates and returns index of file in the directory at index_of_directory, -1 means not located
+{
+	directory_contents *contents;
+	struct cs1550_file_directory *file;
+	unsigned long slot;
+
+	if( index_of_directory == -1 )	//directory is not there
+	{
+		return -1;
+	}
+
+	contents = &contents_of[ index_of_directory ];
+	slot = hash_file_name(filename, extension) & (contents->index_size - 1);
+
+	count_stat(COUNT_FILE_LOOKUPS, 1);
+	while( contents->index[ slot ] != -1 )	//probe until an empty slot
+	{
+		count_stat(COUNT_FILE_PROBES, 1);
+		file = get_file(index_of_directory, contents->index[ slot ]);
+		//checks if filename and extension match
+		if( strcmp(filename, file->fname) == 0 && strcmp(extension, file->fext) == 0 )
+		{
+			return contents->index[ slot ];
+		}
+		slot = (slot + 1) & (contents->index_size - 1);
+	}
+	return -1;
+}
+
+static int copy_path_part(const char *from, char *to, int size, const char *stops)	//copies from up to a char in stops (or the end) into to, which holds size chars and the nul, returns how many chars were read or -1 if they did not fit
+{
+	int length = 0;
+
+	while( from[ length ] != '\0' && strchr(stops, from[ length ]) == NULL )
+	{
+		if( length < size )
+		{
+			to[ length ] = from[ length ];
+		}
+		length++;
+	}
+	to[ length < size ? length : size ] = '\0';
+
+	return length <= size ? length : -1;
+}
+
+static int parse_path(const char *path, char *directory, char *filename, char *extension, int *too_long)	//splits path into /directory/filename.extension in one pass, returns how many slashes it has
+{
+	const char *at = path;	//the next char to look at
+	int slash_count = 0;
+	int length;
+	int count;
+
+	directory[0] = filename[0] = extension[0] = '\0';
+	*too_long = 0;
+
+	for(count = 0; path[ count ] != '\0'; count++)	//to check the directory is not under root
+	{
+		if( path[ count ] == '/' )
+		{
+			slash_count++;
+		}
+	}
+
+	if( *at == '/' )
+	{
+		at++;
+		length = copy_path_part(at, directory, MAX_FILENAME, "/");
+		*too_long |= length == -1;
+		at += strcspn(at, "/");
+	}
+
+	if( *at == '/' )	//the filename is everything up to the first dot, like sscanf("%[^.]") did
+	{
+		at++;
+		length = copy_path_part(at, filename, MAX_FILENAME, ".");
+		*too_long |= length == -1;
+		at += strcspn(at, ".");
+
+		if( *at == '.' )
+		{
+			*too_long |= copy_path_part(at + 1, extension, MAX_EXTENSION, "") == -1;
+		}
+	}
+	return slash_count;
+}
+
+static int path_cache_slot(const char *path)	//where path goes in path_cache
+{
+	return hash_name(path) & (PATH_CACHE_SIZE - 1);
+}
+
+static int path_cache_lookup(const char *path, meta_entry *attribute, long *size)	//fills attribute and size from what path resolved to last time, returns 1 if it is cached and 0 if not
+{
+	path_cache_entry *entry = &path_cache[ path_cache_slot(path) ];
+	int hit;
+
+	pthread_mutex_lock(&path_cache_lock);
+	hit = entry->path[0] != '\0' && strcmp(entry->path, path) == 0;
+	if( hit )
+	{
+		*attribute = entry->attribute;
+		*size = entry->size;
+	}
+	pthread_mutex_unlock(&path_cache_lock);
+	count_stat(hit ? COUNT_PATH_CACHE_HITS : COUNT_PATH_CACHE_MISSES, 1);
+	return hit;
+}
+
+static void path_cache_insert(const char *path, meta_entry *attribute, long size)	//remembers what path resolved to, called with the locks of the lookup still held
+{
+	path_cache_entry *entry = &path_cache[ path_cache_slot(path) ];
+
+	pthread_mutex_lock(&path_cache_lock);
+	strcpy(entry->path, path);	//it is at most MAX_PATH_LENGTH, only the canonical spelling of a path is inserted
+	entry->attribute = *attribute;
+	entry->attribute.locked = NO_LOCK;
+	entry->size = size;
+	pthread_mutex_unlock(&path_cache_lock);
+}
+
+static void path_cache_forget(const char *path)	//drops path, mknod calls this so a cached miss is not served after the file is made
+{
+	path_cache_entry *entry = &path_cache[ path_cache_slot(path) ];
+
+	pthread_mutex_lock(&path_cache_lock);
+	if( strcmp(entry->path, path) == 0 )
+	{
+		entry->path[0] = '\0';
+	}
+	pthread_mutex_unlock(&path_cache_lock);
+}
+
+static void path_cache_set_size(const char *path, long size)	//changes the size remembered for path, if it is cached
+{
+	path_cache_entry *entry = &path_cache[ path_cache_slot(path) ];
+
+	pthread_mutex_lock(&path_cache_lock);
+	if( strcmp(entry->path, path) == 0 )
+	{
+		entry->size = size;
+	}
+	pthread_mutex_unlock(&path_cache_lock);
+}
+
+static void file_path(char *canonical, int index_of_directory, struct cs1550_file_directory *file)	//spells the path of file the one way the path cache keeps it, canonical holds MAX_PATH_LENGTH + 2 chars
+{
+	snprintf(canonical, MAX_PATH_LENGTH + 2, file->fext[0] != '\0' ? "%s/%s.%s" : "%s/%s", directory_table[ index_of_directory ].dname, file->fname, file->fext);
+}
+
+static void path_cache_forget_file(int index_of_directory, struct cs1550_file_directory *file)	//drops the one spelling of the path of file that can be cached, unlink calls this for the file it removes and the one it moves
+{
+	char canonical[MAX_PATH_LENGTH + 2];
+
+	file_path(canonical, index_of_directory, file);
+	path_cache_forget(canonical);
+}
+
+static void path_cache_forget_missing(const char *directory_path)	//drops every cached miss at or under directory_path, mkdir calls this once it exists
+{
+	size_t length = strlen(directory_path);
+	int slot;
+
+	pthread_mutex_lock(&path_cache_lock);
+	for(slot = 0; slot < PATH_CACHE_SIZE; slot++)
+	{
+		if( path_cache[ slot ].attribute.index_of_directory == -1 && strncmp(path_cache[ slot ].path, directory_path, length) == 0 &&
+			(path_cache[ slot ].path[ length ] == '\0' || path_cache[ slot ].path[ length ] == '/') )
+		{
+			path_cache[ slot ].path[0] = '\0';
+		}
+	}
+	pthread_mutex_unlock(&path_cache_lock);
+}
+
+static void lock_directory(int index_of_directory, int lock)	//takes the lock of the directory for reading or writing, the table lock must already be held
+{
+	if( lock == WRITE_LOCK )
+	{
+		pthread_rwlock_wrlock(directory_locks[ index_of_directory ]);
+	}
+	else
+	{
+		pthread_rwlock_rdlock(directory_locks[ index_of_directory ]);
+	}
+}
+
+static meta_entry find_correct_directory(const char *path, int lock)	//finds and returns the correct directory that the calling funciton wanted, locking it with lock until release_directory()
+{
+	char directory[MAX_FILENAME + 1];	//name of directory we are looking for
+	char filename[MAX_FILENAME + 1];	//name of file we are looking for
+	char extension[MAX_EXTENSION + 1];	//file extension we are looking for
+	char canonical[MAX_PATH_LENGTH + 2];	//path spelled the one way the cache keeps it
+	int too_long;	//set when a part of the path is too long to name anything
+	long size = 0;	//of the file found, for the path cache
+	meta_entry cached;	//what the path cache has for path
+
+	meta_entry search_return;	//the meta_entry struct that holds the directory to be returned
+	search_return.file_index = -1;	//set so that parameter path is also not a file index
+	search_return.index_of_directory = -1;	//starts at -1, and if its an actually directory it will be set to a real index
+	search_return.locked = NO_LOCK;
+
+	search_return.slash_count = parse_path(path, directory, filename, extension, &too_long);	//tokenizes and stores the strings for the directory we are looking for
+
+	if( too_long )	//can not be in the table, nothing to look up
+	{
+		return search_return;
+	}
+
+	if( lock != NO_LOCK )	//directory indexes stay valid until the table lock is dropped
+	{
+		pthread_rwlock_rdlock(&directory_table_lock);
+	}
+
+	search_return.index_of_directory = locate_directory(directory);	//finds directory
+
+	if( lock != NO_LOCK && search_return.index_of_directory > -1 )	//lock the directory before looking at its files
+	{
+		lock_directory(search_return.index_of_directory, lock);
+		search_return.locked = lock;
+	}
+
+	if( search_return.slash_count > 1 && path_cache_lookup(path, &cached, &size) )	//path is not under root and was looked up before, no need to go through the files
+	{
+		search_return.file_index = cached.file_index;
+	}
+	else if( search_return.slash_count > 1 )	//path is not under root
+	{
+		search_return.file_index = locate_file(search_return.index_of_directory, filename, extension);	//finds file
+		if( search_return.file_index > -1 )
+		{
+			size = file_size( get_file(search_return.index_of_directory, search_return.file_index) );
+		}
+
+		//only the one spelling of the path is cached, so mknod and unlink know every entry a file has
+		snprintf(canonical, sizeof(canonical), extension[0] != '\0' ? "/%s/%s.%s" : "/%s/%s", directory, filename, extension);
+		if( search_return.slash_count == 2 && strcmp(canonical, path) == 0 )
+		{
+			path_cache_insert(path, &search_return, size);
+		}
+	}
+	else if( path[1] != '\0' && strcmp(path + 1, directory) == 0 )	//directories are cached too so getattr does not have to lock
+	{
+		path_cache_insert(path, &search_return, 0);
+	}
+
+	if( lock != NO_LOCK && search_return.locked == NO_LOCK )	//nothing found to lock so the table can go too
+	{
+		pthread_rwlock_unlock(&directory_table_lock);
+	}
+
+	return search_return;
+}
+
+static void release_directory(meta_entry *attribute)	//drops the locks find_correct_directory() or find_file_by_block() took
+{
+	if( attribute->locked != NO_LOCK && attribute->index_of_directory == -1 )	//an orphaned file, which only has orphan_lock
+	{
+		pthread_mutex_unlock(&orphan_lock);
+		attribute->locked = NO_LOCK;
+	}
+	else if( attribute->locked != NO_LOCK )
+	{
+		pthread_rwlock_unlock(directory_locks[ attribute->index_of_directory ]);
+		pthread_rwlock_unlock(&directory_table_lock);
+		attribute->locked = NO_LOCK;
+	}
+}
+
+static meta_entry find_file_by_block(long block, int lock)	//finds the file whose inode is at block and locks its directory with lock until release_directory(), index_of_directory is -1 if it is not linked and then orphan_lock is held if the file is orphaned
+{
+	meta_entry found;	//what owner_table says, checked again once it is locked
+	inode_owner owner;
+	inode_owner *now;
+	int same;
+
+	found.slash_count = 2;
+
+	for( ; ; )
+	{
+		pthread_mutex_lock(&owner_lock);
+		now = find_owner(block);
+		owner.index_of_directory = now != NULL ? now->index_of_directory : -1;	//nothing holds the file, the kernel and open files only name files they hold
+		owner.file_index = now != NULL ? now->file_index : -1;
+		owner.orphaned = now != NULL ? now->orphaned : 0;
+		pthread_mutex_unlock(&owner_lock);
+
+		found.index_of_directory = owner.index_of_directory;
+		found.file_index = owner.file_index;
+		found.locked = NO_LOCK;
+
+		if( owner.index_of_directory == -1 && !owner.orphaned )	//no such file, nothing to lock
+		{
+			return found;
+		}
+
+		if( owner.index_of_directory == -1 )
+		{
+			pthread_mutex_lock(&orphan_lock);
+		}
+		else
+		{
+			pthread_rwlock_rdlock(&directory_table_lock);
+			lock_directory(owner.index_of_directory, lock);
+		}
+		found.locked = lock;
+
+		//the owner can only have changed before the lock was taken
+		pthread_mutex_lock(&owner_lock);
+		now = find_owner(block);
+		same = now != NULL && now->index_of_directory == owner.index_of_directory && now->file_index == owner.file_index && now->orphaned == owner.orphaned;
+		pthread_mutex_unlock(&owner_lock);
+
+		if( same )
+		{
+			return found;
+		}
+		release_directory(&found);
+	}
+}
+
+static int orphan_file(long block, struct cs1550_file_directory *orphan)	//fills orphan with what the inode at block says, for a file that is no longer in a directory, returns 0 or -EIO
+{
+	cs1550_inode inode;
+
+	memset(orphan, 0, sizeof(struct cs1550_file_directory));
+	orphan->nInodeBlock = block * BLOCK_SIZE;
+	if( read_metadata(&inode, sizeof(inode), orphan->nInodeBlock) != 0 )
+	{
+		return -EIO;
+	}
+	orphan->fsize = inode.size;
+	return 0;
+}
+
+static struct cs1550_file_directory *found_file(meta_entry *attribute, long block, struct cs1550_file_directory *orphan)	//returns the entry of the file find_file_by_block() found, orphan if it is orphaned, NULL if there is none
+{
+	if( attribute->index_of_directory > -1 )
+	{
+		return get_file(attribute->index_of_directory, attribute->file_index);
+	}
+	if( attribute->locked != NO_LOCK && orphan_file(block, orphan) == 0 )
+	{
+		return orphan;
+	}
+	return NULL;
+}
+
+static meta_entry find_directory_by_index(long index, int lock)	//locks the directory at index of directory_table with lock until release_directory(), index_of_directory is -1 if there is no such directory
+{
+	meta_entry found;
+
+	found.slash_count = 1;
+	found.file_index = -1;
+	found.index_of_directory = -1;
+	found.locked = NO_LOCK;
+
+	pthread_rwlock_rdlock(&directory_table_lock);
+	if( index >= 0 && index < directory_count && is_directory_record(index) )
+	{
+		found.index_of_directory = index;
+		lock_directory(index, lock);
+		found.locked = lock;
+	}
+	else
+	{
+		pthread_rwlock_unlock(&directory_table_lock);
+	}
+	return found;
+}
+
+static int directory_is_full(int index_of_directory)	//returns 1 if every record of the directory is full
+{
+	return contents_of[ index_of_directory ].nFiles == contents_of[ index_of_directory ].record_count * (int) MAX_FILES_IN_DIR;
+}
+
+static int store_directory_record(int index)	//writes record index of directory_table to .directories as part of the transaction of this thread, with a journal it waits in the cache until .journal has it, returns 0 or -EIO
+{
+	int pin = journal_note(JOURNAL_DIRECTORIES, (off_t) index * sizeof(cs1550_directory_entry), sizeof(cs1550_directory_entry));
+
+	if( journal_fd != -1 && cache != NULL )
+	{
+		return cache_record(index, &directory_table[ index ], pin);
+	}
+	return write_at(directory_fd, &directory_table[ index ], sizeof(cs1550_directory_entry), (off_t) index * sizeof(cs1550_directory_entry));
+}
+
+void write_directory_entry(cs1550_directory_entry current_directory, int index)
+{
+	//keep the in memory copy in sync. the name never changes after mkdir so it is left alone, lookups compare it
+	//holding only the table read lock
+	directory_table[ index ].nFiles = current_directory.nFiles;
+	directory_table[ index ].nNextRecord = current_directory.nNextRecord;
+	memcpy(directory_table[ index ].files, current_directory.files, sizeof(current_directory.files));
+	store_directory_record(index);	//rewrite the struct
+}
+
+static int append_directory_record(cs1550_directory_entry *record)	//adds record at the end of directory_table and .directories, the table lock must be held for writing, returns its index or -ENOMEM if the table could not grow
+{
+	int index = append_directory_table(record);
+
+	if( index >= 0 )
+	{
+		store_directory_record(index);	//once it is in the table it is used, like write_directory_entry() does
+	}
+	return index;
+}
+
+static int add_directory_record(int index_of_directory)	//puts one more record for files of the directory at the end of .directories, the table lock must be held for writing, returns 0 or -ENOMEM
+{
+	cs1550_directory_entry new_record;
+	int last = contents_of[ index_of_directory ].records[ contents_of[ index_of_directory ].record_count - 1 ];
+	int index;
+	int *records;
+	directory_contents *contents;
+
+	memset(&new_record, 0, sizeof(new_record));	//no name, no files and no next record
+
+	index = append_directory_record(&new_record);
+	if( index < 0 )
+	{
+		return index;
+	}
+
+	contents = &contents_of[ index_of_directory ];	//appending can move contents_of
+	records = realloc(contents->records, (contents->record_count + 1) * sizeof(int));
+	if( records == NULL )	//the record stays at the end of .directories, empty and in no chain
+	{
+		return -ENOMEM;
+	}
+	contents->records = records;
+	contents->records[ contents->record_count++ ] = index;
+
+	new_record = get_directory_entry( last );	//chain it after what was the last record
+	new_record.nNextRecord = index;
+	write_directory_entry( new_record, last );
+	return 0;
+}
+
+static void fill_directory_stat(struct stat *stbuf)	//the attributes every directory has
+{
+	memset(stbuf, 0, sizeof(struct stat));
+	stbuf->st_mode = S_IFDIR | 0755;
+	stbuf->st_nlink = 2;
+}
+
+static void fill_file_stat(struct stat *stbuf, long size)	//the attributes of a file of size bytes
+{
+	memset(stbuf, 0, sizeof(struct stat));
+	//regular file, probably want to be read and write
+	stbuf->st_mode = S_IFREG | 0666; 
+	stbuf->st_nlink = 1; //file link
+	stbuf->st_size = size; //file size
+}
+
+static void fill_stats_stat(struct stat *stbuf)	//the attributes of /.stats, its size is what it would say now
+{
+	char *text = malloc(STATS_TEXT_SIZE);
+
+	fill_file_stat(stbuf, text != NULL ? render_stats(text, STATS_TEXT_SIZE) : 0);
+	free(text);
+}
+
+/*
+ * Called whenever the system wants to know the file attributes, including
+ * simply whether the file exists or not. 
+ *
+ * man -s 2 stat will show the fields of a stat structure
+ */
+static int cs1550_getattr(const char *path, struct stat *stbuf)
+{
+	int res = -ENOENT;	//sets res to error first, if the directory or file is found then res is set to 0 because there is no error
+
+	memset(stbuf, 0, sizeof(struct stat));
+	//is path the root dir?
+	if (strcmp(path, "/") == 0) {
+		fill_directory_stat(stbuf);
+		res = 0;
+	} 
+
+	else if( strcmp(path, STATS_PATH) == 0 )	//not on .disk, made up from the counters
+	{
+		fill_stats_stat(stbuf);
+		res = 0;
+	}
+
+	else	//is directly under root directory
+	{
+		meta_entry attribute;
+		long size;	//of the file
+
+		if( !path_cache_lookup(path, &attribute, &size) )	//a hit, even for a path that is not there, is answered without taking a lock
+		{
+			attribute = find_correct_directory(path, READ_LOCK);
+			size = attribute.file_index > -1 ? file_size( get_file(attribute.index_of_directory, attribute.file_index) ) : 0;
+			release_directory(&attribute);
+		}
+
+		if(attribute.index_of_directory > -1 && attribute.slash_count == 1)	//means that paramter path is a directory
+		{
+			fill_directory_stat(stbuf);
+			res = 0;	
+		}
+
+		else if(attribute.index_of_directory > -1 && attribute.file_index > -1)//means that parameter path is a file
+		{
+			fill_file_stat(stbuf, size);
+			res = 0; // no error
+		}
+	}
+
+	return res;
+}
+
+static void list_root(void *buf, fuse_fill_dir_t filler, off_t offset)	//filler()s every directory from offset on, see cs1550_readdir()
+{
+	struct stat stbuf;	//attributes of the entry being filled
+	off_t position;	//offset of the entry being filled
+
+	fill_directory_stat(&stbuf);	//every entry of root is a directory
+
+	pthread_rwlock_rdlock(&directory_table_lock);	//names never change once made, so the table lock is enough
+	for(position = offset; position < directory_count + 2; position++)	//filler() every directory in the table
+	{
+		if( position >= 2 && !is_directory_record(position - 2) )	//the other records only hold more files
+		{
+			continue;
+		}
+		stbuf.st_ino = position < 2 ? FUSE_ROOT_ID : DIRECTORY_INO(position - 2);
+		if( filler(buf, position == 0 ? "." : position == 1 ? ".." : directory_table[ position - 2 ].dname + 1, &stbuf, position + 1) )	//buf is full
+		{
+			break;
+		}
+	}
+	pthread_rwlock_unlock(&directory_table_lock);
+}
+
+static void list_files(meta_entry *attribute, void *buf, fuse_fill_dir_t filler, off_t offset)	//filler()s every file of the directory from offset on, the directory must be locked, see cs1550_readdir()
+{
+	directory_contents *contents = &contents_of[ attribute->index_of_directory ];
+	meta_entry listed = *attribute;	//what each file resolves to, for the path cache
+	char canonical[MAX_PATH_LENGTH + 2];	//path of the file
+	struct stat stbuf;	//attributes of the entry being filled
+	off_t position;	//offset of the entry being filled
+	int full;	//set once buf is full
+
+	listed.slash_count = 2;
+	for(position = offset; position < contents->nFiles + 2; position++)	//go through filler() the files, in every record of the directory
+	{
+		struct cs1550_file_directory *file;
+
+		if( position < 2 )
+		{
+			fill_directory_stat(&stbuf);
+			stbuf.st_ino = position == 0 ? DIRECTORY_INO(attribute->index_of_directory) : FUSE_ROOT_ID;
+			full = filler(buf, position == 0 ? "." : "..", &stbuf, position + 1);
+		}
+		else
+		{
+			file = get_file(attribute->index_of_directory, position - 2);
+			fill_file_stat(&stbuf, file_size(file));
+			stbuf.st_ino = FILE_INO(file->nInodeBlock / BLOCK_SIZE);
+			file_path(canonical, attribute->index_of_directory, file);
+			full = filler(buf, canonical + strlen(directory_table[ attribute->index_of_directory ].dname) + 1, &stbuf, position + 1);
+
+			//the getattr that ls -l sends next for this file is answered from the path cache
+			listed.file_index = position - 2;
+			path_cache_insert(canonical, &listed, file_size(file));
+		}
+		if( full )
+		{
+			break;
+		}
+	}
+}
+
+/* 
+ * Called whenever the contents of a directory are desired. Could be from an 'ls'
+ * or could even be when a user hits TAB to do autocompletion
+ *
+ * Every entry is given with its attributes and the offset to go on from after it:
+ * "." is at 0, ".." at 1 and entry i of the directory at i + 2. Once buf is full
+ * filler() returns 1 and the kernel calls again with the offset it stopped at.
+ */
+static int cs1550_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
+			 off_t offset, struct fuse_file_info *fi)
+{
+	//Since we're building with -Wall (all warnings reported) we need
+	//to "use" every parameter, so let's just cast them to void to
+	//satisfy the compiler
+	(void) fi;
+	int res = -ENOENT;
+	
+	//the filler function allows us to add entries to the listing
+	//read the fuse.h file for a description (in the ../include dir)
+	if ( strcmp(path, "/") == 0 )	//means that the path is root, so filler() all subdirectories
+	{
+		list_root(buf, filler, offset);
+		res = 0;
+	}
+
+	else
+	{
+		//add the user stuff (subdirs or files)
+		meta_entry attribute = find_correct_directory(path, READ_LOCK);
+			
+		if(attribute.index_of_directory > -1)	//means that parameter path is a directory(aka subdirectory of root)
+		{
+			list_files(&attribute, buf, filler, offset);
+			res = 0;
+		}
+		release_directory(&attribute);
+	}
+	return res;
+}
+
+/* 
+ * Creates a directory. We can ignore mode since we're not dealing with
+ * permissions, as long as getattr returns appropriate ones for us.
+ */
+static int cs1550_mkdir(const char *path, mode_t mode)
+{
+	int res = 0;
+	cs1550_transaction tx;	//the new directory entry
+	long lsn;
+	(void) mode;
+
+	pthread_rwlock_wrlock(&directory_table_lock);	//nothing else can use the table while it grows
+	begin_transaction(&tx);
+
+	meta_entry attribute = find_correct_directory(path, NO_LOCK);
+
+	if( attribute.slash_count > 1 )	//means not under root, do not give permission
+	{
+		res = -EPERM;
+	}
+
+	else if( strlen(path) > 9 )	//name length is too long, 9 because of beginning "/"
+	{
+		res = -ENAMETOOLONG;
+	}
+
+	else if( strcmp(path, STATS_PATH) == 0 )	//the name is taken by the stats file
+	{
+		res = -EEXIST;
+	}
+
+	else if( attribute.index_of_directory > -1 && attribute.file_index == -1)	//is a directory
+	{
+		res = -EEXIST;
+	}
+
+	else	//append
+	{
+		cs1550_directory_entry current_directory;	//current directory to be appended
+
+		memset(&current_directory, 0, sizeof(current_directory));
+		snprintf(current_directory.dname, sizeof(current_directory.dname), "%s", path);
+		current_directory.nFiles = 0;
+
+		res = append_directory_record(&current_directory);	//append directory, to the in memory table and index too
+		if( res >= 0 )
+		{
+			res = open_directory(res);	//no files yet, just the one record
+			path_cache_forget_missing(path);	//it and anything under it may be cached as missing
+		}
+	}
+
+	lsn = commit_transaction();
+	pthread_rwlock_unlock(&directory_table_lock);
+
+	if( res == 0 )
+	{
+		res = wait_for_journal(lsn);
+	}
+	return res;
+}
+
+/* 
+ * Removes a directory.
+ */
+static int cs1550_rmdir(const char *path)
+{
+	(void) path;
+	return 0;
+}
+
+static void load_bitmap(void)	//reads the bitmap at bitmap_offset of .disk into free_space, called once at mount
+{
+	long count;
+
+	free_space = calloc(bitmap_words, sizeof(uint64_t));	//a copy even with -o mmap, a bit must not reach .disk before .journal has it
+	if( free_space == NULL )
+	{
+		perror("bitmap");
+		exit(1);
+	}
+	read_disk(free_space, bitmap_words * sizeof(uint64_t), bitmap_offset);	//read in bitmap
+
+	for(count = block_count; count < bitmap_words * 64; count++)	//bits past the last block are never free
+	{
+		free_space[ count / 64 ] |= (uint64_t) 1 << (count % 64);
+	}
+
+	free_block_count = 0;
+	for(count = 0; count < bitmap_words; count++)
+	{
+		free_block_count += 64 - __builtin_popcountll( free_space[ count ] );
+	}
+	free_space_dirty = 0;
+}
+
+static void sync_bitmap(void)	//writes free_space back to .disk, only if it changed
+{
+	pthread_mutex_lock(&allocator_lock);
+
+	if( free_space_dirty && write_disk(free_space, bitmap_words * sizeof(uint64_t), bitmap_offset) == 0 )	//writes into bitmap
+	{
+		free_space_dirty = 0;
+	}
+
+	pthread_mutex_unlock(&allocator_lock);
+}
+
+static int sync_backing_files(int checkpoint)	//makes everything written to .disk and .directories so far durable, returns 0 or -errno. what waits for .journal or a transaction stays in the cache and the bitmap words are in .journal, only a checkpoint writes them
+{
+	if( write_back_cache(checkpoint ? LONG_MAX : journal_durable()) != 0 )
+	{
+		return -EIO;
+	}
+	if( checkpoint || journal_fd == -1 )
+	{
+		sync_bitmap();
+	}
+
+	if( disk_map != NULL ? msync(disk_map, disk_size, MS_SYNC) : fdatasync(disk_fd) )
+	{
+		return -errno;
+	}
+	if( fdatasync(directory_fd) )
+	{
+		return -errno;
+	}
+	return 0;
+}
+
+static long range_key(const journal_range *range)	//what the block or record range is in is cached under, -1 for bitmap words which are not cached
+{
+	if( range->target == JOURNAL_DIRECTORIES )
+	{
+		return RECORD_KEY(range->offset / sizeof(cs1550_directory_entry));
+	}
+	return (off_t) range->offset < bitmap_offset ? (long) (range->offset / BLOCK_SIZE) : -1;
+}
+
+int journal_note(int target, off_t offset, size_t length)	//adds a metadata range the handler on this thread changed to its transaction, returns 1 if it is the first range of the transaction in its block or record, which the caller pins in the cache until the commit
+{
+	cs1550_transaction *tx = transaction;
+	journal_range range;
+	int first = 1;	//cleared once a range in the same block or record turns up
+	int count;
+
+	if( tx == NULL || journal_fd == -1 )
+	{
+		return 0;
+	}
+
+	range.target = target;
+	range.offset = offset;
+	range.length = length;
+	for(count = 0; count < tx->count; count++)
+	{
+		if( tx->ranges[ count ].target == range.target && tx->ranges[ count ].offset == range.offset && tx->ranges[ count ].length == range.length )	//already noted, its contents are taken at commit anyway
+		{
+			return 0;
+		}
+		if( first && range_key(&tx->ranges[ count ]) == range_key(&range) )
+		{
+			first = 0;
+		}
+	}
+
+	if( tx->count == JOURNAL_MAX_RANGES || tx->bytes + sizeof(journal_range) + length > JOURNAL_BUFFER_SIZE )	//not pinned either, the commit checkpoints
+	{
+		tx->overflow = 1;
+		return 0;
+	}
+
+	tx->ranges[ tx->count ] = range;
+	tx->count++;
+	tx->bytes += sizeof(journal_range) + length;
+	return first && range_key(&range) != -1;
+}
+
+void begin_transaction(cs1550_transaction *tx)	//starts collecting the metadata this thread changes into tx, waits while a checkpoint is draining the open transactions
+{
+	tx->count = 0;
+	tx->overflow = 0;
+	tx->bytes = 0;
+	transaction = tx;
+
+	if( journal_fd != -1 )
+	{
+		pthread_mutex_lock(&journal_lock);
+		while( journal_draining > 0 )
+		{
+			pthread_cond_wait(&journal_idle_cond, &journal_lock);
+		}
+		journal_open++;
+		pthread_mutex_unlock(&journal_lock);
+	}
+}
+
+static uint64_t journal_checksum(const char *data, size_t size)	//FNV-1a hash of size bytes
+{
+	uint64_t hash = 14695981039346656037ULL;
+
+	while( size-- > 0 )
+	{
+		hash ^= (unsigned char) *data++;
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+static int write_journal_header(void)	//starts .journal over with the next sequence so nothing in it is replayed, returns 0 or -EIO
+{
+	journal_header header;
+
+	memset(&header, 0, sizeof(header));
+	header.magic = JOURNAL_MAGIC;
+	header.sequence = ++journal_sequence;
+
+	if( write_at(journal_fd, &header, sizeof(header), 0) != 0 || fdatasync(journal_fd) != 0 )
+	{
+		return -EIO;
+	}
+	journal_tail = JOURNAL_START;
+	return 0;
+}
+
+static void advance_synced(long lsn)	//moves journal_synced up to lsn, it is read without journal_lock and sync_journal() moves it without it too
+{
+	long synced = __atomic_load_n(&journal_synced, __ATOMIC_ACQUIRE);
+
+	while( synced < lsn && !__atomic_compare_exchange_n(&journal_synced, &synced, lsn, 0, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE) );
+}
+
+static int checkpoint_locked(void)	//makes .disk and .directories durable so the journal can start over, journal_lock must be held and this thread must have no open transaction, returns 0 or -EIO
+{
+	int res = 0;
+
+	//every block, record and bitmap word goes home, so wait until no handler is half way through changing one. the
+	//open transactions hold their directory locks already and only take the inner locks, so they can all get here
+	journal_draining++;
+	while( journal_open > 0 )
+	{
+		pthread_cond_wait(&journal_idle_cond, &journal_lock);
+	}
+
+	//.journal first, a transaction that is only in the page cache must not end up half in .disk
+	if( fdatasync(journal_fd) != 0 )
+	{
+		res = -EIO;
+	}
+	else
+	{
+		advance_synced(journal_lsn);
+		if( sync_backing_files(1) != 0 || write_journal_header() != 0 )
+		{
+			res = -EIO;
+		}
+		pthread_cond_broadcast(&journal_synced_cond);
+	}
+
+	journal_draining--;
+	pthread_cond_broadcast(&journal_idle_cond);
+	return res;
+}
+
+static void capture_range(journal_range *range, char *data)	//copies the current contents of range into data
+{
+	if( range->target == JOURNAL_DIRECTORIES )	//the table is always up to date and the caller still holds the directory
+	{
+		memcpy(data, (char *) directory_table + range->offset, range->length);
+	}
+	else if( (off_t) range->offset >= bitmap_offset )	//bitmap words are only in memory until sync_bitmap()
+	{
+		pthread_mutex_lock(&allocator_lock);
+		memcpy(data, (char *) free_space + (range->offset - bitmap_offset), range->length);
+		pthread_mutex_unlock(&allocator_lock);
+	}
+	else
+	{
+		read_metadata(data, range->length, range->offset);
+	}
+}
+
+static void unpin_transaction(cs1550_transaction *tx, long lsn)	//the blocks and records tx pinned in the cache can be written back once .journal is durable up to lsn
+{
+	long key;
+	int count;
+	int before;
+
+	for(count = 0; count < tx->count; count++)	//journal_note() pinned each block or record at its first range
+	{
+		key = range_key(&tx->ranges[ count ]);
+		for(before = 0; key != -1 && before < count && range_key(&tx->ranges[ before ]) != key; before++);
+		if( key != -1 && before == count )
+		{
+			cache_unpin(key, lsn);
+		}
+	}
+}
+
+static long log_transaction(cs1550_transaction *tx)	//appends tx to .journal, journal_lock must be held and there must be room, returns its lsn or -EIO
+{
+	journal_transaction header;	//goes before the ranges
+	struct iovec vector[2];	//the header and the ranges
+	size_t used = 0;	//how much of journal_buffer is filled
+	long lsn;
+	int count;
+
+	for(count = 0; count < tx->count; count++)	//contents are taken now so the last commit of a shared bitmap word has its latest value
+	{
+		memcpy(journal_buffer + used, &tx->ranges[ count ], sizeof(journal_range));
+		used += sizeof(journal_range);
+		capture_range(&tx->ranges[ count ], journal_buffer + used);
+		used += tx->ranges[ count ].length;
+	}
+
+	memset(&header, 0, sizeof(header));
+	header.magic = JOURNAL_MAGIC;
+	header.sequence = journal_sequence;
+	header.count = tx->count;
+	header.length = used;
+	header.checksum = journal_checksum(journal_buffer, used);
+
+	vector[ 0 ].iov_base = &header;
+	vector[ 0 ].iov_len = sizeof(header);
+	vector[ 1 ].iov_base = journal_buffer;
+	vector[ 1 ].iov_len = used;
+	if( vector_at(journal_fd, vector, 2, journal_tail, 1) != 0 )	//header and ranges in one pwritev
+	{
+		lsn = -EIO;
+	}
+	else
+	{
+		journal_tail += sizeof(header) + used;
+		lsn = journal_lsn + sizeof(header) + used;
+		__atomic_store_n(&journal_lsn, lsn, __ATOMIC_RELEASE);	//sync_journal() reads it without journal_lock
+		count_stat(COUNT_JOURNAL_COMMITS, 1);
+	}
+	return lsn;
+}
+
+long commit_transaction(void)	//writes the transaction of this thread to .journal, returns what to give wait_for_journal() or -EIO
+{
+	cs1550_transaction *tx = transaction;
+	long lsn;
+
+	transaction = NULL;
+
+	if( journal_fd == -1 )	//no journal, the bitmap goes to .disk right away like it did before
+	{
+		sync_bitmap();
+		return 0;
+	}
+
+	pthread_mutex_lock(&journal_lock);
+	if( tx != NULL && --journal_open == 0 && journal_draining > 0 )	//a checkpoint can go ahead
+	{
+		pthread_cond_broadcast(&journal_idle_cond);
+	}
+
+	if( tx == NULL || (tx->count == 0 && !tx->overflow) )	//nothing changed
+	{
+		pthread_mutex_unlock(&journal_lock);
+		return 0;
+	}
+
+	if( tx->overflow )	//too big to log, make everything durable in place instead
+	{
+		lsn = checkpoint_locked() == 0 ? 0 : -EIO;
+	}
+	else if( journal_tail + (off_t) (sizeof(journal_transaction) + tx->bytes) > JOURNAL_SIZE && checkpoint_locked() != 0 )	//no room left, start over
+	{
+		lsn = -EIO;
+	}
+	else
+	{
+		lsn = log_transaction(tx);
+	}
+
+	pthread_mutex_unlock(&journal_lock);
+	unpin_transaction(tx, lsn > 0 ? lsn : 0);	//a failed commit lets them go too, or they would never leave the cache
+	return lsn;
+}
+
+int wait_for_journal(long lsn)	//returns once .journal is durable up to lsn, one fdatasync covers every thread waiting at the time, returns 0 or -EIO
+{
+	long target;	//how far the fdatasync this thread does covers
+	int res = 0;
+
+	if( lsn <= 0 || journal_fd == -1 )	//nothing to wait for, or the commit failed
+	{
+		return lsn < 0 ? (int) lsn : 0;
+	}
+
+	pthread_mutex_lock(&journal_lock);
+	while( journal_durable() < lsn && res == 0 )
+	{
+		if( journal_syncing )	//another thread is syncing, its sync or the next one covers this transaction
+		{
+			pthread_cond_wait(&journal_synced_cond, &journal_lock);
+			continue;
+		}
+
+		journal_syncing = 1;
+		target = journal_lsn;	//everything written so far, not just this transaction
+		pthread_mutex_unlock(&journal_lock);
+
+		if( fdatasync(journal_fd) != 0 )
+		{
+			res = -EIO;
+		}
+		count_stat(COUNT_JOURNAL_SYNCS, 1);
+
+		pthread_mutex_lock(&journal_lock);
+		journal_syncing = 0;
+		if( res == 0 )
+		{
+			advance_synced(target);
+		}
+		pthread_cond_broadcast(&journal_synced_cond);
+	}
+	pthread_mutex_unlock(&journal_lock);
+	return res;
+}
+
+long journal_durable(void)	//how far .journal is known to be durable, blocks cached with an lsn up to it can go to .disk
+{
+	return __atomic_load_n(&journal_synced, __ATOMIC_ACQUIRE);
+}
+
+long sync_journal(void)	//makes everything written to .journal so far durable, without journal_lock so the cache can call it holding cache_lock, returns how far it is durable now or -EIO
+{
+	long target = __atomic_load_n(&journal_lsn, __ATOMIC_ACQUIRE);	//written to .journal before it was set
+
+	if( journal_fd == -1 || journal_durable() >= target )
+	{
+		return journal_durable();
+	}
+	if( fdatasync(journal_fd) != 0 )
+	{
+		return -EIO;
+	}
+	count_stat(COUNT_JOURNAL_SYNCS, 1);
+	advance_synced(target);
+	return target;
+}
+
+static int force_journal(void)	//makes every transaction written so far durable, returns 0 or -EIO
+{
+	long lsn;
+
+	pthread_mutex_lock(&journal_lock);
+	lsn = journal_lsn;
+	pthread_mutex_unlock(&journal_lock);
+
+	return wait_for_journal(lsn);
+}
+
+static int replay_journal(void)	//redoes every whole transaction left in .journal on .disk and .directories, then starts it over, called once at mount. returns 0, or -EIO with .journal left as it was so the next mount tries again
+{
+	journal_header header;
+	journal_transaction tx;
+	journal_range range;
+	off_t offset = JOURNAL_START;	//where the next transaction is in .journal
+	size_t used;	//how much of the transaction has been applied
+	int applied = 0;	//how many transactions were redone
+	int res = 0;
+	uint32_t count;
+
+	if( read_at(journal_fd, &header, sizeof(header), 0) != 0 || header.magic != JOURNAL_MAGIC )	//new or empty journal
+	{
+		header.sequence = 0;
+	}
+	else
+	{
+		//stop at the first transaction that is from an old sequence, torn or past the end
+		while( res == 0 && offset + (off_t) sizeof(tx) <= JOURNAL_SIZE && read_at(journal_fd, &tx, sizeof(tx), offset) == 0 &&
+			tx.magic == JOURNAL_MAGIC && tx.sequence == header.sequence && tx.length <= JOURNAL_BUFFER_SIZE &&
+			read_at(journal_fd, journal_buffer, tx.length, offset + sizeof(tx)) == 0 && journal_checksum(journal_buffer, tx.length) == tx.checksum )
+		{
+			used = 0;
+			for(count = 0; count < tx.count && used + sizeof(range) <= tx.length; count++)
+			{
+				memcpy(&range, journal_buffer + used, sizeof(range));
+				used += sizeof(range);
+				if( used + range.length > tx.length )
+				{
+					break;
+				}
+				if( write_at(range.target == JOURNAL_DIRECTORIES ? directory_fd : disk_fd, journal_buffer + used, range.length, range.offset) != 0 )
+				{
+					res = -EIO;
+					break;
+				}
+				used += range.length;
+			}
+			offset += sizeof(tx) + tx.length;
+			applied++;
+		}
+	}
+
+	if( res == 0 && applied > 0 )	//the redone metadata has to be durable before the journal forgets it
+	{
+		if( fdatasync(disk_fd) != 0 || fdatasync(directory_fd) != 0 )
+		{
+			res = -EIO;
+		}
+		else
+		{
+			fprintf(stderr, "cs1550: replayed %d transactions from .journal\n", applied);
+		}
+	}
+
+	journal_sequence = header.sequence;
+	if( res != 0 || write_journal_header() != 0 )	//once the header is written the transactions are gone, so only after they are home
+	{
+		fprintf(stderr, "cs1550: could not replay .journal, .disk and .directories are left alone until it can be\n");
+		return -EIO;
+	}
+	return 0;
+}
+
+static void close_journal(void)	//checkpoints and closes .journal at unmount
+{
+	if( journal_fd == -1 )
+	{
+		return;
+	}
+
+	pthread_mutex_lock(&journal_lock);
+	checkpoint_locked();
+	pthread_mutex_unlock(&journal_lock);
+
+	close(journal_fd);
+	journal_fd = -1;
+}
+
+static int is_block_free(long block)	//returns 1 if the block is free, 0 if it is in use
+{
+	return (free_space[ block / 64 ] & ((uint64_t) 1 << (block % 64))) == 0;
+}
+
+static void mark_block(long block, int in_use)	//sets the block to used or free in free_space
+{
+	uint64_t bit = (uint64_t) 1 << (block % 64);
+
+	journal_note(JOURNAL_DISK, bitmap_offset + (block / 64) * sizeof(uint64_t), sizeof(uint64_t));	//the word goes in the journal instead of the whole bitmap going to .disk
+
+	if( in_use && is_block_free(block) )
+	{
+		free_space[ block / 64 ] |= bit;
+		free_block_count--;
+		count_stat(COUNT_BLOCKS_ALLOCATED, 1);
+		free_space_dirty = 1;
+	}
+	else if( !in_use && !is_block_free(block) )
+	{
+		free_space[ block / 64 ] &= ~bit;
+		free_block_count++;
+		count_stat(COUNT_BLOCKS_FREED, 1);
+		free_space_dirty = 1;
+	}
+}
+
+static uint64_t fingerprint_of(long block)	//fingerprint block is indexed under in the dedup index, 0 if none, allocator_lock must be held
+{
+	block_entry *entry = find_block_entry(&block_fingerprints, block);
+
+	return entry != NULL ? (uint64_t) entry->value : 0;
+}
+
+static void forget_fingerprint(long block)	//takes block out of the dedup index, its slot there is stale from now on, allocator_lock must be held
+{
+	block_entry *entry = find_block_entry(&block_fingerprints, block);
+
+	if( entry != NULL )
+	{
+		remove_block_entry(&block_fingerprints, entry);
+	}
+}
+
+static long shares_of(long block)	//how many data pointers besides the first point at block, allocator_lock must be held
+{
+	block_entry *entry = shared_block_count > 0 ? find_block_entry(&block_shares, block) : NULL;
+
+	return entry != NULL ? entry->value : 0;
+}
+
+static void release_block(long block)	//drops the hold of one data pointer on block, it is freed when no other pointer shares it, allocator_lock must be held
+{
+	block_entry *entry = shared_block_count > 0 ? find_block_entry(&block_shares, block) : NULL;
+
+	if( entry != NULL )	//someone else still points at it, its data and cached copy stay
+	{
+		if( --entry->value == 0 )
+		{
+			remove_block_entry(&block_shares, entry);
+			shared_block_count--;
+		}
+		return;
+	}
+
+	if( dedup_index != NULL )	//whatever gets the block next holds other data
+	{
+		forget_fingerprint(block);
+	}
+	forget_cached_block(block);
+	mark_block(block, 0);
+}
+
+static int share_block(long block)	//counts one more data pointer pointing at block, which is in use, allocator_lock must be held, returns 0 or -ENOMEM
+{
+	block_entry *entry = add_block_entry(&block_shares, block);
+
+	if( entry == NULL )
+	{
+		return -ENOMEM;
+	}
+	shared_block_count += entry->value == 0;
+	entry->value++;
+	return 0;
+}
+
+static uint64_t rotate_left(uint64_t word, int bits)	//word turned bits to the left, the bits going out come back in on the right
+{
+	return (word << bits) | (word >> (64 - bits));
+}
+
+static uint64_t fingerprint_block(const char *data)	//64 bit hash of one block of data the way xxHash64 mixes its input, four lanes at a time, never 0 so 0 can stand for none
+{
+	const uint64_t prime1 = 0x9E3779B185EBCA87ULL;
+	const uint64_t prime2 = 0xC2B2AE3D27D4EB4FULL;
+	const uint64_t prime3 = 0x165667B19E3779F9ULL;
+	uint64_t lanes[4] = { prime1 + prime2, prime2, 0, -prime1 };
+	uint64_t word;
+	uint64_t hash;
+	int offset;
+	int lane;
+
+	for(offset = 0; offset < BLOCK_SIZE; offset += 4 * sizeof(word))
+	{
+		for(lane = 0; lane < 4; lane++)
+		{
+			memcpy(&word, data + offset + lane * sizeof(word), sizeof(word));	//need not be aligned
+			lanes[ lane ] = rotate_left(lanes[ lane ] + word * prime2, 31) * prime1;
+		}
+	}
+
+	hash = rotate_left(lanes[ 0 ], 1) + rotate_left(lanes[ 1 ], 7) + rotate_left(lanes[ 2 ], 12) + rotate_left(lanes[ 3 ], 18);
+	hash ^= hash >> 33;	//so every bit of the lanes reaches the low bits the index uses
+	hash *= prime2;
+	hash ^= hash >> 29;
+	hash *= prime3;
+	hash ^= hash >> 32;
+	return hash != 0 ? hash : 1;
+}
+
+static int rebuild_dedup_index(void)	//puts the blocks of dedup_index that are not stale in a new one, big enough that at most half of it is used, returns 0 or -ENOMEM, allocator_lock must be held
+{
+	dedup_entry *old = dedup_index;
+	long old_size = dedup_index_size;
+	long live = 0;	//slots that are not empty or stale
+	long size = DEDUP_INDEX_START_SIZE;
+	long slot;
+	long to;
+
+	for(slot = 0; slot < old_size; slot++)
+	{
+		live += old[ slot ].block != -1 && fingerprint_of(old[ slot ].block) == old[ slot ].fingerprint;
+	}
+	while( live * 2 >= size )
+	{
+		size *= 2;
+	}
+
+	dedup_index = malloc(size * sizeof(dedup_entry));
+	if( dedup_index == NULL )	//go on with the old one
+	{
+		dedup_index = old;
+		return -ENOMEM;
+	}
+	for(slot = 0; slot < size; slot++)
+	{
+		dedup_index[ slot ].block = -1;
+	}
+	dedup_index_size = size;
+	dedup_index_used = live;
+
+	for(slot = 0; slot < old_size; slot++)
+	{
+		if( old[ slot ].block != -1 && fingerprint_of(old[ slot ].block) == old[ slot ].fingerprint )
+		{
+			for(to = old[ slot ].fingerprint & (size - 1); dedup_index[ to ].block != -1; to = (to + 1) & (size - 1));
+			dedup_index[ to ] = old[ slot ];
+		}
+	}
+	free(old);
+	return 0;
+}
+
+static void index_block(uint64_t fingerprint, long block)	//puts block, whose data has fingerprint, in dedup_index in place of the block it had under that fingerprint, allocator_lock must be held
+{
+	block_entry *entry;
+	long slot;
+
+	if( dedup_index_used * 4 >= dedup_index_size * 3 && rebuild_dedup_index() != 0 && dedup_index_used + 1 >= dedup_index_size )	//full and can not grow, the block is just not shared
+	{
+		return;
+	}
+
+	for(slot = fingerprint & (dedup_index_size - 1); dedup_index[ slot ].block != -1; slot = (slot + 1) & (dedup_index_size - 1))
+	{
+		if( dedup_index[ slot ].fingerprint == fingerprint )
+		{
+			break;
+		}
+	}
+
+	if( dedup_index[ slot ].block == -1 )
+	{
+		dedup_index_used++;
+	}
+	else if( fingerprint_of(dedup_index[ slot ].block) == fingerprint )	//it is not indexed anymore
+	{
+		forget_fingerprint(dedup_index[ slot ].block);
+	}
+	dedup_index[ slot ].fingerprint = fingerprint;
+	dedup_index[ slot ].block = block;
+
+	entry = add_block_entry(&block_fingerprints, block);
+	if( entry != NULL )	//without it the slot is stale and the block is just not shared
+	{
+		entry->value = (long) fingerprint;
+	}
+}
+
+static long find_duplicate(uint64_t fingerprint, const char *data)	//returns the block dedup_index has under fingerprint if it holds the same bytes as data, -1 if there is none, allocator_lock must be held so no write can change it before it is shared
+{
+	long slot;
+	long block;
+	char held[BLOCK_SIZE];	//what the block holds
+
+	for(slot = fingerprint & (dedup_index_size - 1); dedup_index[ slot ].block != -1; slot = (slot + 1) & (dedup_index_size - 1))
+	{
+		if( dedup_index[ slot ].fingerprint != fingerprint )
+		{
+			continue;
+		}
+
+		block = dedup_index[ slot ].block;
+		if( fingerprint_of(block) == fingerprint && read_disk(held, BLOCK_SIZE, block * BLOCK_SIZE) == 0 && memcmp(held, data, BLOCK_SIZE) == 0 )	//a stale slot, or one whose fingerprint only is the same, leaves later slots to look at
+		{
+			return block;
+		}
+	}
+	return -1;
+}
+
+static long scan_bitmap(long block, int want_free)	//returns the first block at or after block that is free (or used), block_count if there is none
+{
+	long word = block / 64;
+	uint64_t bits;
+
+	if( block >= block_count )
+	{
+		return block_count;
+	}
+	count_stat(COUNT_BITMAP_SCANS, 1);
+
+	//look at a whole word at a time, flipping it when looking for free blocks so the wanted blocks are always the set bits
+	bits = want_free ? ~free_space[ word ] : free_space[ word ];
+	bits &= ~(uint64_t) 0 << (block % 64);	//ignore the blocks before block in the first word
+
+	while( bits == 0 )
+	{
+		word++;
+		if( word == bitmap_words )
+		{
+			count_stat(COUNT_BITMAP_WORDS, word - block / 64);
+			return block_count;
+		}
+		bits = want_free ? ~free_space[ word ] : free_space[ word ];
+	}
+	count_stat(COUNT_BITMAP_WORDS, word - block / 64 + 1);
+
+	block = word * 64 + __builtin_ctzll(bits);	//lowest set bit is the first wanted block
+	return block < block_count ? block : block_count;
+}
+
+static long find_free_run(long length)	//returns the first block of length free blocks in a row, -1 if there is no such run
+{
+	long start;
+	long end;
+
+	if( length > free_block_count )	//can not fit no matter how the free blocks are laid out
+	{
+		return -1;
+	}
+
+	start = scan_bitmap(0, 1);
+	while( start < block_count )
+	{
+		end = scan_bitmap(start, 0);	//the run of free blocks stops at the next used block
+		if( end - start >= length )
+		{
+			return start;
+		}
+		start = scan_bitmap(end, 1);
+	}
+	return -1;
+}
+
+long get_first_free_block(void)	//marks the first free block as used and returns its address, -1 if the disk is full
+{
+	long count;
+
+	pthread_mutex_lock(&allocator_lock);
+	count = scan_bitmap(0, 1);	//will find the first free block
+	if( count < block_count )
+	{
+		mark_block(count, 1);	//now in use
+	}
+	pthread_mutex_unlock(&allocator_lock);
+
+	if( count == block_count )
+	{
+		return -1;
+	}
+
+	return count * BLOCK_SIZE;	//returns the addres of the block
+}
+
+/* 
+ * Does the actual creation of a file. Mode and dev can be ignored.
+ *
+ */
+static int cs1550_mknod(const char *path, mode_t mode, dev_t dev)
+{
+	(void) mode;
+	(void) dev;
+	char directory[MAX_FILENAME + 1];	//name of directory we are looking for
+	char filename[MAX_FILENAME + 1];	//name of file we are looking for
+	char extension[MAX_EXTENSION + 1];	//file extension we are looking for
+	
+	int res = 0;
+	int too_long;	//set when the filename or extension is too long
+	cs1550_transaction tx;	//the bitmap word, inode and directory entry the new file changes
+	long lsn;
+	meta_entry attribute = find_correct_directory(path, WRITE_LOCK);
+	int table_locked = 0;	//set when the table lock is held for writing instead of attribute being locked
+
+	if( attribute.slash_count == 2 && attribute.file_index == -1 && attribute.index_of_directory > -1 && directory_is_full(attribute.index_of_directory) )
+	{
+		//the directory needs another record, which can move the table, so nothing else may be using it. look again
+		//afterwards since the file could have been made in between
+		release_directory(&attribute);
+		pthread_rwlock_wrlock(&directory_table_lock);
+		table_locked = 1;
+		attribute = find_correct_directory(path, NO_LOCK);
+	}
+
+	begin_transaction(&tx);
+	parse_path(path, directory, filename, extension, &too_long);	//tokenizes and stores the strings for the directory we are looking for	
+
+	if( attribute.slash_count == 1 )	//under root, do not give permission
+	{
+		res = -EPERM;
+	}
+
+	else if( too_long )	//name length is too long
+	{
+		res = -ENAMETOOLONG;
+	}
+
+	else if( attribute.file_index > -1)	//is already a file
+	{
+		res = -EEXIST;
+	}
+
+	else if( attribute.index_of_directory == -1 )	//directory is not there
+	{
+		res = -ENOENT;
+	}
+
+	else if( directory_is_full(attribute.index_of_directory) && (!table_locked || (res = add_directory_record(attribute.index_of_directory)) != 0) )	//no room in the directory and no record could be added
+	{
+		res = table_locked ? res : -ENOSPC;
+	}
+
+	else	//create file
+	{
+		directory_contents *contents = &contents_of[ attribute.index_of_directory ];
+		int record = file_record(attribute.index_of_directory, contents->nFiles);	//the new file goes right after the last one
+		cs1550_directory_entry directory_entry = get_directory_entry( record );
+		struct cs1550_file_directory *file = &directory_entry.files[ directory_entry.nFiles ];
+				
+		strcpy(file->fname, filename); //put filename in array index
+		strcpy(file->fext, extension);	//put extension in array index
+//		file->fsize = BLOCK_SIZE;	//size of block
+
+		file->fsize = 0;	//size of block
+		if( (contents->nFiles + 1) * 2 > contents->index_size )	//keep the index at most half full so probes stay short, it grows before the file can be left out of it
+		{
+			res = rebuild_file_index(attribute.index_of_directory, contents->index_size * 2);
+		}
+		file->nInodeBlock = res == 0 ? get_first_free_block() : -1;	//gets the first free block for the inode
+
+		if( res == 0 && file->nInodeBlock == -1 )	//no block left to give the file
+		{
+			res = -ENOSPC;
+		}
+		else if( res == 0 && write_empty_inode( file->nInodeBlock ) != 0 )	//the file is not made, its block goes back
+		{
+			pthread_mutex_lock(&allocator_lock);
+			release_block(file->nInodeBlock / BLOCK_SIZE);
+			pthread_mutex_unlock(&allocator_lock);
+			res = -EIO;
+		}
+		else if( res == 0 )
+		{
+			directory_entry.nFiles++;	//increment the amount of files  
+
+			write_directory_entry( directory_entry, record );	//write the record the file is in
+			contents->nFiles++;
+			set_owner(attribute.index_of_directory, contents->nFiles - 1);
+			index_file(attribute.index_of_directory, contents->nFiles - 1);
+			path_cache_forget(path);	//it may be cached as missing
+		}
+	}
+
+	lsn = commit_transaction();
+	if( table_locked )
+	{
+		pthread_rwlock_unlock(&directory_table_lock);
+	}
+	else
+	{
+		release_directory(&attribute);
+	}
+
+	if( res == 0 )	//wait without the directory so other creates can join the same fdatasync
+	{
+		res = wait_for_journal(lsn);
+	}
+	return res;
+}
+
+/*
+ * Deletes a file
+ */
+static int cs1550_unlink(const char *path)
+{
+	int res = 0;
+	cs1550_transaction tx;	//the freed bitmap words and the directory entry
+	long lsn;
+	meta_entry attribute = find_correct_directory(path, WRITE_LOCK);
+
+	begin_transaction(&tx);
+
+	if( attribute.slash_count == 1 )	//the path is a directory, overwrite res
+	{
+		res = -EISDIR;
+	}
+
+ 	else if( attribute.file_index == -1 )	//file not found(or wrong path but goes under same error)
+	{
+		res = -ENOENT;
+	}   	
+	
+	else	//remove file
+	{
+		directory_contents *contents = &contents_of[ attribute.index_of_directory ];
+		int index = attribute.file_index;
+		int last = contents->nFiles - 1;	//the last file takes the place of the removed one so nothing else moves
+		int record = file_record(attribute.index_of_directory, index);
+		int last_record = file_record(attribute.index_of_directory, last);
+		cs1550_directory_entry directory_entry;
+
+		if( disown_inode( get_file(attribute.index_of_directory, index)->nInodeBlock / BLOCK_SIZE ) )	//an orphan keeps its blocks until the kernel forgets it and it is closed
+		{
+			clear_pending( get_file(attribute.index_of_directory, index)->nInodeBlock / BLOCK_SIZE );	//appends no one can read anymore
+			free_file_blocks( get_file(attribute.index_of_directory, index) );	//give the blocks back before the entry is gone
+		}
+		else
+		{
+			flush_pending(&attribute);	//the orphan is read from its inode, so its appends need blocks
+		}
+		path_cache_forget_file( attribute.index_of_directory, get_file(attribute.index_of_directory, index) );
+		unindex_file( attribute.index_of_directory, index );
+
+		if( index != last )
+		{
+			path_cache_forget_file( attribute.index_of_directory, get_file(attribute.index_of_directory, last) );	//its index changes
+			contents->index[ find_file_slot(attribute.index_of_directory, last) ] = index;
+
+			directory_entry = get_directory_entry( record );
+			directory_entry.files[ index % MAX_FILES_IN_DIR ] = *get_file(attribute.index_of_directory, last);
+			write_directory_entry( directory_entry, record );	//write the record the last file moved into
+			set_owner(attribute.index_of_directory, index);
+		}
+
+		directory_entry = get_directory_entry( last_record );
+		directory_entry.nFiles--;	//remove the file from count
+		write_directory_entry( directory_entry, last_record );	//write the record the last file left
+		contents->nFiles--;
+	}
+
+	lsn = commit_transaction();
+	release_directory(&attribute);
+
+	if( res == 0 )
+	{
+		res = wait_for_journal(lsn);
+	}
+	return res;
+}
+
+static open_file *open_file_of(struct fuse_file_info *fi)	//the open_file cs1550_open() put in fi, NULL if there is none
+{
+	return fi != NULL ? (open_file *) (uintptr_t) fi->fh : NULL;
+}
+
+static int open_stats(struct fuse_file_info *fi)	//makes the open_file of /.stats, which keeps what it says now so reads of it agree with each other, returns 0 or -ENOMEM
+{
+	open_file *handle = calloc(1, sizeof(open_file));	//freed by cs1550_release()
+
+	if( handle == NULL || (handle->stats = malloc(STATS_TEXT_SIZE)) == NULL )
+	{
+		free(handle);
+		return -ENOMEM;
+	}
+	pthread_mutex_init(&handle->lock, NULL);
+	handle->inode = -1;
+	handle->stats_size = render_stats(handle->stats, STATS_TEXT_SIZE);
+
+	fi->fh = (uintptr_t) handle;
+	fi->direct_io = 1;	//read to the end of the text whatever size getattr said
+	return 0;
+}
+
+static int read_stats(open_file *handle, char *buf, size_t size, off_t offset)	//reads up to size bytes at offset of what /.stats said when handle was opened, returns how many were read
+{
+	if( offset >= (off_t) handle->stats_size )
+	{
+		return 0;
+	}
+	if( offset + size > handle->stats_size )
+	{
+		size = handle->stats_size - offset;
+	}
+	memcpy(buf, handle->stats + offset, size);
+	return size;
+}
+
+static int load_open_map(open_file *handle, struct cs1550_file_directory *file, cs1550_file_map *map)	//load_file_map() that uses the copy handle (NULL for none) keeps while the inode has not changed, the file must be locked
+{
+	long block = file->nInodeBlock / BLOCK_SIZE;
+	unsigned long version;	//of the inode now
+	int res = 0;
+
+	if( handle == NULL || handle->inode != block )
+	{
+		return load_file_map(file, map);
+	}
+
+	pthread_mutex_lock(&owner_lock);
+	version = find_owner(block)->map_version;	//it is open, so it has an owner, the version only changes while the file is locked for writing
+	pthread_mutex_unlock(&owner_lock);
+	pthread_mutex_lock(&handle->lock);
+	if( handle->map_version == version )	//no inode or indirect block to read
+	{
+		memcpy(map, &handle->map, sizeof(cs1550_file_map));
+	}
+	else
+	{
+		res = load_file_map(file, map);
+		if( res == 0 )
+		{
+			memcpy(&handle->map, map, sizeof(cs1550_file_map));
+			handle->map_version = version;
+		}
+	}
+	pthread_mutex_unlock(&handle->lock);
+	return res;
+}
+
+static int read_file(open_file *handle, struct cs1550_file_directory *file, char *buf, size_t size, off_t offset)	//reads up to size bytes at offset of file, which must be locked, through handle (NULL for none), returns how many were read or -EIO
+{
+	cs1550_file_map map;	//where the blocks of the file are
+	open_file *pending = pending_of(file);	//holds what comes after fsize, if anything does
+	size_t on_disk;	//how many of the bytes come from blocks
+
+	if( offset >= (off_t) file_size(file) )	//nothing past the end of the file
+	{
+		return 0;
+	}
+
+	if( offset + size > file_size(file) )	//only read up to the end of the file
+	{
+		size = file_size(file) - offset;
+	}
+	on_disk = offset >= (off_t) file->fsize ? 0 : (offset + size > file->fsize ? file->fsize - offset : size);
+
+	//read in data
+	if( on_disk > 0 && (load_open_map( handle, file, &map ) != 0 || copy_blocks( &map, buf, on_disk, offset, 0 ) != 0) )
+	{
+		return -EIO;
+	}
+
+	if( on_disk > 0 && handle != NULL && readahead_limit > 0 && !(map.inode.flags & INODE_INLINE) )	//an inode with the data in it has no blocks to read ahead
+	{
+		read_ahead(handle, &map, offset, on_disk);
+	}
+
+	if( size > on_disk )	//the rest was appended and is still in memory
+	{
+		memcpy(buf + on_disk, pending->pending + (offset + on_disk - file->fsize), size - on_disk);
+	}
+	return size;
+}
+
+/* 
+ * Read size bytes from file into buf starting from offset
+ *
+ */
+static int cs1550_read(const char *path, char *buf, size_t size, off_t offset,
+			  struct fuse_file_info *fi)
+{
+	open_file *handle = open_file_of(fi);
+	struct cs1550_file_directory orphan;	//what is left of an open file that was unlinked
+	struct cs1550_file_directory *file;
+	meta_entry attribute;
+
+	if( handle != NULL && handle->stats != NULL )
+	{
+		return read_stats(handle, buf, size, offset);
+	}
+
+	if( handle != NULL )	//resolved at open, no path to parse
+	{
+		attribute = find_file_by_block(handle->inode, READ_LOCK);	//reads of files in the same directory go on side by side
+		file = found_file(&attribute, handle->inode, &orphan);
+		size = file != NULL ? read_file( handle, file, buf, size, offset ) : -ENOENT;
+		release_directory(&attribute);
+		return size;
+	}
+
+	attribute = find_correct_directory(path, READ_LOCK);
+
+	//check to make sure path exists
+	if(attribute.index_of_directory > -1 && attribute.slash_count == 1)	//means that paramter path is a directory
+	{
+		size = -EISDIR;
+	}
+
+	else if( attribute.file_index == -1 )	//file not found
+	{
+		size = -ENOENT;
+	}
+
+	else
+	{
+		size = read_file( NULL, get_file( attribute.index_of_directory, attribute.file_index ), buf, size, offset );
+	}
+
+	release_directory(&attribute);
+	return size;
+}
+
+int is_next_block_free(long start_address)	//returns 1 if the next block is free, returns 0 if it is not
+{
+	long next_bitmap_index = (start_address / BLOCK_SIZE) + 1;	//gets the index of the next block
+	int freedom;
+
+	pthread_mutex_lock(&allocator_lock);
+	freedom = next_bitmap_index < block_count && is_block_free(next_bitmap_index);
+	pthread_mutex_unlock(&allocator_lock);
+
+	return freedom;
+}
+
+long find_next_free_block(long start_address)	//finds address of next free block because next block returned false
+{
+	long index;
+
+	pthread_mutex_lock(&allocator_lock);
+	index = scan_bitmap(start_address / BLOCK_SIZE, 1);	//first free block at or after the start block
+	pthread_mutex_unlock(&allocator_lock);
+
+	if( index < block_count )
+	{
+		start_address = index * BLOCK_SIZE;	//found free block so set address
+	}
+	return start_address;	//returns the addres of the block
+}
+
+long allocate_block(long goal)	//marks the first free block at or after goal (or anywhere if there is none) as used, returns it or -1 if the disk is full
+{
+	long block;
+
+	pthread_mutex_lock(&allocator_lock);	//finding and claiming the block is one step so two threads never get the same one
+
+	block = scan_bitmap(goal, 1);
+	if( block == block_count )	//nothing after goal so wrap around
+	{
+		block = scan_bitmap(0, 1);
+	}
+
+	if( block == block_count )
+	{
+		block = -1;
+	}
+	else
+	{
+		mark_block(block, 1);
+	}
+
+	pthread_mutex_unlock(&allocator_lock);
+	return block;
+}
+
+static int store_indirect(cs1550_file_map *map)	//writes the indirect block in map back if it changed, returns 0 or -EIO
+{
+	if( map->indirect_dirty )
+	{
+		if( write_metadata(&map->indirect, sizeof(cs1550_indirect_block), map->indirect_block * BLOCK_SIZE) != 0 )
+		{
+			map->error = -EIO;
+			return -EIO;
+		}
+		map->indirect_dirty = 0;
+	}
+	return 0;
+}
+
+static int load_indirect(cs1550_file_map *map, long which)	//makes the which-th indirect block of the file, which it must have, the one in map, the one there before is written back first, returns 0 or -EIO
+{
+	long block;
+
+	if( which == map->indirect_index )
+	{
+		return 0;
+	}
+	if( store_indirect(map) != 0 )
+	{
+		return -EIO;
+	}
+
+	block = NEEDS_DOUBLE_INDIRECT(map->inode.nBlocks) ? (long) map->double_indirect.pointers[ which ] : (long) map->inode.pointers[ INDIRECT_POINTER ];
+	if( read_metadata(&map->indirect, sizeof(cs1550_indirect_block), block * BLOCK_SIZE) != 0 )
+	{
+		map->indirect_index = -1;
+		map->error = -EIO;
+		return -EIO;
+	}
+	map->indirect_index = which;
+	map->indirect_block = block;
+	return 0;
+}
+
+int load_file_map(struct cs1550_file_directory *file, cs1550_file_map *map)	//reads the inode of the file, and its double indirect block and first indirect block if it has them, into map
+{
+	map->nInodeBlock = file->nInodeBlock;
+	map->indirect_index = -1;
+	map->indirect_dirty = 0;
+	map->double_dirty = 0;
+	map->error = 0;
+
+	if( read_metadata(&map->inode, sizeof(cs1550_inode), file->nInodeBlock) != 0 )	//read the inode
+	{
+		return -EIO;
+	}
+
+	if( NEEDS_DOUBLE_INDIRECT(map->inode.nBlocks) && read_metadata(&map->double_indirect, sizeof(cs1550_indirect_block), map->inode.pointers[ INDIRECT_POINTER ] * BLOCK_SIZE) != 0 )
+	{
+		return -EIO;
+	}
+
+	if( map->inode.nBlocks > DIRECT_POINTERS )	//file is big enough to use the indirect block
+	{
+		return load_indirect(map, 0);
+	}
+	return 0;
+}
+
+int store_file_map(cs1550_file_map *map)	//writes the inode in map back, and the indirect blocks if they changed, returns 0 or -EIO
+{
+	inode_owner *owner;
+
+	if( map->error != 0 || store_indirect(map) != 0 )	//a data pointer was lost, the inode must not point at the wrong blocks
+	{
+		return -EIO;
+	}
+	if( map->double_dirty )
+	{
+		if( write_metadata(&map->double_indirect, sizeof(cs1550_indirect_block), map->inode.pointers[ INDIRECT_POINTER ] * BLOCK_SIZE) != 0 )
+		{
+			return -EIO;
+		}
+		map->double_dirty = 0;
+	}
+	pthread_mutex_lock(&owner_lock);
+	owner = find_owner(map->nInodeBlock / BLOCK_SIZE);
+	if( owner != NULL )	//copies open files hold are stale now, a file nothing holds has no copies
+	{
+		owner->map_version++;
+	}
+	pthread_mutex_unlock(&owner_lock);
+	return write_metadata(&map->inode, sizeof(cs1550_inode), map->nInodeBlock);	//write the inode
+}
+
+int write_empty_inode(long address)	//writes the inode of a file with no blocks at address, returns 0 or -EIO
+{
+	cs1550_inode inode;
+
+	memset(&inode, 0, sizeof(inode));
+	return write_metadata(&inode, sizeof(inode), address);
+}
+
+long get_file_block(cs1550_file_map *map, long index)	//returns the block number of the index-th data block of the file, HOLE_BLOCK if it has none there or its indirect block can not be read, which sets map->error
+{
+	if( index >= map->inode.nBlocks )	//past the last pointer, only a hole can be there
+	{
+		return HOLE_BLOCK;
+	}
+	if( index < DIRECT_POINTERS )
+	{
+		return map->inode.pointers[ index ];
+	}
+	if( load_indirect(map, (index - DIRECT_POINTERS) / POINTERS_IN_INDIRECT) != 0 )
+	{
+		return HOLE_BLOCK;
+	}
+	return map->indirect.pointers[ (index - DIRECT_POINTERS) % POINTERS_IN_INDIRECT ];
+}
+
+static void start_double_indirect(cs1550_file_map *map, long block)	//makes block the double indirect block of the file, pointing at the indirect block it had, before its first data pointer past that one
+{
+	memset(&map->double_indirect, 0, sizeof(cs1550_indirect_block));
+	map->double_indirect.pointers[ 0 ] = map->inode.pointers[ INDIRECT_POINTER ];
+	map->inode.pointers[ INDIRECT_POINTER ] = block;
+	map->double_dirty = 1;
+}
+
+static int start_indirect(cs1550_file_map *map, long block)	//makes block the empty indirect block the next data pointer of the file is in, the double indirect block has to be there already if it is needed, returns 0 or -EIO
+{
+	long which = (map->inode.nBlocks - DIRECT_POINTERS) / POINTERS_IN_INDIRECT;
+
+	if( store_indirect(map) != 0 )	//the one it is done with
+	{
+		return -EIO;
+	}
+	if( which == 0 )
+	{
+		map->inode.pointers[ INDIRECT_POINTER ] = block;
+	}
+	else
+	{
+		map->double_indirect.pointers[ which ] = block;
+		map->double_dirty = 1;
+	}
+	memset(&map->indirect, 0, sizeof(cs1550_indirect_block));
+	map->indirect_index = which;
+	map->indirect_block = block;
+	map->indirect_dirty = 1;
+	return 0;
+}
+
+static long file_goal(cs1550_file_map *map, long index)	//block the index-th data block of the file should be put at, where it would be if the file were in a row from the closest block before it
+{
+	long before;
+	long block;
+
+	for(before = index - 1; before >= 0; before--)	//holes and the lengths of compressed chunks have no place on disk, look past them
+	{
+		block = get_file_block(map, before);
+		if( block != HOLE_BLOCK && !IS_COMPRESSED_CHUNK(block) )
+		{
+			return block + (index - before);
+		}
+	}
+	return map->nInodeBlock / BLOCK_SIZE + 1 + index;
+}
+
+static int add_indirect_block(cs1550_file_map *map)	//gives the file the indirect block its next data pointer is the first of, and the double indirect block if that is the first past the single indirect one, returns 0, or -ENOSPC with the file as it was or -EIO
+{
+	long goal = file_goal(map, map->inode.nBlocks);
+	long double_block = -1;
+	long block;
+
+	if( map->inode.nBlocks == DIRECT_POINTERS + POINTERS_IN_INDIRECT )
+	{
+		double_block = allocate_block(goal);
+		if( double_block == -1 )
+		{
+			return -ENOSPC;
+		}
+		goal = double_block + 1;
+	}
+
+	block = allocate_block(goal);
+	if( block == -1 )
+	{
+		if( double_block != -1 )
+		{
+			pthread_mutex_lock(&allocator_lock);
+			mark_block(double_block, 0);
+			pthread_mutex_unlock(&allocator_lock);
+		}
+		return -ENOSPC;
+	}
+
+	if( double_block != -1 )
+	{
+		start_double_indirect(map, double_block);
+	}
+	return start_indirect(map, block);
+}
+
+static void set_file_block(cs1550_file_map *map, long index, long block)	//points the index-th data pointer of the file, which it must have, at block, if its indirect block can not be read map->error is set instead
+{
+	if( index < DIRECT_POINTERS )
+	{
+		map->inode.pointers[ index ] = block;
+	}
+	else if( load_indirect(map, (index - DIRECT_POINTERS) / POINTERS_IN_INDIRECT) == 0 )
+	{
+		map->indirect.pointers[ (index - DIRECT_POINTERS) % POINTERS_IN_INDIRECT ] = block;
+		map->indirect_dirty = 1;
+	}
+}
+
+static long allocate_run(long goal, long length)	//marks length free blocks in a row as used, at goal if they are all free there and else the first such run, returns the first or -1 if there is no run that long
+{
+	long block;
+	long count;
+
+	pthread_mutex_lock(&allocator_lock);
+
+	if( goal >= 0 && goal + length <= block_count && scan_bitmap(goal, 0) >= goal + length )	//no used block between goal and the end of the run
+	{
+		block = goal;
+	}
+	else
+	{
+		block = find_free_run(length);
+	}
+
+	for(count = 0; block != -1 && count < length; count++)
+	{
+		mark_block(block + count, 1);
+	}
+
+	pthread_mutex_unlock(&allocator_lock);
+	return block;
+}
+
+static void add_file_block(cs1550_file_map *map, long block)	//makes block (or HOLE_BLOCK) the next data block of the file, the indirect block it goes in has to be there already if it is needed
+{
+	map->inode.nBlocks++;
+	set_file_block(map, map->inode.nBlocks - 1, block);
+}
+
+int grow_file(cs1550_file_map *map, long blocks)	//gives the file blocks more data blocks at its end, in one run on disk when there is one, returns 0 or an error
+{
+	long goal;	//block the new one should be put at, right after the last one so the file stays in a row when it can
+	long block;
+	long indirect;	//next of the indirect blocks the run needs too
+	int res;
+
+	if( blocks > 1 && map->inode.nBlocks + blocks <= MAX_FILE_BLOCKS )	//several blocks at once, from a flush, try to keep them all in a row
+	{
+		goal = file_goal(map, map->inode.nBlocks);
+		indirect = INDIRECT_BLOCKS(map->inode.nBlocks + blocks) - INDIRECT_BLOCKS(map->inode.nBlocks) + (NEEDS_DOUBLE_INDIRECT(map->inode.nBlocks + blocks) && !NEEDS_DOUBLE_INDIRECT(map->inode.nBlocks));
+		block = allocate_run(goal, blocks + indirect);
+		if( block != -1 )
+		{
+			indirect = block + blocks;	//after the data so they do not split the run
+			while( blocks-- > 0 )
+			{
+				if( map->inode.nBlocks == DIRECT_POINTERS + POINTERS_IN_INDIRECT )	//the first past the single indirect block
+				{
+					start_double_indirect(map, indirect++);
+				}
+				if( STARTS_INDIRECT(map->inode.nBlocks) && start_indirect(map, indirect++) != 0 )
+				{
+					return -EIO;
+				}
+				add_file_block(map, block++);
+			}
+			return 0;
+		}
+	}
+
+	while( blocks > 0 )
+	{
+		if( map->inode.nBlocks == MAX_FILE_BLOCKS )	//no pointer left to put the block in
+		{
+			return -EFBIG;
+		}
+
+		if( STARTS_INDIRECT(map->inode.nBlocks) )	//first block past the direct pointers, or past an indirect block, needs an indirect block
+		{
+			res = add_indirect_block(map);
+			if( res != 0 )
+			{
+				return res;
+			}
+		}
+
+		goal = STARTS_INDIRECT(map->inode.nBlocks) ? map->indirect_block + 1 : file_goal(map, map->inode.nBlocks);
+		block = allocate_block(goal);
+		if( block == -1 )
+		{
+			return -ENOSPC;
+		}
+
+		add_file_block(map, block);
+		blocks--;
+	}
+	return 0;
+}
+
+static int add_holes(cs1550_file_map *map, long blocks)	//gives the file blocks more data pointers at its end that are holes, only the indirect blocks they reach are allocated, returns 0 or an error
+{
+	int res;
+
+	while( blocks-- > 0 )
+	{
+		if( map->inode.nBlocks == MAX_FILE_BLOCKS )
+		{
+			return -EFBIG;
+		}
+		if( STARTS_INDIRECT(map->inode.nBlocks) )
+		{
+			res = add_indirect_block(map);
+			if( res != 0 )
+			{
+				return res;
+			}
+		}
+		add_file_block(map, HOLE_BLOCK);
+	}
+	return 0;
+}
+
+static long fill_holes(cs1550_file_map *map, long index, long last_index, int *filled)	//gives every hole among the data pointers index to last_index, which the file must have, a block of its own, filled is set if any did, returns the first that could not get one or last_index + 1
+{
+	long block;
+
+	for( ; index <= last_index; index++)
+	{
+		if( get_file_block(map, index) == HOLE_BLOCK )
+		{
+			block = allocate_block( file_goal(map, index) );
+			if( block == -1 )
+			{
+				break;
+			}
+			set_file_block(map, index, block);
+			*filled = 1;
+		}
+	}
+	return index;
+}
+
+static void release_file_blocks(cs1550_file_map *map, long blocks)	//frees the data blocks of the file from the blocks-th on, and the indirect blocks that are not needed anymore, allocator_lock must be held
+{
+	long index;
+	long block;
+	long which;	//indirect block
+
+	//cached copies are dropped while the allocator lock is still held, before anyone can be given the block again
+	for(index = blocks; index < map->inode.nBlocks; index++)
+	{
+		block = get_file_block(map, index);
+		if( block != HOLE_BLOCK && !IS_COMPRESSED_CHUNK(block) )
+		{
+			release_block(block);
+		}
+	}
+
+	if( NEEDS_DOUBLE_INDIRECT(map->inode.nBlocks) )
+	{
+		for(which = INDIRECT_BLOCKS(blocks); which < INDIRECT_BLOCKS(map->inode.nBlocks); which++)	//the ones past what is left
+		{
+			release_block(map->double_indirect.pointers[ which ]);
+			map->double_dirty = 1;
+		}
+		if( !NEEDS_DOUBLE_INDIRECT(blocks) )	//what is left fits in the single indirect block, which the inode points at again
+		{
+			release_block(map->inode.pointers[ INDIRECT_POINTER ]);
+			map->inode.pointers[ INDIRECT_POINTER ] = map->double_indirect.pointers[ 0 ];
+			map->double_dirty = 0;
+		}
+	}
+	else if( map->inode.nBlocks > DIRECT_POINTERS && blocks <= DIRECT_POINTERS )
+	{
+		release_block(map->inode.pointers[ INDIRECT_POINTER ]);
+	}
+	if( map->indirect_index != -1 && (long) DIRECT_POINTERS + map->indirect_index * (long) POINTERS_IN_INDIRECT >= blocks )	//it is free now, nothing to write back
+	{
+		map->indirect_index = -1;
+		map->indirect_dirty = 0;
+	}
+	if( blocks < map->inode.nBlocks )
+	{
+		map->inode.nBlocks = blocks;
+	}
+	if( blocks == 0 )	//no chunk is left to be compressed
+	{
+		map->inode.flags &= ~INODE_COMPRESSED;
+	}
+}
+
+void free_file_blocks(struct cs1550_file_directory *file)	//marks every block of the file, its indirect blocks and its inode as free, blocks other files share stay theirs
+{
+	cs1550_file_map map;	//the file's inode and indirect blocks
+
+	if( load_file_map(file, &map) != 0 )
+	{
+		return;
+	}
+
+	pthread_mutex_lock(&allocator_lock);
+	release_file_blocks(&map, 0);
+	release_block(file->nInodeBlock / BLOCK_SIZE);
+	pthread_mutex_unlock(&allocator_lock);
+}
+
+static long file_run(cs1550_file_map *map, long index, long last_index, long *run_start)	//returns how many blocks of the file from index on, up to last_index, are next to each other on disk (or are all holes), the first of them is put in run_start
+{
+	long run_length = 1;
+	long step = 1;	//how far apart the blocks of the run are on disk
+
+	*run_start = get_file_block(map, index);
+	if( IS_COMPRESSED_CHUNK(*run_start) )	//the length of a compressed chunk is in no block either
+	{
+		*run_start = HOLE_BLOCK;
+	}
+	if( *run_start == HOLE_BLOCK )	//a run of holes is every hole in a row
+	{
+		step = 0;
+	}
+	while( index + run_length <= last_index && get_file_block(map, index + run_length) == *run_start + step * run_length )	//next block of the file is the next block on disk
+	{
+		run_length++;
+	}
+	return run_length;
+}
+
+static int copy_runs(cs1550_file_map *map, char *buf, size_t size, off_t offset, int writing)	//reads (or writes) size bytes at offset in the file as it is on disk, one pread (or pwrite) per run of blocks that are next to each other on disk and up to IO_BATCH_RUNS runs in one batch
+{
+	long index = offset / BLOCK_SIZE;	//first block of the file that is copied
+	long last_index = (offset + size - 1) / BLOCK_SIZE;	//last block of the file that is copied
+	long run_start;	//first disk block of the current run
+	long run_length;	//how many blocks are in the current run
+	off_t from;	//first byte of the run that is copied
+	off_t to;	//one past the last byte of the run that is copied
+	disk_span spans[IO_BATCH_RUNS];	//the runs that go to the disk together
+	int used = 0;	//how many are in spans
+	int res;
+
+	if( size == 0 )
+	{
+		return 0;
+	}
+
+	while( index <= last_index )
+	{
+		run_length = file_run(map, index, last_index, &run_start);
+		if( map->error != 0 )	//an indirect block could not be read, the run is not where run_start says
+		{
+			return map->error;
+		}
+
+		from = index * BLOCK_SIZE > offset ? index * BLOCK_SIZE : offset;
+		to = (index + run_length) * BLOCK_SIZE < offset + (off_t) size ? (index + run_length) * BLOCK_SIZE : offset + (off_t) size;
+
+		if( run_start == HOLE_BLOCK )	//nothing on disk, a hole reads as zeros and has to get blocks before it is written
+		{
+			if( writing )
+			{
+				return -EIO;
+			}
+			memset(buf + (from - offset), 0, to - from);
+		}
+		else
+		{
+			spans[ used ].data = buf + (from - offset);
+			spans[ used ].size = to - from;
+			spans[ used ].offset = run_start * BLOCK_SIZE + (from - index * BLOCK_SIZE);
+			used++;
+			count_stat(writing ? COUNT_BYTES_WRITTEN : COUNT_BYTES_READ, to - from);
+		}
+		index += run_length;
+
+		if( used == IO_BATCH_RUNS || (used > 0 && index > last_index) )
+		{
+			res = disk_io(spans, used, writing);
+			if( res != 0 )
+			{
+				return res;
+			}
+			used = 0;
+		}
+	}
+	return 0;
+}
+
+static uint32_t load_word(const unsigned char *at)	//the 4 bytes at at as one word, they need not be aligned
+{
+	uint32_t word;
+
+	memcpy(&word, at, sizeof(word));
+	return word;
+}
+
+static size_t lz_put_length(unsigned char *out, size_t used, size_t rest)	//writes what is left of a length past the 15 its token holds at used in out, returns the new used
+{
+	for( ; rest >= 255; rest -= 255)
+	{
+		out[ used++ ] = 255;
+	}
+	out[ used++ ] = rest;
+	return used;
+}
+
+static size_t lz_sequence(unsigned char *out, size_t used, const unsigned char *literals, size_t count, size_t distance, size_t length)	//writes one LZ4 sequence at used in out, count literals and then length bytes copied from distance back, length 0 for the last one which has no copy, returns the new used
+{
+	size_t token = used++;
+
+	out[ token ] = (count < 15 ? count : 15) << 4;
+	if( count >= 15 )
+	{
+		used = lz_put_length(out, used, count - 15);
+	}
+	memcpy(out + used, literals, count);
+	used += count;
+
+	if( length == 0 )
+	{
+		return used;
+	}
+	out[ used++ ] = distance & 0xff;
+	out[ used++ ] = distance >> 8;
+	out[ token ] |= length - 4 < 15 ? length - 4 : 15;
+	if( length - 4 >= 15 )
+	{
+		used = lz_put_length(out, used, length - 4 - 15);
+	}
+	return used;
+}
+
+static size_t lz_compress(const unsigned char *data, size_t size, unsigned char *out, size_t capacity)	//compresses size bytes of data into out in the LZ4 block format, returns how many bytes that took or 0 if it does not fit in capacity
+{
+	uint32_t last_seen[1 << LZ_HASH_BITS];	//1 + where the 4 bytes with each hash were seen last, 0 for never
+	size_t match_limit = size > 12 ? size - 12 : 0;	//LZ4 starts no copy in the last 12 bytes and ends none in the last 5
+	size_t position = 0;	//next byte to look for a copy at
+	size_t anchor = 0;	//first byte no sequence has yet
+	size_t used = 0;	//bytes of out written
+	size_t candidate;	//where the same 4 bytes might have been before
+	size_t length;	//how many bytes are copied from there
+	uint32_t hash;
+
+	memset(last_seen, 0, sizeof(last_seen));
+	while( position < match_limit )
+	{
+		hash = (load_word(data + position) * 2654435761U) >> (32 - LZ_HASH_BITS);
+		candidate = last_seen[ hash ];
+		last_seen[ hash ] = position + 1;
+
+		if( candidate == 0 || position - (candidate - 1) > 65535 || load_word(data + candidate - 1) != load_word(data + position) )	//no copy here
+		{
+			position += 1 + ((position - anchor) >> 6);	//goes faster through data that does not repeat
+			continue;
+		}
+		candidate--;
+		for(length = 4; position + length < size - 5 && data[ candidate + length ] == data[ position + length ]; length++);
+
+		if( used + (position - anchor) / 255 + (position - anchor) + length / 255 + 5 > capacity )
+		{
+			return 0;
+		}
+		used = lz_sequence(out, used, data + anchor, position - anchor, position - candidate, length);
+		position += length;
+		anchor = position;
+	}
+
+	if( used + (size - anchor) / 255 + (size - anchor) + 2 > capacity )	//the rest goes as literals
+	{
+		return 0;
+	}
+	return lz_sequence(out, used, data + anchor, size - anchor, 0, 0);
+}
+
+static int lz_get_length(const unsigned char *data, size_t size, size_t *in, size_t *length)	//adds the bytes at in that carry on a length of 15 in a token to length, returns 0 or -1 if data ends first
+{
+	unsigned char more;
+
+	do
+	{
+		if( *in == size )
+		{
+			return -1;
+		}
+		more = data[ (*in)++ ];
+		*length += more;
+	} while( more == 255 );
+	return 0;
+}
+
+static long lz_expand(const unsigned char *data, size_t size, unsigned char *out, size_t capacity)	//undoes lz_compress(), returns how many bytes the size bytes of data give or -1 if they are not LZ4 or do not fit in capacity
+{
+	size_t in = 0;	//next byte of data
+	size_t used = 0;	//bytes of out written
+	size_t count;	//literals, then bytes copied
+	size_t distance;	//how far back the copy is from
+	size_t from;	//where the copy starts
+	size_t step;	//how much of it is copied at once
+	unsigned char token;
+
+	while( in < size )
+	{
+		token = data[ in++ ];
+		count = token >> 4;
+		if( (count == 15 && lz_get_length(data, size, &in, &count) != 0) || count > size - in || count > capacity - used )
+		{
+			return -1;
+		}
+		memcpy(out + used, data + in, count);
+		in += count;
+		used += count;
+
+		if( in == size )	//the last sequence has no copy
+		{
+			break;
+		}
+		if( size - in < 2 )
+		{
+			return -1;
+		}
+		distance = data[ in ] | (data[ in + 1 ] << 8);
+		in += 2;
+		count = token & 15;
+		if( distance == 0 || distance > used || (count == 15 && lz_get_length(data, size, &in, &count) != 0) || count + 4 > capacity - used )
+		{
+			return -1;
+		}
+		for(count += 4, from = used - distance; count > 0; count -= step, used += step)	//a copy that overlaps what it makes repeats it, in pieces that double each time
+		{
+			step = used - from < count ? used - from : count;
+			memcpy(out + used, out + from, step);
+		}
+	}
+	return used;
+}
+
+static long chunk_mark(cs1550_file_map *map, long chunk)	//index of the data pointer that holds the length of the chunk if it is compressed, -1 if it is not
+{
+	long index;
+	long last = (chunk + 1) * CHUNK_BLOCKS < (long) map->inode.nBlocks ? (chunk + 1) * CHUNK_BLOCKS : (long) map->inode.nBlocks;	//one past its last pointer
+
+	for(index = chunk * CHUNK_BLOCKS; (map->inode.flags & INODE_COMPRESSED) && index < last; index++)
+	{
+		if( IS_COMPRESSED_CHUNK(get_file_block(map, index)) )
+		{
+			return index;
+		}
+	}
+	return -1;
+}
+
+static int read_chunk(cs1550_file_map *map, long chunk, long mark, char *plain)	//decompresses the chunk whose length is in the data pointer mark into plain, which holds CHUNK_SIZE, what is past its data is zeros, returns 0 or -EIO
+{
+	long first = chunk * CHUNK_BLOCKS;	//its first data pointer
+	size_t length = get_file_block(map, mark) & ~COMPRESSED_CHUNK;	//bytes of compressed data
+	char *packed;
+	long size = -1;	//bytes it decompresses to
+
+	if( length == 0 || length > (size_t) (mark - first) * BLOCK_SIZE )	//not what its blocks hold
+	{
+		return -EIO;
+	}
+
+	packed = malloc(length);
+	if( packed != NULL && copy_runs(map, packed, length, first * BLOCK_SIZE, 0) == 0 )
+	{
+		size = lz_expand((unsigned char *) packed, length, (unsigned char *) plain, CHUNK_SIZE);
+	}
+	free(packed);
+
+	if( size < 0 )
+	{
+		return -EIO;
+	}
+	memset(plain + size, 0, CHUNK_SIZE - size);
+	return 0;
+}
+
+int copy_blocks(cs1550_file_map *map, char *buf, size_t size, off_t offset, int writing)	//copy_runs() that decompresses the compressed chunks it reads and reads data kept in the inode, a write must not reach either, expand_chunks() or spill_inline() first
+{
+	long chunk;
+	long mark;	//where the length of the chunk is, -1 if it is raw
+	off_t from;	//first byte of the chunk that is copied
+	off_t to;	//one past the last byte of the chunk that is copied
+	char *plain = NULL;	//a chunk decompressed
+	int res = 0;
+
+	if( map->inode.flags & INODE_INLINE )	//no block to go to
+	{
+		if( writing )
+		{
+			return -EIO;
+		}
+		memcpy(buf, (char *) map->inode.pointers + offset, size);
+		return 0;
+	}
+	if( !(map->inode.flags & INODE_COMPRESSED) )	//every chunk is raw
+	{
+		return copy_runs(map, buf, size, offset, writing);
+	}
+
+	for(chunk = offset / CHUNK_SIZE; res == 0 && chunk * CHUNK_SIZE < offset + (off_t) size; chunk++)
+	{
+		from = chunk * CHUNK_SIZE > offset ? chunk * CHUNK_SIZE : offset;
+		to = (chunk + 1) * CHUNK_SIZE < offset + (off_t) size ? (chunk + 1) * CHUNK_SIZE : offset + (off_t) size;
+
+		mark = chunk_mark(map, chunk);
+		if( mark == -1 )
+		{
+			res = copy_runs(map, buf + (from - offset), to - from, from, writing);
+		}
+		else if( writing )
+		{
+			res = -EIO;
+		}
+		else
+		{
+			plain = plain != NULL ? plain : malloc(CHUNK_SIZE);
+			res = plain != NULL ? read_chunk(map, chunk, mark, plain) : -EIO;
+			if( res == 0 )
+			{
+				memcpy(buf + (from - offset), plain + (from - chunk * CHUNK_SIZE), to - from);
+			}
+		}
+	}
+	free(plain);
+	return res;
+}
+
+void read_ahead(open_file *handle, cs1550_file_map *map, off_t offset, size_t size)	//notes a read of size bytes at offset through handle and, while reads carry on from each other, keeps the next window of the file queued for the readahead thread
+{
+	long next = (offset + size + BLOCK_SIZE - 1) / BLOCK_SIZE;	//first block of the file past this read
+	long index;	//next block of the file to queue
+	long last;	//last block of the file to queue
+	long run_start;
+	long run_length;
+
+	if( map->inode.nBlocks == 0 || (map->inode.flags & INODE_INLINE) )	//no blocks to read ahead, the data is all pending, holes or in the inode
+	{
+		return;
+	}
+
+	pthread_mutex_lock(&handle->lock);
+
+	if( offset != handle->next_offset )	//a seek, start over until the reads are sequential again
+	{
+		handle->window = 0;
+		handle->ahead = 0;
+	}
+	else if( handle->window == 0 )	//first sequential read, start small
+	{
+		handle->window = READAHEAD_MIN_BLOCKS < readahead_limit ? READAHEAD_MIN_BLOCKS : readahead_limit;
+	}
+	else if( handle->ahead - next <= handle->window / 2 )	//the reader is into the second half of what was fetched, fetch more and further
+	{
+		handle->window = handle->window * 2 < readahead_limit ? handle->window * 2 : readahead_limit;
+	}
+	else	//enough is still ahead of the reader
+	{
+		handle->next_offset = offset + size;
+		pthread_mutex_unlock(&handle->lock);
+		return;
+	}
+	handle->next_offset = offset + size;
+
+	index = handle->ahead > next ? handle->ahead : next;
+	last = next + handle->window <= (long) map->inode.nBlocks ? next + handle->window - 1 : (long) map->inode.nBlocks - 1;
+	if( handle->window > 0 && index <= last )
+	{
+		handle->ahead = last + 1;
+		while( index <= last )
+		{
+			run_length = file_run(map, index, last, &run_start);
+			if( run_start != HOLE_BLOCK )	//nothing to read for a hole
+			{
+				queue_readahead(run_start, run_length);
+			}
+			index += run_length;
+		}
+	}
+
+	pthread_mutex_unlock(&handle->lock);
+}
+
+static int rewrite_chunk(cs1550_file_map *map, long first, long count, const char *data, long blocks, long mark)	//points the count data pointers of the file from first on, all in one chunk, at new blocks holding the blocks blocks of data, the next pointer at mark (HOLE_BLOCK for none) and the rest at holes, then frees what they pointed at, so a crash before the inode is written leaves the old blocks as they were, nothing changes if it fails, returns 0 or an error
+{
+	long fresh[CHUNK_BLOCKS];	//the new blocks
+	long allocated;	//how many of them there are yet
+	long index;
+	long run;	//how many new blocks from index on are in a row
+	long block;
+	int res = 0;
+
+	for(allocated = 0; allocated < blocks; allocated++)	//next to each other when they can be
+	{
+		fresh[ allocated ] = allocate_block(allocated == 0 ? file_goal(map, first) : fresh[ allocated - 1 ] + 1);
+		if( fresh[ allocated ] == -1 )
+		{
+			res = -ENOSPC;
+			break;
+		}
+	}
+
+	for(index = 0; res == 0 && index < blocks; index += run)
+	{
+		for(run = 1; index + run < blocks && fresh[ index + run ] == fresh[ index ] + run; run++);
+		res = write_disk(data + index * BLOCK_SIZE, run * BLOCK_SIZE, fresh[ index ] * BLOCK_SIZE);
+		count_stat(COUNT_BYTES_WRITTEN, run * BLOCK_SIZE);
+	}
+
+	pthread_mutex_lock(&allocator_lock);
+	while( res != 0 && allocated-- > 0 )	//the old blocks stay, the new ones go back
+	{
+		release_block(fresh[ allocated ]);
+	}
+	for(index = 0; res == 0 && index < count; index++)
+	{
+		block = get_file_block(map, first + index);
+		if( block != HOLE_BLOCK && !IS_COMPRESSED_CHUNK(block) )
+		{
+			release_block(block);
+		}
+		set_file_block(map, first + index, index < blocks ? fresh[ index ] : (index == blocks ? mark : HOLE_BLOCK));
+	}
+	pthread_mutex_unlock(&allocator_lock);
+	return res;
+}
+
+static int expand_chunks(cs1550_file_map *map, long index, long last_index, off_t size, int *expanded)	//stores the compressed chunks the data pointers index to last_index are in raw again, a block per pointer up to size bytes into the file and holes past it, expanded is set if any was, returns 0 or an error
+{
+	long chunk;
+	long mark;	//where the length of the chunk is, -1 if it is raw
+	long first;	//first data pointer of the chunk
+	long count;	//how many data pointers it has
+	long blocks;	//how many of them get a block
+	char *plain = NULL;	//the chunk decompressed
+	int res = 0;
+
+	for(chunk = index / CHUNK_BLOCKS; res == 0 && chunk <= last_index / CHUNK_BLOCKS && chunk * CHUNK_BLOCKS < (long) map->inode.nBlocks; chunk++)	//the last chunk can be in the range with fewer pointers than that
+	{
+		mark = chunk_mark(map, chunk);
+		if( mark == -1 )
+		{
+			continue;
+		}
+
+		first = chunk * CHUNK_BLOCKS;
+		count = (long) map->inode.nBlocks - first < CHUNK_BLOCKS ? (long) map->inode.nBlocks - first : CHUNK_BLOCKS;
+		blocks = size > first * BLOCK_SIZE ? (size - first * BLOCK_SIZE + BLOCK_SIZE - 1) / BLOCK_SIZE : 0;
+		blocks = blocks < count ? blocks : count;
+
+		plain = plain != NULL ? plain : malloc(CHUNK_SIZE);
+		res = plain != NULL ? read_chunk(map, chunk, mark, plain) : -EIO;
+		if( res == 0 && blocks > 0 && size < (first + blocks) * BLOCK_SIZE )	//what is past the end of the file reads as zeros, in its last block too
+		{
+			memset(plain + (size - first * BLOCK_SIZE), 0, (first + blocks) * BLOCK_SIZE - size);
+		}
+		if( res == 0 )
+		{
+			res = rewrite_chunk(map, first, count, plain, blocks, HOLE_BLOCK);
+		}
+		if( res == 0 )
+		{
+			*expanded = 1;
+			count_stat(COUNT_CHUNKS_EXPANDED, 1);
+		}
+	}
+	free(plain);
+	return res;
+}
+
+static int compress_chunks(cs1550_file_map *map, long index, long last_index, off_t size)	//stores the raw chunks the data pointers index to last_index are in compressed when that saves a block, size is how big the file is, returns 1 if any was, a chunk that can not be, or that has holes, stays as it is
+{
+	long chunk;
+	long first;	//first data pointer of the chunk
+	long blocks;	//how many blocks it has data in
+	long scan;
+	off_t length;	//bytes of data in it
+	size_t packed_size;	//bytes that data compresses to
+	char *plain = malloc(CHUNK_SIZE);	//the chunk as it is
+	char *packed = malloc(CHUNK_SIZE);	//the chunk compressed
+	int compressed = 0;
+
+	for(chunk = index / CHUNK_BLOCKS; plain != NULL && packed != NULL && chunk <= last_index / CHUNK_BLOCKS; chunk++)
+	{
+		first = chunk * CHUNK_BLOCKS;
+		length = size - first * BLOCK_SIZE < CHUNK_SIZE ? size - first * BLOCK_SIZE : CHUNK_SIZE;
+		blocks = (length + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+		for(scan = first; scan < first + blocks && scan < (long) map->inode.nBlocks && get_file_block(map, scan) != HOLE_BLOCK && !IS_COMPRESSED_CHUNK(get_file_block(map, scan)); scan++);
+		if( blocks < 2 || scan < first + blocks )	//a block can not be saved, or it has holes or is compressed already
+		{
+			continue;
+		}
+
+		if( copy_runs(map, plain, length, first * BLOCK_SIZE, 0) != 0 )
+		{
+			continue;
+		}
+		packed_size = lz_compress((unsigned char *) plain, length, (unsigned char *) packed, (blocks - 1) * BLOCK_SIZE);
+		if( packed_size == 0 )	//would not save a block, it stays raw
+		{
+			count_stat(COUNT_CHUNKS_INCOMPRESSIBLE, 1);
+			continue;
+		}
+
+		memset(packed + packed_size, 0, (packed_size + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE - packed_size);
+		if( rewrite_chunk(map, first, blocks, packed, (packed_size + BLOCK_SIZE - 1) / BLOCK_SIZE, COMPRESSED_CHUNK | packed_size) == 0 )
+		{
+			map->inode.flags |= INODE_COMPRESSED;
+			compressed = 1;
+			count_stat(COUNT_CHUNKS_COMPRESSED, 1);
+		}
+	}
+	free(plain);
+	free(packed);
+	return compressed;
+}
+
+static int unshare_blocks(cs1550_file_map *map, long index, long last_index, off_t from, off_t to, int *copied)	//takes the blocks of the data pointers index to last_index out of the dedup index since their data is about to change, and gives each pointer that shares its block a copy of its own, not copying a block that lies wholly in from to to since it is overwritten, copied is set if any pointer moved, returns 0 or an error
+{
+	long block;
+	long fresh;	//the copy
+	int shared;
+	char data[BLOCK_SIZE];
+	int res = 0;
+
+	if( dedup_index == NULL && shared_block_count == 0 )	//safe to read without the lock, blocks only start being shared with -o dedup, which always takes it here
+	{
+		return 0;
+	}
+
+	for( ; res == 0 && index <= last_index && index < map->inode.nBlocks; index++)
+	{
+		block = get_file_block(map, index);
+		if( block == HOLE_BLOCK || IS_COMPRESSED_CHUNK(block) )
+		{
+			continue;
+		}
+
+		pthread_mutex_lock(&allocator_lock);
+		if( dedup_index != NULL )	//no write can start sharing it from here on
+		{
+			forget_fingerprint(block);
+		}
+		shared = shares_of(block) > 0;
+		pthread_mutex_unlock(&allocator_lock);
+		if( !shared )
+		{
+			continue;
+		}
+
+		fresh = allocate_block( file_goal(map, index) );
+		if( fresh == -1 )
+		{
+			res = -ENOSPC;
+			break;
+		}
+		if( from > (off_t) index * BLOCK_SIZE || to < (off_t) (index + 1) * BLOCK_SIZE )	//part of it is kept
+		{
+			res = read_disk(data, BLOCK_SIZE, block * BLOCK_SIZE);
+			if( res == 0 )
+			{
+				res = write_disk(data, BLOCK_SIZE, fresh * BLOCK_SIZE);
+			}
+		}
+
+		pthread_mutex_lock(&allocator_lock);
+		release_block(res == 0 ? block : fresh);	//the other pointers keep the old one
+		pthread_mutex_unlock(&allocator_lock);
+		if( res == 0 )
+		{
+			set_file_block(map, index, fresh);
+			count_stat(COUNT_BLOCKS_COPIED, 1);
+			*copied = 1;
+		}
+	}
+	return res;
+}
+
+static int write_indexed(cs1550_file_map *map, const char *data, long index, long count, const uint64_t *fingerprints)	//writes count whole blocks of data to the data pointers from index on and puts them in the dedup index under fingerprints, returns 0 or -EIO
+{
+	long done;
+	int res;
+
+	res = copy_blocks(map, (char *) data, count * BLOCK_SIZE, (off_t) index * BLOCK_SIZE, 1);
+	if( res != 0 )
+	{
+		return res;
+	}
+
+	pthread_mutex_lock(&allocator_lock);	//only once they hold it, a write sharing one must find the data there
+	for(done = 0; done < count; done++)
+	{
+		index_block(fingerprints[ done ], get_file_block(map, index + done));
+	}
+	pthread_mutex_unlock(&allocator_lock);
+	return 0;
+}
+
+static int write_deduped(cs1550_file_map *map, const char *buf, size_t size, off_t offset, int *deduped)	//copy_blocks() of a write with -o dedup, the blocks written in part must be the file's own, a whole block another block already holds the data of is pointed at that one instead of being written, the rest are written and indexed, deduped is set if any pointer moved, returns 0 or an error
+{
+	long first = (offset + BLOCK_SIZE - 1) / BLOCK_SIZE;	//first whole block of the write
+	long last = (offset + size) / BLOCK_SIZE;	//one past the last whole block
+	uint64_t fingerprints[DEDUP_RUN_BLOCKS];	//of the blocks waiting to be written
+	uint64_t fingerprint = 0;
+	long run = 0;	//how many whole blocks right before next wait to be written
+	long next;
+	long match;	//which of the waiting blocks has the fingerprint of next, run if none
+	long block;	//the block the data pointer of next had
+	long duplicate;
+	long fresh;
+	int shared = 0;
+	const char *data;
+	int res = 0;
+
+	if( first >= last )	//no whole block to share
+	{
+		return copy_blocks(map, (char *) buf, size, offset, 1);
+	}
+	if( offset < (off_t) first * BLOCK_SIZE )	//the parts of blocks at either end are written in place
+	{
+		res = copy_blocks(map, (char *) buf, first * BLOCK_SIZE - offset, offset, 1);
+	}
+	if( res == 0 && offset + (off_t) size > (off_t) last * BLOCK_SIZE )
+	{
+		res = copy_blocks(map, (char *) buf + (last * BLOCK_SIZE - offset), offset + size - last * BLOCK_SIZE, (off_t) last * BLOCK_SIZE, 1);
+	}
+
+	for(next = first; res == 0 && next <= last; next++)
+	{
+		data = buf + (next * BLOCK_SIZE - offset);
+		match = run;
+		if( next < last )
+		{
+			fingerprint = fingerprint_block(data);
+			for(match = 0; match < run && fingerprints[ match ] != fingerprint; match++);
+		}
+		if( run > 0 && (next == last || match < run || run == DEDUP_RUN_BLOCKS) )	//what waits is written and indexed first, next may repeat it
+		{
+			res = write_indexed(map, data - run * BLOCK_SIZE, next - run, run, fingerprints);
+			run = 0;
+		}
+		if( res != 0 || next == last )
+		{
+			break;
+		}
+
+		pthread_mutex_lock(&allocator_lock);
+		block = get_file_block(map, next);
+		duplicate = find_duplicate(fingerprint, data);
+		if( duplicate != -1 && duplicate != block && share_block(duplicate) != 0 )	//no memory to count one more pointer at it, the data is written like any other
+		{
+			duplicate = -1;
+		}
+		if( duplicate == -1 )	//written in place, no write can start sharing it from here on
+		{
+			forget_fingerprint(block);
+			shared = shares_of(block) > 0;
+		}
+		else if( duplicate != block )	//the block the pointer had is not needed
+		{
+			release_block(block);
+		}
+		pthread_mutex_unlock(&allocator_lock);
+
+		if( duplicate == -1 && shared )	//a block of its own that need not be copied, the whole of it is written
+		{
+			fresh = allocate_block( file_goal(map, next) );
+			if( fresh == -1 )
+			{
+				res = -ENOSPC;
+				break;
+			}
+			pthread_mutex_lock(&allocator_lock);
+			release_block(block);
+			pthread_mutex_unlock(&allocator_lock);
+			set_file_block(map, next, fresh);
+			count_stat(COUNT_BLOCKS_COPIED, 1);
+			*deduped = 1;
+		}
+		if( duplicate == -1 )
+		{
+			fingerprints[ run++ ] = fingerprint;
+			continue;
+		}
+
+		if( run > 0 )	//what waits ends here
+		{
+			res = write_indexed(map, data - run * BLOCK_SIZE, next - run, run, fingerprints);
+			run = 0;
+		}
+		count_stat(COUNT_BLOCKS_DEDUPED, 1);
+		if( duplicate != block )
+		{
+			set_file_block(map, next, duplicate);
+			*deduped = 1;
+		}
+	}
+	return res;
+}
+
+static int spill_inline(cs1550_file_map *map)	//moves the data of a file kept in its inode to a data block of its own, the inode is not written, returns 0 or an error
+{
+	char data[BLOCK_SIZE];
+	long block;
+
+	memset(data, 0, BLOCK_SIZE);
+	memcpy(data, map->inode.pointers, INLINE_BYTES);
+	block = allocate_block( file_goal(map, 0) );
+	if( block == -1 )
+	{
+		return -ENOSPC;
+	}
+	if( write_disk(data, BLOCK_SIZE, block * BLOCK_SIZE) != 0 )
+	{
+		pthread_mutex_lock(&allocator_lock);
+		release_block(block);
+		pthread_mutex_unlock(&allocator_lock);
+		return -EIO;
+	}
+	count_stat(COUNT_BYTES_WRITTEN, BLOCK_SIZE);
+
+	memset(map->inode.pointers, 0, INLINE_BYTES);
+	map->inode.flags &= ~INODE_INLINE;
+	add_file_block(map, block);
+	return 0;
+}
+
+static int zero_tail(cs1550_file_map *map, off_t from, off_t to)	//zeros the bytes from from up to to, or the end of the block from is in, the stale bytes past the end of the file a write past it or a truncate up brings back, returns 0 or -EIO
+{
+	off_t end = (from / BLOCK_SIZE + 1) * BLOCK_SIZE;	//end of the block
+
+	if( from % BLOCK_SIZE == 0 || get_file_block(map, from / BLOCK_SIZE) == HOLE_BLOCK || chunk_mark(map, from / CHUNK_SIZE) != -1 )	//no block, nothing of it past the end of the file, or compressed data, which ends where the file does
+	{
+		return 0;
+	}
+	return copy_blocks(map, zero_block, (to < end ? to : end) - from, from, 1);
+}
+
+static int write_file(open_file *handle, struct cs1550_file_directory *file, const char *buf, size_t size, off_t offset)	//writes size bytes at offset of file, which must be locked for writing, through handle (NULL for none), and updates its inode and fsize, a write past the end leaves a hole, returns how many were written or an error
+{
+	cs1550_file_map map;	//where the blocks of the file are
+	long first_index = offset / BLOCK_SIZE;	//first block of the file that is written
+	long blocks_needed = (offset + size + BLOCK_SIZE - 1) / BLOCK_SIZE;	//how many blocks the file needs after this write
+	long stop;	//first block of the write that has no block on disk
+	off_t end;	//one past the last byte written
+	int head_new;	//set if the first block written is new, so what is before offset in it has to read as zeros
+	int tail_new;	//same for the last block and what is after the write in it
+	int res;
+	int grew = 0;	//set when the file got new blocks, a new size or chunks stored another way, so its inode has to be written
+
+	if( size == 0 )
+	{
+		return 0;
+	}
+	if( offset >= (off_t) MAX_FILE_BLOCKS * BLOCK_SIZE )	//no pointer for it
+	{
+		return -EFBIG;
+	}
+
+	res = load_open_map(handle, file, &map);
+	if( res != 0 )
+	{
+		return res;
+	}
+	if( offset + size <= config.inline_bytes && file->fsize <= config.inline_bytes && map.inode.nBlocks == 0 && !(map.inode.flags & INODE_COMPRESSED) )	//small enough to be kept in the inode, where the data goes with no block
+	{
+		if( !(map.inode.flags & INODE_INLINE) )	//the pointers of blocks it had once are not data
+		{
+			memset(map.inode.pointers, 0, INLINE_BYTES);
+			map.inode.flags |= INODE_INLINE;
+		}
+		memcpy((char *) map.inode.pointers + offset, buf, size);
+		if( offset + size > file->fsize )
+		{
+			file->fsize = offset + size;
+			map.inode.size = file->fsize;
+		}
+		res = store_file_map(&map);
+		return res == 0 ? (int) size : res;
+	}
+	if( map.inode.flags & INODE_INLINE )	//it outgrew the inode
+	{
+		res = spill_inline(&map);
+		grew = 1;
+	}
+	if( res == 0 && (map.inode.flags & INODE_COMPRESSED) )	//compressed chunks the write lands in are stored raw first, with the data around the write that they keep
+	{
+		res = expand_chunks(&map, first_index, blocks_needed - 1, file->fsize, &grew);
+	}
+	head_new = get_file_block(&map, first_index) == HOLE_BLOCK;
+	tail_new = get_file_block(&map, blocks_needed - 1) == HOLE_BLOCK;
+
+	if( res == 0 && offset > (off_t) file->fsize )	//what is skipped reads as zeros, whole blocks of it stay holes
+	{
+		res = unshare_blocks(&map, file->fsize / BLOCK_SIZE, file->fsize / BLOCK_SIZE, 0, 0, &grew);
+		if( res == 0 )
+		{
+			res = zero_tail(&map, file->fsize, offset);
+		}
+	}
+	if( res == 0 && first_index > map.inode.nBlocks )
+	{
+		res = add_holes(&map, first_index - map.inode.nBlocks);
+		grew = 1;
+	}
+
+	stop = first_index;
+	if( res == 0 )	//holes the write lands in get blocks, nothing already written moves
+	{
+		stop = fill_holes(&map, first_index, (blocks_needed < map.inode.nBlocks ? blocks_needed : map.inode.nBlocks) - 1, &grew);
+		if( stop < map.inode.nBlocks && stop < blocks_needed )
+		{
+			res = -ENOSPC;
+		}
+	}
+	if( res == 0 && blocks_needed > map.inode.nBlocks )	//append, only the new blocks are allocated
+	{
+		res = grow_file(&map, blocks_needed - map.inode.nBlocks);
+		stop = map.inode.nBlocks;
+		grew = 1;
+	}
+	if( res != 0 && stop > first_index )	//out of room part way, write what fits and say so with a short count
+	{
+		size = stop * BLOCK_SIZE - offset;
+		res = 0;
+	}
+
+	end = offset + size;
+	if( res == 0 && !config.dedup )	//blocks another file shares are copied before the write changes them
+	{
+		res = unshare_blocks(&map, first_index, (end - 1) / BLOCK_SIZE, offset, end, &grew);
+	}
+	else if( res == 0 )	//write_deduped() sees to the whole blocks, only those written in part are copied here
+	{
+		if( offset % BLOCK_SIZE != 0 )
+		{
+			res = unshare_blocks(&map, first_index, first_index, offset, end, &grew);
+		}
+		if( res == 0 && end % BLOCK_SIZE != 0 )
+		{
+			res = unshare_blocks(&map, (end - 1) / BLOCK_SIZE, (end - 1) / BLOCK_SIZE, offset, end, &grew);
+		}
+	}
+	if( res == 0 && head_new && offset % BLOCK_SIZE != 0 )	//the start of a new block
+	{
+		res = copy_blocks(&map, zero_block, offset % BLOCK_SIZE, offset - offset % BLOCK_SIZE, 1);
+	}
+	if( res == 0 && tail_new && end % BLOCK_SIZE != 0 && end < (off_t) file->fsize )	//the end of a new block that is still inside the file
+	{
+		res = copy_blocks(&map, zero_block, ((end / BLOCK_SIZE + 1) * BLOCK_SIZE < (off_t) file->fsize ? (end / BLOCK_SIZE + 1) * BLOCK_SIZE : (off_t) file->fsize) - end, end, 1);
+	}
+
+	if( res == 0 )
+	{
+		//write data
+		res = config.dedup ? write_deduped(&map, buf, size, offset, &grew) : copy_blocks(&map, (char *) buf, size, offset, 1);
+	}
+
+	if( res == 0 && end > (off_t) file->fsize )	//update size
+	{
+		file->fsize = end;
+		map.inode.size = file->fsize;
+		grew = 1;
+	}
+
+	if( res == 0 && config.compress )	//the chunks written are compressed, again or for the first time, if they shrink by a block
+	{
+		grew |= compress_chunks(&map, first_index, (end - 1) / BLOCK_SIZE, file->fsize);
+	}
+
+	if( grew && store_file_map(&map) != 0 && res == 0 )	//an overwrite inside the file changes no metadata, blocks added before an error still belong to the file
+	{
+		res = -EIO;
+	}
+	return res == 0 ? (int) size : res;
+}
+
+static int truncate_file(open_file *handle, struct cs1550_file_directory *file, off_t size)	//makes file, which must be locked for writing, size bytes long through handle (NULL for none), the blocks past size are freed and what it grows by is a hole, updates its inode and fsize, returns 0 or an error
+{
+	cs1550_file_map map;	//where the blocks of the file are
+	long blocks = (size + BLOCK_SIZE - 1) / BLOCK_SIZE;	//how many blocks the file covers after
+	int expanded = 0;	//set if the chunk the file now ends in was compressed
+	int res;
+
+	if( size > (off_t) MAX_FILE_BLOCKS * BLOCK_SIZE )
+	{
+		return -EFBIG;
+	}
+	if( size == (off_t) file->fsize )
+	{
+		return 0;
+	}
+
+	res = load_open_map(handle, file, &map);
+	if( res == 0 && (map.inode.flags & INODE_INLINE) && size > (off_t) INLINE_BYTES )	//it outgrows the inode
+	{
+		res = spill_inline(&map);
+	}
+	if( res == 0 && (map.inode.flags & INODE_INLINE) && size < (off_t) file->fsize )	//what is cut off is zeroed, so growing again brings back zeros
+	{
+		memset((char *) map.inode.pointers + size, 0, file->fsize - size);
+		if( size == 0 )
+		{
+			map.inode.flags &= ~INODE_INLINE;
+		}
+	}
+	if( res == 0 && (map.inode.flags & INODE_COMPRESSED) && size < (off_t) file->fsize && size % CHUNK_SIZE != 0 )	//the chunk the file now ends in is stored raw, its data has to end where the file does so what is cut off can not come back
+	{
+		res = expand_chunks(&map, size / BLOCK_SIZE, size / BLOCK_SIZE, size, &expanded);
+	}
+	if( res == 0 && size > (off_t) file->fsize )	//no blocks are given, only the rest of the last one has to read as zeros now
+	{
+		res = unshare_blocks(&map, file->fsize / BLOCK_SIZE, file->fsize / BLOCK_SIZE, 0, 0, &expanded);
+		if( res == 0 )
+		{
+			res = zero_tail(&map, file->fsize, size);
+		}
+	}
+	else if( res == 0 && blocks < map.inode.nBlocks )	//only the blocks past the new end are touched
+	{
+		pthread_mutex_lock(&allocator_lock);
+		release_file_blocks(&map, blocks);
+		pthread_mutex_unlock(&allocator_lock);
+	}
+
+	if( res == 0 )
+	{
+		file->fsize = size;
+		map.inode.size = size;
+		res = store_file_map(&map);
+	}
+	return res;
+}
+
+static int write_linked_file(meta_entry *attribute, open_file *handle, const char *buf, size_t size, off_t offset)	//write_file() for a file in a directory locked for writing, rewriting its record if its size changed
+{
+	int record = file_record( attribute->index_of_directory, attribute->file_index );	//the record of the directory the file is in
+	cs1550_directory_entry directory_entry = get_directory_entry( record );
+	struct cs1550_file_directory *file = &directory_entry.files[ attribute->file_index % MAX_FILES_IN_DIR ];
+	size_t old_size = file->fsize;
+	char canonical[MAX_PATH_LENGTH + 2];	//path of the file
+	int res = write_file(handle, file, buf, size, offset);
+
+	if( file->fsize != old_size )
+	{
+		write_directory_entry( directory_entry, record );	//rewrite the struct and the in memory copy
+		file_path(canonical, attribute->index_of_directory, file);
+		path_cache_set_size(canonical, file->fsize);
+	}
+	return res;
+}
+
+int flush_pending(meta_entry *attribute)	//writes what was appended to the file of attribute and only held in memory, its blocks come in one run, the directory must be locked for writing, returns 0 or an error
+{
+	struct cs1550_file_directory *file = get_file( attribute->index_of_directory, attribute->file_index );
+	open_file *handle = pending_of(file);
+	size_t size;
+	char canonical[MAX_PATH_LENGTH + 2];	//path of the file
+	int res;
+
+	if( handle == NULL )
+	{
+		return 0;
+	}
+
+	size = handle->pending_size;
+	res = write_linked_file(attribute, handle, handle->pending, size, file->fsize);
+	clear_pending( file->nInodeBlock / BLOCK_SIZE );	//what did not fit is lost, like a write that failed
+
+	file = get_file( attribute->index_of_directory, attribute->file_index );
+	file_path(canonical, attribute->index_of_directory, file);
+	path_cache_set_size(canonical, file->fsize);
+
+	if( res >= 0 && (size_t) res < size )	//the disk filled up part way
+	{
+		res = -ENOSPC;
+	}
+	return res < 0 ? res : 0;
+}
+
+static int write_open_file(meta_entry *attribute, open_file *handle, const char *buf, size_t size, off_t offset)	//writes size bytes at offset of the file of attribute through handle (NULL for none), appends are held in handle until flush, the directory must be locked for writing, returns how many were written or an error
+{
+	struct cs1550_file_directory *file = get_file( attribute->index_of_directory, attribute->file_index );
+	open_file *pending = pending_of(file);
+	char canonical[MAX_PATH_LENGTH + 2];	//path of the file
+	int res;
+
+	if( handle != NULL && (pending == NULL || pending == handle) && offset == (off_t) file_size(file)
+		&& file_size(file) + size <= MAX_FILE_BLOCKS * BLOCK_SIZE && hold_pending(handle, file, buf, size) == 0 )	//an append that fits, it gets its blocks later all at once
+	{
+		file_path(canonical, attribute->index_of_directory, file);
+		path_cache_set_size(canonical, file_size(file));
+		return size;
+	}
+
+	res = flush_pending(attribute);	//anything else works on the blocks, so what was appended gets them first
+	if( res == 0 )
+	{
+		res = write_linked_file(attribute, handle, buf, size, offset);
+	}
+	return res;
+}
+
+static int flush_open_file(open_file *handle)	//writes what was appended through handle and only held in memory, for flush, fsync and release, returns 0 or an error
+{
+	cs1550_transaction tx;	//the inode, bitmap words and directory entry the new blocks change
+	meta_entry attribute;
+	int res = 0;
+
+	if( handle == NULL || handle->pending == NULL )	//nothing held, or unlink already dealt with it
+	{
+		return 0;
+	}
+
+	attribute = find_file_by_block(handle->inode, WRITE_LOCK);
+	begin_transaction(&tx);
+	if( attribute.index_of_directory > -1 && pending_of( get_file(attribute.index_of_directory, attribute.file_index) ) == handle )
+	{
+		res = flush_pending(&attribute);
+	}
+	if( commit_transaction() < 0 && res == 0 )	//the new blocks are not in .journal
+	{
+		res = -EIO;
+	}
+	release_directory(&attribute);
+	return res;
+}
+
+/* 
+ * Write size bytes from buf into file starting from offset
+ *
+ */
+static int cs1550_write(const char *path, const char *buf, size_t size,
+			  off_t offset, struct fuse_file_info *fi)
+{
+	open_file *handle = open_file_of(fi);
+	struct cs1550_file_directory orphan;	//what is left of an open file that was unlinked
+	cs1550_transaction tx;	//the inode, bitmap words and directory entry an append changes
+	meta_entry attribute;
+	int res;
+
+	if( handle != NULL && handle->stats != NULL )	//only truncating it does anything
+	{
+		return -EACCES;
+	}
+
+	attribute = handle != NULL ? find_file_by_block(handle->inode, WRITE_LOCK) : find_correct_directory(path, WRITE_LOCK);	//an open file was resolved at open
+	begin_transaction(&tx);
+	if( attribute.index_of_directory > -1 && attribute.file_index > -1 )
+	{
+		res = write_open_file(&attribute, handle, buf, size, offset);
+	}
+
+	else if( handle != NULL && found_file(&attribute, handle->inode, &orphan) != NULL )	//still open after unlink, it has no record to update
+	{
+		res = write_file(handle, &orphan, buf, size, offset);
+	}
+
+	else	//check to make sure path exists
+	{
+		res = -ENOENT;	//error
+	}
+	//set size (should be same as input) and return, or error
+
+	if( commit_transaction() < 0 && res >= 0 )	//not waited for, fsync makes it durable, but it has to be in .journal
+	{
+		res = -EIO;
+	}
+	release_directory(&attribute);
+	return res;
+}
+
+static int drop_inode(long block, unsigned long nlookup, unsigned long nopen)	//drops nlookup of the lookups the kernel holds of the file whose inode is block and nopen of its opens, an orphaned file is freed once neither is left, returns 0 or -EIO if the freeing did not reach .journal
+{
+	struct cs1550_file_directory orphan;	//all free_file_blocks() needs of it
+	cs1550_transaction tx;	//the freed bitmap words
+	inode_owner *owner;
+	int free_now = 0;
+	int res = 0;
+
+	pthread_mutex_lock(&orphan_lock);	//no read or write of the orphan can be going on while it is freed
+
+	pthread_mutex_lock(&owner_lock);
+	owner = find_owner(block);
+	if( owner != NULL )	//the kernel may forget an inode it looked up before a remount
+	{
+		owner->lookups -= nlookup < owner->lookups ? nlookup : owner->lookups;
+		owner->opens -= nopen < owner->opens ? nopen : owner->opens;
+		free_now = owner->lookups == 0 && owner->opens == 0 && owner->orphaned;
+		if( free_now )
+		{
+			owner->orphaned = 0;
+		}
+		put_owner(owner);
+	}
+	pthread_mutex_unlock(&owner_lock);
+
+	if( free_now )
+	{
+		begin_transaction(&tx);
+		memset(&orphan, 0, sizeof(orphan));
+		orphan.nInodeBlock = block * BLOCK_SIZE;
+		free_file_blocks(&orphan);
+		if( commit_transaction() < 0 )
+		{
+			res = -EIO;
+		}
+	}
+
+	pthread_mutex_unlock(&orphan_lock);
+	return res;
+}
+
+static int read_superblock(void)	//sets the geometry of .disk from its superblock, or the legacy one if it has none, returns 0 or -EINVAL if this build can not mount it
+{
+	cs1550_superblock superblock;
+
+	disk_size = lseek(disk_fd, 0, SEEK_END);
+
+	if( read_at(disk_fd, &superblock, sizeof(superblock), 0) != 0 || superblock.magic != SUPERBLOCK_MAGIC ||
+		superblock.checksum != journal_checksum((char *) &superblock, offsetof(cs1550_superblock, checksum)) )	//made by hand before there was mkfs
+	{
+		if( BLOCK_SIZE != 512 )
+		{
+			fprintf(stderr, "cs1550: .disk has no superblock, format it with mkfs\n");
+			return -EINVAL;
+		}
+		block_count = LEGACY_BLOCKS;
+		bitmap_words = (LEGACY_BLOCKS + 63) / 64;
+		bitmap_offset = disk_size - bitmap_words * sizeof(uint64_t);	//bitmap is at the end of .disk
+		strcpy(directory_file, ".directories");
+		return 0;
+	}
+
+	if( superblock.version != SUPERBLOCK_VERSION || superblock.block_size != BLOCK_SIZE || superblock.directory_record_size != sizeof(cs1550_directory_entry) )
+	{
+		fprintf(stderr, "cs1550: .disk has %u byte blocks (version %u), this was built for %d\n", superblock.block_size, superblock.version, BLOCK_SIZE);
+		return -EINVAL;
+	}
+	if( superblock.bitmap_words * 64 < superblock.block_count || superblock.bitmap_offset + superblock.bitmap_words * sizeof(uint64_t) > (uint64_t) disk_size ||
+		memchr(superblock.directory_file, '\0', sizeof(superblock.directory_file)) == NULL )
+	{
+		fprintf(stderr, "cs1550: the superblock of .disk does not fit it\n");
+		return -EINVAL;
+	}
+
+	block_count = superblock.block_count;
+	bitmap_words = superblock.bitmap_words;
+	bitmap_offset = superblock.bitmap_offset;
+	strcpy(directory_file, superblock.directory_file);
+	return 0;
+}
+
+static void start_owners(void)	//makes owner_table with no file held, lookups and opens fill it in
+{
+	owner_table = calloc(OWNER_TABLE_START_SIZE, sizeof(inode_owner *));
+	if( owner_table == NULL )
+	{
+		perror("inode owners");
+		exit(1);
+	}
+	owner_table_size = OWNER_TABLE_START_SIZE;
+	owner_count = 0;
+}
+
+static void stop_owners(void)	//frees every orphaned file, at unmount the kernel holds no lookups and no file is open anymore, and then owner_table
+{
+	inode_owner *owner;
+	inode_owner *next;
+	long slot;
+
+	for(slot = 0; slot < owner_table_size; slot++)
+	{
+		for(owner = owner_table[ slot ]; owner != NULL; owner = next)
+		{
+			next = owner->next;
+			if( owner->orphaned )	//drop_inode() frees the owner too
+			{
+				drop_inode(owner->block, owner->lookups, owner->opens);
+			}
+			else
+			{
+				free(owner);
+			}
+		}
+	}
+
+	free(owner_table);
+	owner_table = NULL;
+	owner_table_size = 0;
+	owner_count = 0;
+}
+
+static void count_shares(void)	//makes block_shares from the data pointers of every file, nothing on disk says which blocks are shared so each inode is read once at mount
+{
+	uint64_t *seen;	//blocks a data pointer was found pointing at, one bit each
+	cs1550_file_map map;
+	int index_of_directory;
+	int file_index;
+	long index;
+	long block;
+
+	seen = calloc(bitmap_words, sizeof(uint64_t));
+	if( start_block_table(&block_shares, 0) != 0 || seen == NULL )
+	{
+		perror("block shares");
+		exit(1);
+	}
+	shared_block_count = 0;
+
+	for(index_of_directory = 0; index_of_directory < directory_count; index_of_directory++)
+	{
+		if( !is_directory_record(index_of_directory) )
+		{
+			continue;
+		}
+		for(file_index = 0; file_index < contents_of[ index_of_directory ].nFiles; file_index++)
+		{
+			if( load_file_map(get_file(index_of_directory, file_index), &map) != 0 )
+			{
+				continue;
+			}
+			for(index = 0; index < map.inode.nBlocks; index++)
+			{
+				block = get_file_block(&map, index);
+				if( block < 0 || block >= block_count )	//a hole or compressed chunk marker
+				{
+					continue;
+				}
+				if( (seen[ block / 64 ] & ((uint64_t) 1 << (block % 64))) && share_block(block) != 0 )
+				{
+					perror("block shares");	//freeing it would lose the data of the other pointers
+					exit(1);
+				}
+				seen[ block / 64 ] |= (uint64_t) 1 << (block % 64);
+			}
+		}
+	}
+
+	free(seen);
+}
+
+static void start_dedup(void)	//makes the empty dedup index, -o dedup is turned off if there is no memory for it
+{
+	if( start_block_table(&block_fingerprints, 0) != 0 )
+	{
+		perror("dedup");
+		config.dedup = 0;
+		return;
+	}
+
+	dedup_index_size = 0;
+	dedup_index_used = 0;
+	if( rebuild_dedup_index() != 0 )
+	{
+		perror("dedup");
+		stop_block_table(&block_fingerprints);
+		config.dedup = 0;
+	}
+}
+
+static void stop_shares(void)	//frees block_shares and the dedup index, at unmount once no block is freed anymore
+{
+	stop_block_table(&block_shares);
+	stop_block_table(&block_fingerprints);
+	free(dedup_index);
+	dedup_index = NULL;
+	shared_block_count = 0;
+	dedup_index_size = 0;
+	dedup_index_used = 0;
+}
+
+/*
+ * Called once when the file system is mounted, before any other handler
+ *
+ */
+static void *cs1550_init(struct fuse_conn_info *conn)
+{
+	if( conn->capable & FUSE_CAP_BIG_WRITES )	//a write can be up to max_write (128 KB unless -o max_write lowers it) instead of one page
+	{
+		conn->want |= FUSE_CAP_BIG_WRITES;
+	}
+
+	//both files stay open until unmount and are only used with pread and pwrite
+	disk_fd = open(".disk", O_RDWR);
+	if( disk_fd == -1 )
+	{
+		perror("cs1550 .disk");
+	}
+	else if( read_superblock() != 0 )	//not a layout this build can use, it said why
+	{
+		close(disk_fd);
+		disk_fd = -1;
+	}
+	else
+	{
+		directory_fd = open(directory_file, O_RDWR | O_CREAT, 0644);
+		if( directory_fd == -1 )
+		{
+			perror("cs1550 .directories");
+		}
+	}
+
+	if( directory_fd != -1 && disk_fd != -1 )
+	{
+
+		//metadata changes are logged here and only go to .disk and .directories for good at a checkpoint
+		journal_fd = open(".journal", O_RDWR | O_CREAT, 0644);
+		if( journal_fd == -1 )
+		{
+			perror("cs1550 .journal");	//every handler syncs the bitmap itself instead
+		}
+		else if( replay_journal() != 0 )	//before anything is loaded from .disk or .directories, which may hold only part of what it has
+		{
+			close(journal_fd);
+			close(directory_fd);
+			close(disk_fd);
+			journal_fd = -1;
+			directory_fd = -1;
+			disk_fd = -1;
+		}
+		else if( (errno = posix_fallocate(journal_fd, 0, JOURNAL_SIZE)) != 0 )	//so appending to it does not change its size
+		{
+			perror("cs1550 .journal");	//it was just emptied, so every handler can sync the bitmap itself instead
+			close(journal_fd);
+			journal_fd = -1;
+		}
+	}
+
+	start_io(config.io_depth);	//batches of reads and writes go to the kernel together
+
+	if( config.use_mmap && disk_fd != -1 )	//reads and writes of .disk become copies in and out of memory
+	{
+		disk_map = mmap(NULL, disk_size, PROT_READ | PROT_WRITE, MAP_SHARED, disk_fd, 0);
+		if( disk_map == MAP_FAILED )
+		{
+			perror("mmap .disk");	//fall back to pread and pwrite
+			disk_map = NULL;
+		}
+	}
+
+	if( disk_map == NULL && disk_fd != -1 && config.cache_blocks > 0 )	//hot blocks are served from memory and small writes to a block are merged
+	{
+		start_cache(journal_fd != -1 && config.cache_blocks < JOURNAL_CACHE_BLOCKS ? JOURNAL_CACHE_BLOCKS : config.cache_blocks);
+		cache_data = cache != NULL;
+	}
+	else if( disk_fd != -1 && journal_fd != -1 )	//file data goes straight to .disk, but what transactions change still waits for .journal in the cache
+	{
+		start_cache(JOURNAL_CACHE_BLOCKS);
+	}
+
+	if( cache_data && config.readahead_blocks > 0 )	//sequential readers find the next blocks already in the cache
+	{
+		start_readahead(config.readahead_blocks);
+	}
+
+	start_owners();
+	load_directory_table();	//every directory lookup after this is served from memory
+	load_bitmap();	//and every block allocation from the in memory bitmap
+	count_shares();	//blocks -o dedup shared on an earlier mount are copied on write whether or not it is given now
+	if( config.dedup )
+	{
+		start_dedup();
+	}
+
+	return NULL;
+}
+
+/*
+ * Called once when the file system is unmounted
+ *
+ */
+static void cs1550_destroy(void *private_data)
+{
+	(void) private_data;
+
+	stop_owners();	//orphaned files go before the cache and the journal do
+	stop_shares();
+	stop_readahead();
+	stop_cache();
+	close_journal();
+	sync_bitmap();
+
+	free(free_space);
+	free_space = NULL;
+
+	if( disk_map != NULL )
+	{
+		msync(disk_map, disk_size, MS_SYNC);
+		munmap(disk_map, disk_size);
+		disk_map = NULL;
+	}
+
+	free(directory_table);
+
+	close(disk_fd);
+	close(directory_fd);
+	disk_fd = -1;
+	directory_fd = -1;
+
+	free(directory_index);
+	close_directories();
+	memset(path_cache, 0, sizeof(path_cache));	//its indexes are only good for this mount
+	directory_table = NULL;
+	directory_index = NULL;
+	directory_count = 0;
+	directory_capacity = 0;
+}
+
+static int truncate_linked_file(meta_entry *attribute, open_file *handle, off_t size)	//truncate_file() for a file in a directory locked for writing, appends held in memory are cut or written first, and its record is rewritten
+{
+	struct cs1550_file_directory *file = get_file( attribute->index_of_directory, attribute->file_index );
+	open_file *pending = pending_of(file);
+	int record;	//the record of the directory the file is in
+	cs1550_directory_entry directory_entry;
+	size_t old_size;
+	char canonical[MAX_PATH_LENGTH + 2];	//path of the file
+	int res = 0;
+
+	if( pending != NULL && size > (off_t) file->fsize && size <= (off_t) file_size(file) )	//only what is held in memory is cut, nothing on disk changes
+	{
+		pthread_mutex_lock(&owner_lock);
+		pending_total -= pending->pending_size - (size - file->fsize);
+		pthread_mutex_unlock(&owner_lock);
+		pending->pending_size = size - file->fsize;
+	}
+	else
+	{
+		if( size <= (off_t) file->fsize )
+		{
+			clear_pending( file->nInodeBlock / BLOCK_SIZE );	//all of it is past the new end
+		}
+		else
+		{
+			res = flush_pending(attribute);	//the hole goes after it
+		}
+
+		if( res == 0 )
+		{
+			record = file_record( attribute->index_of_directory, attribute->file_index );
+			directory_entry = get_directory_entry( record );
+			file = &directory_entry.files[ attribute->file_index % MAX_FILES_IN_DIR ];
+			old_size = file->fsize;
+			res = truncate_file(handle, file, size);
+			if( file->fsize != old_size )
+			{
+				write_directory_entry( directory_entry, record );	//rewrite the struct and the in memory copy
+			}
+		}
+	}
+
+	file = get_file( attribute->index_of_directory, attribute->file_index );
+	file_path(canonical, attribute->index_of_directory, file);
+	path_cache_set_size(canonical, file_size(file));
+	return res;
+}
+
+static int truncate_found_file(meta_entry *attribute, open_file *handle, long block, off_t size)	//truncates the file find_file_by_block() found for block, locked for writing, whether it is linked or orphaned, returns 0 or -errno
+{
+	struct cs1550_file_directory orphan;	//what is left of an open file that was unlinked
+
+	if( attribute->index_of_directory > -1 && attribute->file_index > -1 )
+	{
+		return truncate_linked_file(attribute, handle, size);
+	}
+	if( found_file(attribute, block, &orphan) != NULL )	//still open after unlink, it has no record to update
+	{
+		return truncate_file(handle, &orphan, size);
+	}
+	return -ENOENT;
+}
+
+/*
+ * truncate is called when a new file is created (with a 0 size), when an
+ * existing file is opened with O_TRUNC, or when it is made shorter or
+ * longer. The blocks past the new size are given back, and a file that
+ * grows gets a hole that reads as zeros without any blocks.
+ *
+ */
+static int cs1550_truncate(const char *path, off_t size)
+{
+	cs1550_transaction tx;	//the inode, freed bitmap words and directory entry
+	meta_entry attribute;
+	int res;
+
+	if( strcmp(path, STATS_PATH) == 0 )	//how the counters are started over
+	{
+		reset_stats();
+		return 0;
+	}
+
+	attribute = find_correct_directory(path, WRITE_LOCK);
+	begin_transaction(&tx);
+	if( attribute.index_of_directory > -1 && attribute.slash_count == 1 )	//means that paramter path is a directory
+	{
+		res = -EISDIR;
+	}
+	else if( attribute.file_index == -1 )	//file not found
+	{
+		res = -ENOENT;
+	}
+	else
+	{
+		res = truncate_linked_file(&attribute, NULL, size);
+	}
+	if( commit_transaction() < 0 && res == 0 )	//not waited for, like a write
+	{
+		res = -EIO;
+	}
+	release_directory(&attribute);
+	return res;
+}
+
+/*
+ * ftruncate on an open file, which is found by its inode like read and write
+ *
+ */
+static int cs1550_ftruncate(const char *path, off_t size, struct fuse_file_info *fi)
+{
+	open_file *handle = open_file_of(fi);
+	cs1550_transaction tx;	//the inode, freed bitmap words and directory entry
+	meta_entry attribute;
+	int res;
+
+	if( handle == NULL )
+	{
+		return cs1550_truncate(path, size);
+	}
+	if( handle->stats != NULL )
+	{
+		reset_stats();
+		return 0;
+	}
+
+	attribute = find_file_by_block(handle->inode, WRITE_LOCK);
+	begin_transaction(&tx);
+	res = truncate_found_file(&attribute, handle, handle->inode, size);
+	if( commit_transaction() < 0 && res == 0 )
+	{
+		res = -EIO;
+	}
+	release_directory(&attribute);
+	return res;
+}
+
+
+/* 
+ * Called when we open a file
+ *
+ */
+static int open_inode(long block, meta_entry *attribute, struct fuse_file_info *fi)	//makes the open_file of the file whose inode is block, which attribute found and locked, and counts it so an unlink leaves the blocks until release, returns 0 or -ENOMEM
+{
+	open_file *handle = calloc(1, sizeof(open_file));	//freed by cs1550_release()
+	inode_owner *owner;
+
+	if( handle == NULL )
+	{
+		return -ENOMEM;
+	}
+
+	pthread_mutex_lock(&owner_lock);
+	owner = hold_owner(block, attribute->index_of_directory, attribute->file_index);
+	if( owner != NULL )
+	{
+		owner->opens++;
+	}
+	pthread_mutex_unlock(&owner_lock);
+	if( owner == NULL )
+	{
+		free(handle);
+		return -ENOMEM;
+	}
+
+	pthread_mutex_init(&handle->lock, NULL);
+	handle->inode = block;
+
+	fi->fh = (uintptr_t) handle;
+	return 0;
+}
+
+static int cs1550_open(const char *path, struct fuse_file_info *fi)
+{
+	meta_entry attribute;
+	int res;
+
+	if( strcmp(path, STATS_PATH) == 0 )
+	{
+		return open_stats(fi);
+	}
+
+	attribute = find_correct_directory(path, READ_LOCK);
+	if( attribute.index_of_directory > -1 && attribute.slash_count == 1 )
+	{
+		res = -EISDIR;
+	}
+	else if( attribute.file_index == -1 )	//if we can't find the desired file, return an error
+	{
+		res = -ENOENT;
+	}
+	else	//read and write find the file by its inode from now on, with no path to look up
+	{
+		res = open_inode( get_file(attribute.index_of_directory, attribute.file_index)->nInodeBlock / BLOCK_SIZE, &attribute, fi );
+	}
+	release_directory(&attribute);
+
+    /* We're not going to worry about permissions for this project, but 
+	   if we were and we don't have them to the file we should return an error
+
+        return -EACCES;
+    */
+
+    return res;
+}
+
+/*
+ * Called when close is called on a file descriptor, but because it might
+ * have been dup'ed, this isn't a guarantee we won't ever need the file 
+ * again. For us, return success simply to avoid the unimplemented error
+ * in the debug log.
+ */
+static int cs1550_flush (const char *path , struct fuse_file_info *fi)
+{
+	int res = flush_open_file( open_file_of(fi) );	//appends held in memory get their blocks now that the size is known
+
+	(void) path;
+
+	if( res != 0 )
+	{
+		return res;
+	}
+
+	if( disk_map != NULL )	//writes only went into the mapping, so this is where they become durable
+	{
+		return sync_backing_files(0);
+	}
+
+	return write_back_cache(journal_durable());	//dirty blocks of the file (and any other) go to .disk, 0 on success
+}
+
+/*
+ * Called once the last descriptor of an open file is closed
+ *
+ */
+static int cs1550_release(const char *path, struct fuse_file_info *fi)
+{
+	open_file *handle = open_file_of(fi);
+	int res = flush_open_file(handle);	//normally flush already did
+
+	(void) path;
+
+	if( handle != NULL )
+	{
+		if( handle->stats == NULL )
+		{
+			if( drop_inode(handle->inode, 0, 1) != 0 && res == 0 )	//frees the file if it was unlinked while open
+			{
+				res = -EIO;
+			}
+		}
+		free(handle->stats);
+		free(handle->pending);	//only left if the file was freed meanwhile
+		pthread_mutex_destroy(&handle->lock);
+		free(handle);
+		fi->fh = 0;
+	}
+	return res;
+}
+
+/*
+ * Called when the data (and metadata unless datasync is set) of a file
+ * should be made durable
+ */
+static int cs1550_fsync(const char *path, int datasync, struct fuse_file_info *fi)
+{
+	int res;
+
+	(void) path;
+	(void) datasync;
+
+	res = flush_open_file( open_file_of(fi) );
+	if( res == 0 )
+	{
+		res = force_journal();	//appends that were not waited for
+	}
+	if( res == 0 )
+	{
+		res = sync_backing_files(0);
+	}
+	return res;
+}
+
+
+/*
+ * With -o lowlevel the kernel calls the handlers below instead, by inode number.
+ * A name is looked up once; read, write and getattr after that go straight to
+ * the inode through owner_table, with no path to parse. Making and removing names
+ * spells the path from the parent and uses the handlers above.
+ */
+
+static int ll_path(fuse_ino_t parent, const char *name, char *path, size_t size)	//spells the path of name in the directory parent, returns 0 or -errno
+{
+	long index = INO_INDEX(parent);
+	int res = 0;
+
+	if( parent == FUSE_ROOT_ID )
+	{
+		return (size_t) snprintf(path, size, "/%s", name) < size ? 0 : -ENAMETOOLONG;
+	}
+	if( INO_IS_FILE(parent) )
+	{
+		return -ENOTDIR;
+	}
+
+	pthread_rwlock_rdlock(&directory_table_lock);	//the table can move, the name in it does not change
+	if( index < 0 || index >= directory_count || !is_directory_record(index) )
+	{
+		res = -ENOENT;
+	}
+	else if( (size_t) snprintf(path, size, "%s/%s", directory_table[ index ].dname, name) >= size )
+	{
+		res = -ENAMETOOLONG;
+	}
+	pthread_rwlock_unlock(&directory_table_lock);
+	return res;
+}
+
+static int ll_entry(const char *path, struct fuse_entry_param *entry)	//fills entry with what path is and counts a lookup of it if it is a file, returns 0 or -ENOENT
+{
+	meta_entry attribute = find_correct_directory(path, READ_LOCK);
+	struct cs1550_file_directory *file;
+	int res = 0;
+
+	memset(entry, 0, sizeof(struct fuse_entry_param));
+	entry->attr_timeout = LOWLEVEL_TIMEOUT;
+	entry->entry_timeout = LOWLEVEL_TIMEOUT;
+
+	if( attribute.index_of_directory > -1 && attribute.slash_count == 1 )
+	{
+		fill_directory_stat(&entry->attr);
+		entry->ino = DIRECTORY_INO(attribute.index_of_directory);
+	}
+	else if( attribute.file_index > -1 )
+	{
+		file = get_file(attribute.index_of_directory, attribute.file_index);
+		fill_file_stat(&entry->attr, file_size(file));
+		entry->ino = FILE_INO(file->nInodeBlock / BLOCK_SIZE);
+		res = hold_inode(file->nInodeBlock / BLOCK_SIZE, attribute.index_of_directory, attribute.file_index);	//while the directory is locked, so an unlink after this sees the lookup
+	}
+	else
+	{
+		res = -ENOENT;
+	}
+	entry->attr.st_ino = entry->ino;
+
+	release_directory(&attribute);
+	return res;
+}
+
+static int ll_stat(fuse_ino_t ino, struct stat *stbuf)	//fills stbuf with the attributes of ino, returns 0 or -ENOENT
+{
+	meta_entry attribute;
+	struct cs1550_file_directory orphan;
+	struct cs1550_file_directory *file;
+	int res = 0;
+
+	if( ino == FUSE_ROOT_ID )
+	{
+		fill_directory_stat(stbuf);
+	}
+	else if( !INO_IS_FILE(ino) )
+	{
+		attribute = find_directory_by_index(INO_INDEX(ino), READ_LOCK);
+		fill_directory_stat(stbuf);
+		res = attribute.index_of_directory > -1 ? 0 : -ENOENT;
+		release_directory(&attribute);
+	}
+	else
+	{
+		attribute = find_file_by_block(INO_INDEX(ino), READ_LOCK);
+		file = found_file(&attribute, INO_INDEX(ino), &orphan);
+		if( file != NULL )
+		{
+			fill_file_stat(stbuf, file_size(file));
+		}
+		else
+		{
+			res = -ENOENT;
+		}
+		release_directory(&attribute);
+	}
+	stbuf->st_ino = ino;
+	return res;
+}
+
+static int ino_is_valid(fuse_ino_t ino)	//returns 1 if a file inode number names a block of .disk
+{
+	return INO_INDEX(ino) >= 0 && INO_INDEX(ino) < block_count;
+}
+
+static void cs1550_ll_lookup(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+	char path[MAX_PATH_LENGTH + 2];
+	struct fuse_entry_param entry;
+	int res = ll_path(parent, name, path, sizeof(path));
+
+	if( res == 0 && strcmp(path, STATS_PATH) == 0 )	//not on .disk, its size changes all the time so the kernel keeps nothing of it
+	{
+		memset(&entry, 0, sizeof(entry));
+		entry.ino = STATS_INO;
+		fill_stats_stat(&entry.attr);
+		entry.attr.st_ino = STATS_INO;
+	}
+	else if( res == 0 )
+	{
+		res = ll_entry(path, &entry);
+	}
+
+	if( res == -ENOENT )	//a negative entry, the kernel remembers the name is not there like the path cache does, a name too long is an error it does not keep
+	{
+		memset(&entry, 0, sizeof(entry));
+		entry.entry_timeout = LOWLEVEL_TIMEOUT;
+		res = 0;
+	}
+
+	if( res == 0 )
+	{
+		fuse_reply_entry(req, &entry);
+	}
+	else
+	{
+		fuse_reply_err(req, -res);
+	}
+}
+
+static void cs1550_ll_forget(fuse_req_t req, fuse_ino_t ino, unsigned long nlookup)
+{
+	if( ino != FUSE_ROOT_ID && INO_IS_FILE(ino) && ino_is_valid(ino) )	//only files are counted, directories are never removed
+	{
+		drop_inode(INO_INDEX(ino), nlookup, 0);
+	}
+	fuse_reply_none(req);
+}
+
+static void cs1550_ll_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+	struct stat stbuf;
+	int res;
+
+	(void) fi;
+
+	if( ino == STATS_INO )
+	{
+		fill_stats_stat(&stbuf);
+		stbuf.st_ino = STATS_INO;
+		fuse_reply_attr(req, &stbuf, 0);
+		return;
+	}
+
+	res = ino != FUSE_ROOT_ID && INO_IS_FILE(ino) && !ino_is_valid(ino) ? -ENOENT : ll_stat(ino, &stbuf);
+	if( res == 0 )
+	{
+		fuse_reply_attr(req, &stbuf, LOWLEVEL_TIMEOUT);
+	}
+	else
+	{
+		fuse_reply_err(req, -res);
+	}
+}
+
+static void cs1550_ll_setattr(fuse_req_t req, fuse_ino_t ino, struct stat *attr, int to_set, struct fuse_file_info *fi)
+{
+	cs1550_transaction tx;	//the inode, freed bitmap words and directory entry
+	meta_entry attribute;
+	int res;
+
+	if( (to_set & FUSE_SET_ATTR_SIZE) && ino == STATS_INO )	//how the counters are started over
+	{
+		reset_stats();
+	}
+	else if( (to_set & FUSE_SET_ATTR_SIZE) && (ino == FUSE_ROOT_ID || !INO_IS_FILE(ino)) )
+	{
+		fuse_reply_err(req, EISDIR);
+		return;
+	}
+	else if( (to_set & FUSE_SET_ATTR_SIZE) && ino_is_valid(ino) )	//only the size can be changed
+	{
+		attribute = find_file_by_block(INO_INDEX(ino), WRITE_LOCK);
+		begin_transaction(&tx);
+		res = truncate_found_file(&attribute, open_file_of(fi), INO_INDEX(ino), attr->st_size);
+		if( commit_transaction() < 0 && res == 0 )
+		{
+			res = -EIO;
+		}
+		release_directory(&attribute);
+		if( res != 0 )
+		{
+			fuse_reply_err(req, -res);
+			return;
+		}
+	}
+
+	cs1550_ll_getattr(req, ino, fi);
+}
+
+static void ll_make(fuse_req_t req, fuse_ino_t parent, const char *name, int directory, struct fuse_file_info *fi)	//mknod, mkdir and create, name is made with the path handlers and then looked up, fi is only given by create
+{
+	char path[MAX_PATH_LENGTH + 2];
+	struct fuse_entry_param entry;
+	int res = ll_path(parent, name, path, sizeof(path));
+
+	if( res == 0 )
+	{
+		res = directory ? cs1550_mkdir(path, S_IFDIR | 0755) : cs1550_mknod(path, S_IFREG | 0666, 0);
+	}
+	if( res == 0 && fi != NULL )
+	{
+		res = cs1550_open(path, fi);
+	}
+	if( res == 0 )
+	{
+		res = ll_entry(path, &entry);
+		if( res != 0 && fi != NULL )
+		{
+			cs1550_release(path, fi);
+		}
+	}
+
+	if( res != 0 )
+	{
+		fuse_reply_err(req, -res);
+	}
+	else if( fi != NULL )
+	{
+		fi->keep_cache = 1;
+		fuse_reply_create(req, &entry, fi);
+	}
+	else
+	{
+		fuse_reply_entry(req, &entry);
+	}
+}
+
+static void cs1550_ll_mknod(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode, dev_t rdev)
+{
+	(void) mode;
+	(void) rdev;
+
+	ll_make(req, parent, name, 0, NULL);
+}
+
+static void cs1550_ll_mkdir(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode)
+{
+	(void) mode;
+
+	ll_make(req, parent, name, 1, NULL);
+}
+
+static void cs1550_ll_create(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode, struct fuse_file_info *fi)
+{
+	(void) mode;
+
+	ll_make(req, parent, name, 0, fi);
+}
+
+static void cs1550_ll_unlink(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+	char path[MAX_PATH_LENGTH + 2];
+	int res = ll_path(parent, name, path, sizeof(path));
+
+	if( res == 0 )
+	{
+		res = cs1550_unlink(path);	//the kernel's lookups keep the inode until it forgets them
+	}
+	fuse_reply_err(req, -res);
+}
+
+static void cs1550_ll_rmdir(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+	char path[MAX_PATH_LENGTH + 2];
+	int res = ll_path(parent, name, path, sizeof(path));
+
+	if( res == 0 )
+	{
+		res = cs1550_rmdir(path);
+	}
+	fuse_reply_err(req, -res);
+}
+
+static void cs1550_ll_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+	meta_entry attribute;
+	struct cs1550_file_directory orphan;
+	int res = -ENOENT;
+
+	if( ino == FUSE_ROOT_ID || !INO_IS_FILE(ino) )
+	{
+		fuse_reply_err(req, EISDIR);
+		return;
+	}
+
+	if( ino == STATS_INO )
+	{
+		res = open_stats(fi);
+		if( res == 0 )
+		{
+			fuse_reply_open(req, fi);
+		}
+		else
+		{
+			fuse_reply_err(req, -res);
+		}
+		return;
+	}
+
+	if( ino_is_valid(ino) )
+	{
+		attribute = find_file_by_block(INO_INDEX(ino), READ_LOCK);
+		if( found_file(&attribute, INO_INDEX(ino), &orphan) != NULL )
+		{
+			res = open_inode(INO_INDEX(ino), &attribute, fi);
+		}
+		release_directory(&attribute);
+	}
+
+	if( res != 0 )
+	{
+		fuse_reply_err(req, -res);
+		return;
+	}
+	fi->keep_cache = 1;	//every write goes through the kernel, so what it cached of the file is still good
+	fuse_reply_open(req, fi);
+}
+
+static int splice_file(fuse_req_t req, open_file *handle, struct cs1550_file_directory *file, size_t size, off_t offset)	//replies with up to size bytes at offset of file, which must be locked, as pieces of .disk the kernel copies itself, returns 0 or -EIO
+{
+	cs1550_file_map map;	//where the blocks of the file are
+	struct fuse_bufvec *bufv;	//one piece of .disk per run of blocks
+	struct fuse_buf *piece;
+	char *zeros = NULL;	//what the pieces for holes point at
+	char *copy;	//the data of a compressed file, or of one kept in its inode, which is not in .disk as it reads
+	long index = offset / BLOCK_SIZE;	//first block of the file that is read
+	long last_index;	//last block of the file that is read
+	long run_start;	//first disk block of the current run
+	long run_length;	//how many blocks are in the current run
+	off_t from;	//first byte of the run that is read
+	off_t to;	//one past the last byte of the run that is read
+
+	if( offset >= (off_t) file->fsize )	//nothing past the end of the file
+	{
+		fuse_reply_buf(req, NULL, 0);
+		return 0;
+	}
+	if( offset + size > file->fsize )	//only read up to the end of the file
+	{
+		size = file->fsize - offset;
+	}
+	if( load_open_map(handle, file, &map) != 0 )
+	{
+		return -EIO;
+	}
+	if( map.inode.flags & (INODE_COMPRESSED | INODE_INLINE) )	//the kernel can not decompress or pick the data out of the inode, it is copied out here
+	{
+		copy = malloc(size);
+		if( copy == NULL || copy_blocks(&map, copy, size, offset, 0) != 0 )
+		{
+			free(copy);
+			return -EIO;
+		}
+		fuse_reply_buf(req, copy, size);
+		free(copy);
+		return 0;
+	}
+
+	last_index = (offset + size - 1) / BLOCK_SIZE;
+	bufv = calloc(1, sizeof(struct fuse_bufvec) + (last_index - index + 1) * sizeof(struct fuse_buf));	//at most one piece per block
+	if( bufv == NULL )
+	{
+		return -EIO;
+	}
+
+	while( index <= last_index )
+	{
+		run_length = file_run(&map, index, last_index, &run_start);
+		if( map.error != 0 )	//an indirect block could not be read
+		{
+			free(zeros);
+			free(bufv);
+			return -EIO;
+		}
+		from = index * BLOCK_SIZE > offset ? index * BLOCK_SIZE : offset;
+		to = (index + run_length) * BLOCK_SIZE < offset + (off_t) size ? (index + run_length) * BLOCK_SIZE : offset + (off_t) size;
+
+		piece = &bufv->buf[ bufv->count++ ];
+		piece->size = to - from;
+		if( run_start == HOLE_BLOCK )	//no piece of .disk has it, the zeros come from memory
+		{
+			zeros = zeros != NULL ? zeros : calloc(1, size);
+			if( zeros == NULL )
+			{
+				free(bufv);
+				return -EIO;
+			}
+			piece->mem = zeros;
+		}
+		else
+		{
+			piece->flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK;
+			piece->fd = disk_fd;
+			piece->pos = run_start * BLOCK_SIZE + (from - index * BLOCK_SIZE);
+		}
+		index += run_length;
+	}
+
+	fuse_reply_data(req, bufv, FUSE_BUF_SPLICE_MOVE);	//replies even when it fails
+	free(zeros);
+	free(bufv);
+	return 0;
+}
+
+static void cs1550_ll_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset, struct fuse_file_info *fi)
+{
+	meta_entry attribute;
+	struct cs1550_file_directory orphan;
+	struct cs1550_file_directory *file;
+	char *buf = NULL;
+	int res;
+
+	if( ino == FUSE_ROOT_ID || !INO_IS_FILE(ino) )
+	{
+		fuse_reply_err(req, EISDIR);
+		return;
+	}
+	if( ino == STATS_INO )	//what it said when it was opened
+	{
+		buf = malloc(size > 0 ? size : 1);
+		if( buf == NULL || open_file_of(fi) == NULL || open_file_of(fi)->stats == NULL )
+		{
+			fuse_reply_err(req, buf == NULL ? ENOMEM : EBADF);
+		}
+		else
+		{
+			fuse_reply_buf(req, buf, read_stats(open_file_of(fi), buf, size, offset));
+		}
+		free(buf);
+		return;
+	}
+	if( !ino_is_valid(ino) )
+	{
+		fuse_reply_err(req, ENOENT);
+		return;
+	}
+
+	attribute = find_file_by_block(INO_INDEX(ino), READ_LOCK);
+	file = found_file(&attribute, INO_INDEX(ino), &orphan);
+
+	if( file == NULL )
+	{
+		res = -ENOENT;
+	}
+	else if( !cache_data && disk_map == NULL && pending_of(file) == NULL )	//.disk holds every block as it is, so the kernel can take the data straight from it
+	{
+		res = splice_file(req, open_file_of(fi), file, size, offset);
+	}
+	else
+	{
+		buf = malloc(size > 0 ? size : 1);
+		res = buf != NULL ? read_file(open_file_of(fi), file, buf, size, offset) : -ENOMEM;
+	}
+	release_directory(&attribute);
+
+	if( res < 0 )
+	{
+		fuse_reply_err(req, -res);
+	}
+	else if( buf != NULL )
+	{
+		fuse_reply_buf(req, buf, res);
+	}
+	free(buf);
+}
+
+static void cs1550_ll_write(fuse_req_t req, fuse_ino_t ino, const char *buf, size_t size, off_t offset, struct fuse_file_info *fi)
+{
+	cs1550_transaction tx;	//the inode, bitmap words and directory entry an append changes
+	meta_entry attribute;
+	struct cs1550_file_directory orphan;
+	int res;
+
+	if( ino == STATS_INO )	//only truncating it does anything
+	{
+		fuse_reply_err(req, EACCES);
+		return;
+	}
+	if( ino == FUSE_ROOT_ID || !INO_IS_FILE(ino) || !ino_is_valid(ino) )
+	{
+		fuse_reply_err(req, EBADF);
+		return;
+	}
+
+	attribute = find_file_by_block(INO_INDEX(ino), WRITE_LOCK);
+	begin_transaction(&tx);
+
+	if( attribute.index_of_directory > -1 )
+	{
+		res = write_open_file(&attribute, open_file_of(fi), buf, size, offset);
+	}
+	else if( found_file(&attribute, INO_INDEX(ino), &orphan) != NULL )	//still open after unlink, it has no record to update
+	{
+		res = write_file(open_file_of(fi), &orphan, buf, size, offset);
+	}
+	else
+	{
+		res = -ENOENT;
+	}
+
+	if( commit_transaction() < 0 && res >= 0 )	//not waited for, fsync makes it durable, but it has to be in .journal
+	{
+		res = -EIO;
+	}
+	release_directory(&attribute);
+
+	if( res < 0 )
+	{
+		fuse_reply_err(req, -res);
+	}
+	else
+	{
+		fuse_reply_write(req, res);
+	}
+}
+
+static void cs1550_ll_flush(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+	(void) ino;
+
+	fuse_reply_err(req, -cs1550_flush(NULL, fi));
+}
+
+static void cs1550_ll_release(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+	(void) ino;
+
+	fuse_reply_err(req, -cs1550_release(NULL, fi));
+}
+
+static void cs1550_ll_fsync(fuse_req_t req, fuse_ino_t ino, int datasync, struct fuse_file_info *fi)
+{
+	(void) ino;
+
+	fuse_reply_err(req, -cs1550_fsync(NULL, datasync, fi));
+}
+
+struct lowlevel_listing	//the reply buffer cs1550_ll_readdir() fills
+{
+	fuse_req_t req;
+	char *data;
+	size_t size;	//how many bytes data holds
+	size_t used;	//how many of them are filled
+};
+
+typedef struct lowlevel_listing lowlevel_listing;
+
+static int ll_fill(void *buf, const char *name, const struct stat *stbuf, off_t off)	//the filler of cs1550_ll_readdir(), returns 1 once the reply is full
+{
+	lowlevel_listing *listing = buf;
+	size_t length = fuse_add_direntry(listing->req, listing->data + listing->used, listing->size - listing->used, name, stbuf, off);
+
+	if( length > listing->size - listing->used )	//did not fit so nothing was added
+	{
+		return 1;
+	}
+	listing->used += length;
+	return 0;
+}
+
+static void cs1550_ll_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset, struct fuse_file_info *fi)
+{
+	lowlevel_listing listing;
+	meta_entry attribute;
+	int res = 0;
+
+	(void) fi;
+
+	listing.req = req;
+	listing.data = malloc(size);
+	listing.size = size;
+	listing.used = 0;
+	if( listing.data == NULL )
+	{
+		fuse_reply_err(req, ENOMEM);
+		return;
+	}
+
+	if( ino == FUSE_ROOT_ID )
+	{
+		list_root(&listing, ll_fill, offset);
+	}
+	else if( INO_IS_FILE(ino) )
+	{
+		res = -ENOTDIR;
+	}
+	else
+	{
+		attribute = find_directory_by_index(INO_INDEX(ino), READ_LOCK);
+		if( attribute.index_of_directory > -1 )
+		{
+			list_files(&attribute, &listing, ll_fill, offset);
+		}
+		else
+		{
+			res = -ENOENT;
+		}
+		release_directory(&attribute);
+	}
+
+	if( res == 0 )
+	{
+		fuse_reply_buf(req, listing.data, listing.used);
+	}
+	else
+	{
+		fuse_reply_err(req, -res);
+	}
+	free(listing.data);
+}
+
+static void cs1550_ll_init(void *userdata, struct fuse_conn_info *conn)
+{
+	(void) userdata;
+
+	cs1550_init(conn);
+	if( !cache_data && disk_map == NULL && (conn->capable & FUSE_CAP_SPLICE_WRITE) )	//reads are spliced from .disk
+	{
+		conn->want |= FUSE_CAP_SPLICE_WRITE;
+	}
+}
+
+static void cs1550_ll_destroy(void *userdata)
+{
+	cs1550_destroy(userdata);
+}
+
+/*
+ * Every handler is registered through one of these, which times it for /.stats
+ * and does nothing else.
+ */
+
+static int timed_getattr(const char *path, struct stat *stbuf)
+{
+	uint64_t started = stats_clock();
+	int res = cs1550_getattr(path, stbuf);
+
+	time_op(OP_GETATTR, started);
+	return res;
+}
+
+static int timed_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off_t offset, struct fuse_file_info *fi)
+{
+	uint64_t started = stats_clock();
+	int res = cs1550_readdir(path, buf, filler, offset, fi);
+
+	time_op(OP_READDIR, started);
+	return res;
+}
+
+static int timed_mkdir(const char *path, mode_t mode)
+{
+	uint64_t started = stats_clock();
+	int res = cs1550_mkdir(path, mode);
+
+	time_op(OP_MKDIR, started);
+	return res;
+}
+
+static int timed_rmdir(const char *path)
+{
+	uint64_t started = stats_clock();
+	int res = cs1550_rmdir(path);
+
+	time_op(OP_RMDIR, started);
+	return res;
+}
+
+static int timed_read(const char *path, char *buf, size_t size, off_t offset, struct fuse_file_info *fi)
+{
+	uint64_t started = stats_clock();
+	int res = cs1550_read(path, buf, size, offset, fi);
+
+	time_op(OP_READ, started);
+	return res;
+}
+
+static int timed_write(const char *path, const char *buf, size_t size, off_t offset, struct fuse_file_info *fi)
+{
+	uint64_t started = stats_clock();
+	int res = cs1550_write(path, buf, size, offset, fi);
+
+	time_op(OP_WRITE, started);
+	return res;
+}
+
+static int timed_mknod(const char *path, mode_t mode, dev_t dev)
+{
+	uint64_t started = stats_clock();
+	int res = cs1550_mknod(path, mode, dev);
+
+	time_op(OP_MKNOD, started);
+	return res;
+}
+
+static int timed_unlink(const char *path)
+{
+	uint64_t started = stats_clock();
+	int res = cs1550_unlink(path);
+
+	time_op(OP_UNLINK, started);
+	return res;
+}
+
+static int timed_truncate(const char *path, off_t size)
+{
+	uint64_t started = stats_clock();
+	int res = cs1550_truncate(path, size);
+
+	time_op(OP_TRUNCATE, started);
+	return res;
+}
+
+static int timed_ftruncate(const char *path, off_t size, struct fuse_file_info *fi)
+{
+	uint64_t started = stats_clock();
+	int res = cs1550_ftruncate(path, size, fi);
+
+	time_op(OP_TRUNCATE, started);
+	return res;
+}
+
+static int timed_flush(const char *path, struct fuse_file_info *fi)
+{
+	uint64_t started = stats_clock();
+	int res = cs1550_flush(path, fi);
+
+	time_op(OP_FLUSH, started);
+	return res;
+}
+
+static int timed_fsync(const char *path, int datasync, struct fuse_file_info *fi)
+{
+	uint64_t started = stats_clock();
+	int res = cs1550_fsync(path, datasync, fi);
+
+	time_op(OP_FSYNC, started);
+	return res;
+}
+
+static int timed_open(const char *path, struct fuse_file_info *fi)
+{
+	uint64_t started = stats_clock();
+	int res = cs1550_open(path, fi);
+
+	time_op(OP_OPEN, started);
+	return res;
+}
+
+static int timed_release(const char *path, struct fuse_file_info *fi)
+{
+	uint64_t started = stats_clock();
+	int res = cs1550_release(path, fi);
+
+	time_op(OP_RELEASE, started);
+	return res;
+}
+
+static void timed_ll_lookup(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+	uint64_t started = stats_clock();
+
+	cs1550_ll_lookup(req, parent, name);
+	time_op(OP_LOOKUP, started);
+}
+
+static void timed_ll_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+	uint64_t started = stats_clock();
+
+	cs1550_ll_getattr(req, ino, fi);
+	time_op(OP_GETATTR, started);
+}
+
+static void timed_ll_setattr(fuse_req_t req, fuse_ino_t ino, struct stat *attr, int to_set, struct fuse_file_info *fi)
+{
+	uint64_t started = stats_clock();
+
+	cs1550_ll_setattr(req, ino, attr, to_set, fi);
+	time_op((to_set & FUSE_SET_ATTR_SIZE) ? OP_TRUNCATE : OP_SETATTR, started);	//chmod, chown and utimens are not truncates
+}
+
+static void timed_ll_mknod(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode, dev_t rdev)
+{
+	uint64_t started = stats_clock();
+
+	cs1550_ll_mknod(req, parent, name, mode, rdev);
+	time_op(OP_MKNOD, started);
+}
+
+static void timed_ll_mkdir(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode)
+{
+	uint64_t started = stats_clock();
+
+	cs1550_ll_mkdir(req, parent, name, mode);
+	time_op(OP_MKDIR, started);
+}
+
+static void timed_ll_unlink(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+	uint64_t started = stats_clock();
+
+	cs1550_ll_unlink(req, parent, name);
+	time_op(OP_UNLINK, started);
+}
+
+static void timed_ll_rmdir(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+	uint64_t started = stats_clock();
+
+	cs1550_ll_rmdir(req, parent, name);
+	time_op(OP_RMDIR, started);
+}
+
+static void timed_ll_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+	uint64_t started = stats_clock();
+
+	cs1550_ll_open(req, ino, fi);
+	time_op(OP_OPEN, started);
+}
+
+static void timed_ll_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset, struct fuse_file_info *fi)
+{
+	uint64_t started = stats_clock();
+
+	cs1550_ll_read(req, ino, size, offset, fi);
+	time_op(OP_READ, started);
+}
+
+static void timed_ll_write(fuse_req_t req, fuse_ino_t ino, const char *buf, size_t size, off_t offset, struct fuse_file_info *fi)
+{
+	uint64_t started = stats_clock();
+
+	cs1550_ll_write(req, ino, buf, size, offset, fi);
+	time_op(OP_WRITE, started);
+}
+
+static void timed_ll_flush(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+	uint64_t started = stats_clock();
+
+	cs1550_ll_flush(req, ino, fi);
+	time_op(OP_FLUSH, started);
+}
+
+static void timed_ll_release(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+	uint64_t started = stats_clock();
 
-//fuction prototypes
-int locate_directory(char *directory);
-int locate_file(char *directory, char *filename, char *extension);
-long get_first_free_block(void);
-int is_next_block_free(long start_address);
-long get_start_address(cs1550_directory_entry directory, int file_index);
-long find_next_free_block(long start_address);
-cs1550_directory_entry move_file(cs1550_directory_entry directory, int file_index);
-void write_directory_entry(cs1550_directory_entry current_directory, int index);
+	cs1550_ll_release(req, ino, fi);
+	time_op(OP_RELEASE, started);
+}
 
-static cs1550_directory_entry get_directory_entry(int index)	//returns the directory entry at the index
+static void timed_ll_fsync(fuse_req_t req, fuse_ino_t ino, int datasync, struct fuse_file_info *fi)
 {
-	FILE *directory_list;	//file
-	cs1550_directory_entry current_directory;	//holds the directory
-	
-	directory_list = fopen(".directories", "rb");
+	uint64_t started = stats_clock();
 
-	fseek(directory_list, index * sizeof(current_directory), SEEK_SET );	//seeks to entry
-	fread(&current_directory, sizeof(current_directory), 1, directory_list);
+	cs1550_ll_fsync(req, ino, datasync, fi);
+	time_op(OP_FSYNC, started);
+}
 
-	fclose(directory_list);
-	
-	return current_directory;
+static void timed_ll_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset, struct fuse_file_info *fi)
+{
+	uint64_t started = stats_clock();
+
+	cs1550_ll_readdir(req, ino, size, offset, fi);
+	time_op(OP_READDIR, started);
 }
 
-int locate_directory(char *directory)	//locates and returns index of struct in .directories, -1 means not located
+static void timed_ll_create(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode, struct fuse_file_info *fi)
 {
-	FILE *directory_list;	//file
-	cs1550_directory_entry current_directory;	//directory to be read
-	int index_of_directory = -1;
-	int count = 0;	//count of indexes
+	uint64_t started = stats_clock();
 
-	directory_list = fopen(".directories", "rb");	//open .directories
-	
-	if(directory_list != NULL)
-	{
-		while( fread(&current_directory, sizeof(current_directory), 1, directory_list) == 1 )	//reads a directory_entry struct
-		{
-			if( strcmp(current_directory.dname+1, directory) == 0 )	//checks if current_directory is the directory we are looking for
-			{
-				index_of_directory = count;
-				fclose(directory_list);	//close
-				break;
-			}
-			count++;
-		}
-	}	
-	return index_of_directory;
+	cs1550_ll_create(req, parent, name, mode, fi);
+	time_op(OP_CREATE, started);
 }
 
-int locate_file(char *directory, char *filename, char *extension)	//locates and returns index of file in directory, -1 means not located
+//register our new functions as the implementations of the syscalls
+static struct fuse_operations hello_oper = {
+    .getattr	= timed_getattr,
+    .readdir	= timed_readdir,
+    .mkdir	= timed_mkdir,
+	.rmdir = timed_rmdir,
+    .read	= timed_read,
+    .write	= timed_write,
+	.mknod	= timed_mknod,
+	.unlink = timed_unlink,
+	.truncate = timed_truncate,
+	.ftruncate	= timed_ftruncate,
+	.flush = timed_flush,
+	.fsync	= timed_fsync,
+	.open	= timed_open,
+	.release	= timed_release,
+	.init	= cs1550_init,
+	.destroy	= cs1550_destroy,
+};
+
+//and the ones -o lowlevel registers instead
+static struct fuse_lowlevel_ops cs1550_ll_oper = {
+	.init	= cs1550_ll_init,
+	.destroy	= cs1550_ll_destroy,
+	.lookup	= timed_ll_lookup,
+	.forget	= cs1550_ll_forget,
+	.getattr	= timed_ll_getattr,
+	.setattr	= timed_ll_setattr,
+	.mknod	= timed_ll_mknod,
+	.mkdir	= timed_ll_mkdir,
+	.unlink	= timed_ll_unlink,
+	.rmdir	= timed_ll_rmdir,
+	.open	= timed_ll_open,
+	.read	= timed_ll_read,
+	.write	= timed_ll_write,
+	.flush	= timed_ll_flush,
+	.release	= timed_ll_release,
+	.fsync	= timed_ll_fsync,
+	.readdir	= timed_ll_readdir,
+	.create	= timed_ll_create,
+};
+
+static int lowlevel_main(struct fuse_args *args)	//mounts and serves cs1550_ll_oper until unmount, what fuse_main() does for hello_oper
 {
-	int index_of_file = -1;
-	int count;	//count of file indexes
-	int index_of_directory = locate_directory( directory );	//locates the directory that holds supposive file
+	struct fuse_chan *channel;
+	struct fuse_session *session;
+	char *mountpoint = NULL;
+	int multithreaded;
+	int foreground;
+	int res = 1;
 
-	if(index_of_directory > -1)	//means the directory is actually there
+	if( fuse_parse_cmdline(args, &mountpoint, &multithreaded, &foreground) == -1 )
 	{
-		cs1550_directory_entry current_directory = get_directory_entry( index_of_directory );	//get directory
-	
-		for(count = 0; count < current_directory.nFiles; count++)
+		return 1;
+	}
+
+	channel = fuse_mount(mountpoint, args);
+	if( channel != NULL )
+	{
+		session = fuse_lowlevel_new(args, &cs1550_ll_oper, sizeof(cs1550_ll_oper), NULL);
+		if( session != NULL )
 		{
-			//checks if filename and extension match
-			if( strcmp(filename, current_directory.files[ count ].fname) == 0 && strcmp(extension, current_directory.files[ count ].fext) == 0 )
+			if( fuse_set_signal_handlers(session) != -1 )
 			{
-				index_of_file = count;
-				break;
+				fuse_session_add_chan(session, channel);
+				fuse_daemonize(foreground);
+				res = (multithreaded ? fuse_session_loop_mt(session) : fuse_session_loop(session)) == -1;
+				fuse_remove_signal_handlers(session);
+				fuse_session_remove_chan(channel);
 			}
+			fuse_session_destroy(session);
 		}
+		fuse_unmount(mountpoint, channel);
 	}
-	return index_of_file;
+
+	free(mountpoint);
+	return res;
 }
 
-static meta_entry find_correct_directory(const char *path)	//finds and returns the correct directory that the calling funciton wanted by reading through .directories
+static int mkfs(const char *size_text, int quiet)	//formats .disk in the current directory as size_text bytes (K, M, G or T may follow) with a superblock, and empties the directory table and journal, says how many blocks it made unless quiet, returns 0 or 1
 {
-	char directory[MAX_FILENAME + 1];	//name of directory we are looking for
-	char filename[MAX_FILENAME + 1];	//name of file we are looking for
-	char extension[MAX_EXTENSION + 1];	//file extension we are looking for
-	int counter = 0;
+	cs1550_superblock superblock;
+	char *end;
+	uint64_t size = strtoull(size_text, &end, 10);	//of .disk in bytes
+	uint64_t blocks;	//how many blocks fit next to their bitmap
+	uint64_t words;	//how many 64 bit words the bitmap has
+	uint64_t *bits;
+	uint64_t block;
+	int fd;
+	int res = 0;
 
-	meta_entry search_return;	//the meta_entry struct that holds the directory to be returned
-	search_return.file_index = -1;	//set so that parameter path is also not a file index
-	search_return.index_of_directory = -1;	//starts at -1, and if its an actually directory it will be set to a real index
-	search_return.slash_count = 0;
+	switch( *end )
+	{
+		case 'T': case 't': size <<= 10;	//fall through
+		case 'G': case 'g': size <<= 10;	//fall through
+		case 'M': case 'm': size <<= 10;	//fall through
+		case 'K': case 'k': size <<= 10; end++;
+	}
+	if( end == size_text || *end != '\0' )
+	{
+		fprintf(stderr, "mkfs: %s is not a size, try 5M or 2G\n", size_text);
+		return 1;
+	}
+
+	blocks = size / BLOCK_SIZE;
+	while( blocks > 0 && blocks * BLOCK_SIZE + (blocks + 63) / 64 * sizeof(uint64_t) > size )	//the bitmap goes after the last block
+	{
+		blocks--;
+	}
+	if( blocks < 16 )
+	{
+		fprintf(stderr, "mkfs: %s is too small for %d byte blocks\n", size_text, BLOCK_SIZE);
+		return 1;
+	}
+	words = (blocks + 63) / 64;
 
-	sscanf(path, "/%[^/]/%[^.].%s", directory, filename, extension);	//tokenizes and stores the strings for the directory we are looking for
+	memset(&superblock, 0, sizeof(superblock));
+	superblock.magic = SUPERBLOCK_MAGIC;
+	superblock.version = SUPERBLOCK_VERSION;
+	superblock.block_size = BLOCK_SIZE;
+	superblock.block_count = blocks;
+	superblock.bitmap_offset = blocks * BLOCK_SIZE;
+	superblock.bitmap_words = words;
+	superblock.directory_record_size = sizeof(cs1550_directory_entry);
+	strcpy(superblock.directory_file, ".directories");
+	superblock.checksum = journal_checksum((char *) &superblock, offsetof(cs1550_superblock, checksum));
 
-	while( counter < strlen(path) ) //to check the directory is not under root
+	bits = calloc(words, sizeof(uint64_t));
+	if( bits == NULL )
+	{
+		perror("mkfs");
+		return 1;
+	}
+	bits[ 0 ] = 1;	//block 0 is the superblock
+	for(block = blocks; block < words * 64; block++)	//bits past the last block are never free
 	{
-               if(path[counter] == '/')
-               {
-                       search_return.slash_count++;
-               }
-               counter++;
-       	}
+		bits[ block / 64 ] |= (uint64_t) 1 << (block % 64);
+	}
 
-	if( search_return.slash_count > 1)	//path is not under root
+	fd = open(".disk", O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if( fd == -1 || ftruncate(fd, size) != 0 || write_at(fd, &superblock, sizeof(superblock), 0) != 0 ||
+		write_at(fd, bits, words * sizeof(uint64_t), superblock.bitmap_offset) != 0 || fsync(fd) != 0 )	//the blocks themselves are left as holes
+	{
+		perror("mkfs .disk");
+		res = 1;
+	}
+	if( fd != -1 )
 	{
-		search_return.file_index = locate_file(directory, filename, extension);	//finds file
+		close(fd);
 	}
+	free(bits);
 
-	search_return.index_of_directory = locate_directory(directory);	//finds directory
+	fd = open(superblock.directory_file, O_RDWR | O_CREAT | O_TRUNC, 0644);	//no directories yet
+	if( fd == -1 )
+	{
+		perror("mkfs .directories");
+		res = 1;
+	}
+	else
+	{
+		close(fd);
+	}
+	if( unlink(".journal") != 0 && errno != ENOENT )	//nothing in it is about this .disk
+	{
+		perror("mkfs .journal");
+		res = 1;
+	}
 
-	return search_return;
+	if( res == 0 && !quiet )
+	{
+		printf("mkfs: %llu blocks of %d bytes, %llu free\n", (unsigned long long) blocks, BLOCK_SIZE, (unsigned long long) blocks - 1);
+	}
+	return res;
 }
 
-void write_directory_entry(cs1550_directory_entry current_directory, int index)
+//Size of the scratch .disk bench formats
+#define BENCH_DISK_SIZE "256M"
+
+//How many operations each benchmark times unless told otherwise
+#define BENCH_DEFAULT_OPS 2000
+
+//Most bytes of a file the read and write benchmarks use
+#define BENCH_MAX_SPAN (8 * 1024 * 1024)
+
+//How many bytes the files of the read_tiny benchmark hold, few enough to be kept in their inode
+#define BENCH_TINY_BYTES 64
+
+struct bench_run	//the latencies of one benchmark as it goes
 {
-	FILE *directory_list;	//file
-	directory_list = fopen(".directories", "r+b");
+	uint64_t *ns;	//how long each operation took
+	long ops;	//how many were timed
+	long errors;	//how many of them failed
+	uint64_t started;	//when the one being timed started
+};
 
-	fseek(directory_list, index * sizeof(current_directory), SEEK_SET );	//seeks to entry
-	fwrite(&current_directory, sizeof(current_directory), 1, directory_list);	//rewrite the struct				
+typedef struct bench_run bench_run;
 
-	fclose(directory_list);
-	
-	return;
+static uint64_t bench_random(uint64_t *state)	//xorshift64, the same sequence every run so runs can be compared
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return *state;
 }
 
-/*
- * Called whenever the system wants to know the file attributes, including
- * simply whether the file exists or not. 
- *
- * man -s 2 stat will show the fields of a stat structure
- */
-static int cs1550_getattr(const char *path, struct stat *stbuf)
+static void bench_start(bench_run *run)	//starts timing one operation
 {
-	int res = -ENOENT;	//sets res to error first, if the directory or file is found then res is set to 0 because there is no error
+	run->started = stats_clock();
+}
 
-	memset(stbuf, 0, sizeof(struct stat));
-	//is path the root dir?
-	if (strcmp(path, "/") == 0) {
-		stbuf->st_mode = S_IFDIR | 0755;
-		stbuf->st_nlink = 2;
-		res = 0;
-	} 
+static void bench_stop(bench_run *run, int failed)	//stops timing the operation bench_start() started
+{
+	run->ns[ run->ops++ ] = stats_clock() - run->started;
+	run->errors += failed != 0;
+}
 
-	else	//is directly under root directory
+static int compare_ns(const void *a, const void *b)	//qsort order of two latencies
+{
+	uint64_t x = *(const uint64_t *) a;
+	uint64_t y = *(const uint64_t *) b;
+
+	return (x > y) - (x < y);
+}
+
+static void bench_report(const char *name, long bytes, bench_run *run)	//prints run as one line of JSON and starts it over, ops_per_sec counts only the time spent in the handlers
+{
+	uint64_t total = 0;
+	long count;
+
+	if( run->ops == 0 )
+	{
+		return;
+	}
+	for(count = 0; count < run->ops; count++)
 	{
-		meta_entry attribute = find_correct_directory(path);
+		total += run->ns[ count ];
+	}
+	qsort(run->ns, run->ops, sizeof(uint64_t), compare_ns);
 
-		if(attribute.index_of_directory > -1 && attribute.slash_count == 1)	//means that paramter path is a directory
+	printf("{\"bench\":\"%s\",\"bytes\":%ld,\"ops\":%ld,\"errors\":%ld,\"ops_per_sec\":%.1f,\"p50_ns\":%llu,\"p99_ns\":%llu,\"p999_ns\":%llu}\n",
+		name, bytes, run->ops, run->errors, run->ops * 1e9 / (total > 0 ? total : 1),
+		(unsigned long long) run->ns[ run->ops / 2 ], (unsigned long long) run->ns[ run->ops * 99 / 100 ], (unsigned long long) run->ns[ run->ops * 999 / 1000 ]);
+	fflush(stdout);
+
+	run->ops = 0;
+	run->errors = 0;
+}
+
+static void bench_skip(const char *name, long bytes, off_t span)	//prints a line of JSON for a benchmark of size bytes that could not run since the file it uses can only be span bytes
+{
+	printf("{\"bench\":\"%s\",\"bytes\":%ld,\"skipped\":\"a file holds at most %lld bytes\"}\n", name, bytes, (long long) span);
+	fflush(stdout);
+}
+
+static int bench_fill(void *buf, const char *name, const struct stat *stbuf, off_t off)	//the filler of the readdir benchmark, takes every name
+{
+	(void) buf;
+	(void) name;
+	(void) stbuf;
+	(void) off;
+
+	return 0;
+}
+
+static void bench_io(bench_run *run, long ops, long size, off_t span, char *buf)	//times sequential and random reads and writes of size bytes in the first span bytes of /d000000/io.dat
+{
+	const char *path = "/d000000/io.dat";
+	struct fuse_file_info fi;
+	uint64_t seed = 1550;
+	off_t offset;
+	long count;
+	int res;
+
+	memset(&fi, 0, sizeof(fi));
+	hello_oper.open(path, &fi);
+
+	//append until span, then start over from an empty file, flushing the appends held in memory counts with the write that filled it
+	hello_oper.truncate(path, 0);
+	for(offset = 0, count = 0; count < ops; count++)
+	{
+		if( offset + size > span )
 		{
-			//Might want to return a structure with these fields
-			stbuf->st_mode = S_IFDIR | 0755;
-			stbuf->st_nlink = 2;
-			res = 0;	
+			hello_oper.truncate(path, 0);
+			offset = 0;
+		}
+		bench_start(run);
+		res = hello_oper.write(path, buf, size, offset, &fi);
+		if( offset + 2 * size > span )
+		{
+			res = res == size ? hello_oper.flush(path, &fi) : res;
 		}
+		bench_stop(run, res < 0);
+		offset += size;
+	}
+	bench_report("append", size, run);
 
-		else if(attribute.index_of_directory > -1 && attribute.file_index > -1)//means that parameter path is a file
+	hello_oper.truncate(path, 0);
+	for(offset = 0; offset + size <= span; offset += size)	//the file the rest run on, not timed
+	{
+		hello_oper.write(path, buf, size, offset, &fi);
+	}
+	hello_oper.flush(path, &fi);
+
+	for(offset = 0, count = 0; count < ops; count++)
+	{
+		offset = offset + size > span ? 0 : offset;
+		bench_start(run);
+		res = hello_oper.write(path, buf, size, offset, &fi);
+		bench_stop(run, res != size);
+		offset += size;
+	}
+	bench_report("write_seq", size, run);
+
+	for(count = 0; count < ops; count++)
+	{
+		offset = bench_random(&seed) % (span / size) * size;
+		bench_start(run);
+		res = hello_oper.write(path, buf, size, offset, &fi);
+		bench_stop(run, res != size);
+	}
+	bench_report("write_rand", size, run);
+	hello_oper.flush(path, &fi);
+
+	for(offset = 0, count = 0; count < ops; count++)
+	{
+		offset = offset + size > span ? 0 : offset;
+		bench_start(run);
+		res = hello_oper.read(path, buf, size, offset, &fi);
+		bench_stop(run, res != size);
+		offset += size;
+	}
+	bench_report("read_seq", size, run);
+
+	for(count = 0; count < ops; count++)
+	{
+		offset = bench_random(&seed) % (span / size) * size;
+		bench_start(run);
+		res = hello_oper.read(path, buf, size, offset, &fi);
+		bench_stop(run, res != size);
+	}
+	bench_report("read_rand", size, run);
+
+	hello_oper.release(path, &fi);
+}
+
+static void bench_mixed(bench_run *run, long ops, long files, off_t span, char *buf)	//times a mix of random reads (50%), random writes (20%) and getattrs (20%) of 4 KB, and small files made, written and unlinked (10%)
+{
+	const char *path = "/d000000/io.dat";
+	struct fuse_file_info fi;
+	struct stat stbuf;
+	char name[64];
+	uint64_t seed = 1550;
+	uint64_t pick;
+	long size = span < 4096 ? span : 4096;
+	long count;
+	int res;
+
+	memset(&fi, 0, sizeof(fi));
+	hello_oper.open(path, &fi);
+
+	for(count = 0; count < ops; count++)
+	{
+		pick = bench_random(&seed);
+		bench_start(run);
+		switch( pick % 10 )
 		{
-			//regular file, probably want to be read and write
-			cs1550_directory_entry directory_entry = get_directory_entry( attribute.index_of_directory );
-			stbuf->st_mode = S_IFREG | 0666; 
-			stbuf->st_nlink = 1; //file link
-			stbuf->st_size = directory_entry.files[ attribute.file_index ].fsize; //file size - make sure you replace with real size!
-			res = 0; // no error
+			case 0: case 1: case 2: case 3: case 4:
+				res = hello_oper.read(path, buf, size, pick / 10 % (span / size) * size, &fi) != size;
+				break;
+			case 5: case 6:
+				res = hello_oper.write(path, buf, size, pick / 10 % (span / size) * size, &fi) != size;
+				break;
+			case 7: case 8:
+				snprintf(name, sizeof(name), "/d000000/f%06ld.dat", (long) (pick / 10 % files));
+				res = hello_oper.getattr(name, &stbuf);
+				break;
+			default:
+				snprintf(name, sizeof(name), "/d000000/t%06ld.tmp", count);
+				res = hello_oper.mknod(name, S_IFREG | 0644, 0);
+				res = res == 0 ? hello_oper.write(name, buf, 100, 0, NULL) != 100 : res;
+				res = res == 0 ? hello_oper.unlink(name) : res;
 		}
+		bench_stop(run, res);
 	}
+	hello_oper.release(path, &fi);
+	bench_report("mixed", size, run);
+}
 
-	return res;
+static int bench_abort(const char *what, long failed, long ops)	//says how many of the ops calls of what failed and unmounts, the benchmarks after it would only time errors, returns 1
+{
+	fprintf(stderr, "bench: %ld of %ld %s calls failed\n", failed, ops, what);
+	hello_oper.destroy(NULL);
+	return 1;
 }
 
-/* 
- * Called whenever the contents of a directory are desired. Could be from an 'ls'
- * or could even be when a user hits TAB to do autocompletion
- */
-static int cs1550_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
-			 off_t offset, struct fuse_file_info *fi)
+static int bench_all(long ops, bench_run *run, char *buf)	//mounts the .disk in the current directory without fuse, runs every benchmark on it and unmounts, returns 0 or 1
 {
-	//Since we're building with -Wall (all warnings reported) we need
-	//to "use" every parameter, so let's just cast them to void to
-	//satisfy the compiler
-	(void) offset;
-	(void) fi;
-	int res = -ENOENT;
-	
-	//the filler function allows us to add entries to the listing
-	//read the fuse.h file for a description (in the ../include dir)
-	filler(buf, ".", NULL, 0);
-	filler(buf, "..", NULL, 0);
+	static const long sizes[] = { 512, 4096, 65536, 262144 };	//what the reads and writes are timed at, the ones bigger than the file can be are reported as skipped
+	char path[64];
+	struct fuse_conn_info conn;
+	struct fuse_file_info fi;
+	struct stat stbuf;
+	off_t span = (off_t) MAX_FILE_BLOCKS * BLOCK_SIZE < BENCH_MAX_SPAN ? (off_t) MAX_FILE_BLOCKS * BLOCK_SIZE : BENCH_MAX_SPAN;	//how much of io.dat is used
+	long failed;
+	long count;
+	unsigned int size;
 
-	if ( strcmp(path, "/") == 0 )	//means that the path is root, so filler() all subdirectories
+	memset(&conn, 0, sizeof(conn));
+	hello_oper.init(&conn);
+	if( disk_fd == -1 || directory_fd == -1 )
+	{
+		return 1;
+	}
+
+	printf("{\"bench\":\"config\",\"block_size\":%d,\"disk\":\"%s\",\"ops\":%ld,\"mmap\":%d,\"cache_blocks\":%u,\"readahead_blocks\":%u,\"delalloc_bytes\":%u,\"compress\":%d,\"dedup\":%d,\"inline_bytes\":%u,\"io_depth\":%u}\n",
+		BLOCK_SIZE, BENCH_DISK_SIZE, ops, config.use_mmap, config.cache_blocks, config.readahead_blocks, config.delalloc_bytes, config.compress, config.dedup, config.inline_bytes, io_depth);
+
+	for(count = 0; count < ops; count++)
+	{
+		snprintf(path, sizeof(path), "/d%06ld", count);
+		bench_start(run);
+		bench_stop(run, hello_oper.mkdir(path, 0755));
+	}
+	failed = run->errors;
+	bench_report("mkdir", 0, run);
+	if( failed != 0 )
+	{
+		return bench_abort("mkdir", failed, ops);
+	}
+
+	for(count = 0; count < ops; count++)
+	{
+		snprintf(path, sizeof(path), "/d000000/f%06ld.dat", count);
+		bench_start(run);
+		bench_stop(run, hello_oper.mknod(path, S_IFREG | 0644, 0));
+	}
+	failed = run->errors;
+	bench_report("mknod", 0, run);
+	if( failed != 0 )	//getattr_hit, read_tiny and unlink use every file
+	{
+		return bench_abort("mknod", failed, ops);
+	}
+
+	for(count = 0; count < ops; count++)
+	{
+		snprintf(path, sizeof(path), "/d000000/f%06ld.dat", count * 7919 % ops);	//not in the order they were made
+		bench_start(run);
+		bench_stop(run, hello_oper.getattr(path, &stbuf));
+	}
+	bench_report("getattr_hit", 0, run);
+
+	for(count = 0; count < ops; count++)
+	{
+		snprintf(path, sizeof(path), "/d000000/m%06ld.dat", count);
+		bench_start(run);
+		bench_stop(run, hello_oper.getattr(path, &stbuf) != -ENOENT);
+	}
+	bench_report("getattr_miss", 0, run);
+
+	memset(&fi, 0, sizeof(fi));
+	for(count = 0; count < ops / 10 + 1; count++)	//each one lists every file made above
+	{
+		bench_start(run);
+		bench_stop(run, hello_oper.readdir("/d000000", NULL, bench_fill, 0, &fi));
+	}
+	bench_report("readdir", 0, run);
+
+	for(count = 0; count < ops; count++)	//each file made above gets a few bytes and is read back through an open handle, readahead sees every read
 	{
-		FILE *directory_list;
-		cs1550_directory_entry current_directory;	//current directory to be printed out
-		
-		directory_list = fopen(".directories", "rb");	//open .directories
-		
-		if(directory_list != NULL)
+		snprintf(path, sizeof(path), "/d000000/f%06ld.dat", count);
+		memset(&fi, 0, sizeof(fi));
+		if( hello_oper.open(path, &fi) != 0 )
 		{
-			while( fread(&current_directory, sizeof(current_directory), 1, directory_list) == 1 )
-			{
-				filler(buf, current_directory.dname + 1, NULL, 0);
-			}
-			fclose(directory_list);
+			run->errors++;
+			continue;
 		}
-		res = 0;
+		if( hello_oper.write(path, buf, BENCH_TINY_BYTES, 0, &fi) != BENCH_TINY_BYTES )
+		{
+			run->errors++;
+		}
+		else
+		{
+			bench_start(run);
+			bench_stop(run, hello_oper.read(path, buf, BENCH_TINY_BYTES, 0, &fi) != BENCH_TINY_BYTES);
+		}
+		hello_oper.release(path, &fi);
 	}
+	bench_report("read_tiny", BENCH_TINY_BYTES, run);
 
-	else
+	if( hello_oper.mknod("/d000000/io.dat", S_IFREG | 0644, 0) != 0 )	//what the io and mixed benchmarks read and write
 	{
-		//add the user stuff (subdirs or files)
-		//the +1 skips the leading '/' on the filenames
-		meta_entry attribute = find_correct_directory(path);
-			
-		if(attribute.index_of_directory > -1)	//means that parameter path is a directory(aka subdirectory of root)
+		return bench_abort("mknod", 1, 1);
+	}
+	for(size = 0; size < sizeof(sizes) / sizeof(sizes[0]); size++)
+	{
+		if( sizes[ size ] <= span )
 		{
-			cs1550_directory_entry directory_entry = get_directory_entry( attribute.index_of_directory );
-			
-			int count;
-			for(count = 0; count < directory_entry.nFiles; count++)	//go through filler() the files
-			{
-				char fullname[12] = "";
-				sprintf(fullname, "%s.%s", directory_entry.files[count].fname, directory_entry.files[count].fext);
-				filler(buf, fullname, NULL, 0);
-			}
-			res = 0;
+			bench_io(run, ops, sizes[ size ], span, buf);
+		}
+		else
+		{
+			bench_skip("io", sizes[ size ], span);
 		}
 	}
-	return res;
+	bench_mixed(run, ops, ops, span, buf);
+
+	for(count = 0; count < ops; count++)
+	{
+		snprintf(path, sizeof(path), "/d000000/f%06ld.dat", count);
+		bench_start(run);
+		bench_stop(run, hello_oper.unlink(path));
+	}
+	bench_report("unlink", 0, run);
+
+	hello_oper.destroy(NULL);
+	return 0;
 }
 
-/* 
- * Creates a directory. We can ignore mode since we're not dealing with
- * permissions, as long as getattr returns appropriate ones for us.
- */
-static int cs1550_mkdir(const char *path, mode_t mode)
+static int enter_scratch(char *directory, size_t size, const char *mode)	//makes a new directory named for mode under TMPDIR and goes into it, returns 0 or 1 after saying why not
 {
-	int res = 0;
-	(void) mode;
+	const char *tmp = getenv("TMPDIR");
 
-	meta_entry attribute = find_correct_directory(path);
-
-	if( attribute.slash_count > 1 )	//means not under root, do not give permission
+	snprintf(directory, size, "%s/cs1550-%s-XXXXXX", tmp != NULL ? tmp : "/tmp", mode);
+	if( mkdtemp(directory) == NULL )
 	{
-		res = -EPERM;
+		perror(mode);
+		return 1;
+	}
+	if( chdir(directory) != 0 )
+	{
+		perror(mode);
+		rmdir(directory);
+		return 1;
 	}
+	return 0;
+}
 
-	else if( strlen(path) > 9 )	//name length is too long, 9 because of beginning "/"
+static void clear_scratch(void)	//removes whatever mkfs() or the handlers got to make in the current directory
+{
+	unlink(".disk");
+	unlink(".directories");
+	unlink(".journal");
+}
+
+static void leave_scratch(const char *directory, const char *mode)	//removes the directory enter_scratch() made and what is in it
+{
+	clear_scratch();
+	if( chdir("/") != 0 || rmdir(directory) != 0 )
 	{
-		res = -ENAMETOOLONG;
+		perror(mode);
 	}
+}
 
-	else if( attribute.index_of_directory > -1 && attribute.file_index == -1)	//is a directory
+static int bench(const char *ops_text)	//formats a scratch .disk in a new directory under TMPDIR and times the handlers of hello_oper on it with no mount, one line of JSON per benchmark, the directory is removed after, returns 0 or 1
+{
+	char directory[4096];
+	bench_run run;
+	long ops = ops_text != NULL ? atol(ops_text) : BENCH_DEFAULT_OPS;
+	char *buf;
+	int res = 1;
+
+	if( ops <= 0 || ops > 1000000 )	//the names have room for six digits
 	{
-		res = -EEXIST;
+		fprintf(stderr, "bench: %s is not a number of operations\n", ops_text);
+		return 1;
 	}
 
-	else	//append
+	run.ns = malloc(ops * sizeof(uint64_t));
+	run.ops = 0;
+	run.errors = 0;
+	buf = malloc(262144);	//the biggest of the sizes bench_all() times
+	if( run.ns == NULL || buf == NULL )
 	{
-		FILE *directory_list;
-		cs1550_directory_entry current_directory;	//current directory to be appended
-		directory_list = fopen(".directories", "ab");	//open(or create if it does not exist) to append .directories
-		
-		sprintf(current_directory.dname, "%s", path);
-		current_directory.nFiles = 0;
-		fwrite(&current_directory, sizeof(current_directory), 1, directory_list);	//append directory				
-		fclose(directory_list);
+		perror("bench");
+	}
+	else if( enter_scratch(directory, sizeof(directory), "bench") == 0 )
+	{
+		memset(buf, 'x', 262144);
+		if( mkfs(BENCH_DISK_SIZE, 1) == 0 )
+		{
+			res = bench_all(ops, &run, buf);
+		}
+		leave_scratch(directory, "bench");
 	}
+
+	free(run.ns);
+	free(buf);
 	return res;
 }
 
-/* 
- * Removes a directory.
- */
-static int cs1550_rmdir(const char *path)
+//Size of the scratch .disk each check of test formats
+#define TEST_DISK_SIZE "16M"
+
+//How many bytes the files the checks write hold, past the direct pointers and over several chunks
+#define TEST_FILE_BYTES (256 * 1024)
+
+//How many requests the io check puts in one batch, more than the io_uring it makes holds
+#define TEST_IO_REQUESTS 48
+
+struct test_check	//one check of test
+{
+	const char *name;
+	int (*run)(void);	//returns 0 if it passed or 1 after saying why not
+};
+
+typedef struct test_check test_check;
+
+static int test_fail(const char *what, const char *path)	//says what went wrong, with path if it is not NULL, returns 1
 {
-	(void) path;
-	return 0;
+	fprintf(stderr, "test: %s%s%s\n", what, path != NULL ? " " : "", path != NULL ? path : "");
+	return 1;
 }
 
-long get_first_free_block(void)
+static void test_fill(char *data, size_t size, long seed)	//what the checks write, it repeats every 251 bytes so it compresses, and blocks at the same offset of files filled with the same seed are the same
 {
-	FILE *disk;
-	bitmap bitmap;	//bitmap to read, edit and write
-	long count = 0;	//will count until it finds a free block
-	
-	disk = fopen(".disk", "r+b");
-	
-	fseek(disk, -1 * sizeof(bitmap), SEEK_END);	//seeks to end and -1 size of bitmap to read in
-	fread(&bitmap, sizeof(bitmap), 1, disk);	//read in bitmap
-	
-	for(; count < MAX_BLOCKS; count++)
+	size_t count;
+
+	for(count = 0; count < size; count++)
 	{
-		if( bitmap.tracker[ count ] == '\0' )	//free
-		{
-			bitmap.tracker[ count ] = '1';	//now in use
-			break;
-		}		
+		data[ count ] = 'a' + (count + seed) % 251 % 26;
 	}
+}
 
-	int check;
-	fseek(disk, -1 * sizeof(bitmap), SEEK_END);	//seeks to end and -1 size of bitmap to read in
-	check = fwrite(&bitmap, sizeof(bitmap), 1, disk);	//read into bitmap
-	fclose(disk);
+static int test_mount(void)	//mounts the .disk in the current directory without fuse as bench_all() does, returns 0 or 1 after saying why not
+{
+	struct fuse_conn_info conn;
 
-	return count * 512;	//returns the addres of the block
+	memset(&conn, 0, sizeof(conn));
+	hello_oper.init(&conn);
+	return disk_fd == -1 || directory_fd == -1 ? test_fail("could not mount .disk", NULL) : 0;
 }
-/* 
- * Does the actual creation of a file. Mode and dev can be ignored.
- *
- */
-static int cs1550_mknod(const char *path, mode_t mode, dev_t dev)
+
+static int test_write(const char *path, const char *data, size_t size, off_t offset)	//writes size bytes of data at offset of the file at path through an open handle, making the file if it is not there, returns 0 or 1 after saying why not
 {
-	(void) mode;
-	(void) dev;
-	char directory[MAX_FILENAME + 1];	//name of directory we are looking for
-	char filename[MAX_FILENAME + 1];	//name of file we are looking for
-	char extension[MAX_EXTENSION + 1];	//file extension we are looking for
-	
+	struct fuse_file_info fi;
+	struct stat stbuf;
 	int res = 0;
-	meta_entry attribute = find_correct_directory(path);  
-
-	sscanf(path, "/%[^/]/%[^.].%s", directory, filename, extension);	//tokenizes and stores the strings for the directory we are looking for	
 
-	if( attribute.slash_count == 1 )	//under root, do not give permission
+	memset(&fi, 0, sizeof(fi));
+	if( hello_oper.getattr(path, &stbuf) == -ENOENT && hello_oper.mknod(path, S_IFREG | 0644, 0) != 0 )
 	{
-		res = -EPERM;
+		return test_fail("could not make", path);
 	}
-
-	else if( strlen(filename) > 8 || strlen(extension) > 3 )	//name length is too long
+	if( hello_oper.open(path, &fi) != 0 )
 	{
-		res = -ENAMETOOLONG;
+		return test_fail("could not open", path);
 	}
-
-	else if( attribute.file_index > -1)	//is already a file
+	if( hello_oper.write(path, data, size, offset, &fi) != (int) size )
 	{
-		res = -EEXIST;
+		res = test_fail("could not write", path);
 	}
-
-	else	//create file
+	if( hello_oper.release(path, &fi) != 0 && res == 0 )	//where appends held in memory get their blocks
 	{
-		cs1550_directory_entry directory_entry = get_directory_entry( attribute.index_of_directory );
-				
-		strcpy(directory_entry.files[ directory_entry.nFiles ].fname, filename); //put filename in array index
-		strcpy(directory_entry.files[ directory_entry.nFiles ].fext, extension);	//put extension in array index
-//		directory_entry.files[ directory_entry.nFiles ].fsize = 512;	//size of block
-
-		directory_entry.files[ directory_entry.nFiles ].fsize = 0;	//size of block
-		directory_entry.files[ directory_entry.nFiles ].nStartBlock = get_first_free_block();	//gets the first free block
-		directory_entry.nFiles = directory_entry.nFiles++;	//increment the amount of files  
-
-		write_directory_entry( directory_entry, attribute.index_of_directory );	//write the directory entry			
-		
+		res = test_fail("could not release", path);
 	}
-
 	return res;
 }
 
-/*
- * Deletes a file
- */
-static int cs1550_unlink(const char *path)
+static int test_matches(const char *path, const char *data, size_t size)	//checks the file at path is size bytes long and holds data, returns 0 or 1 after saying why not
 {
+	struct fuse_file_info fi;
+	struct stat stbuf;
+	char *held = malloc(size + 1);	//one more so a file that is too long shows
 	int res = 0;
-	meta_entry attribute = find_correct_directory(path);  
 
-	if( attribute.slash_count == 1 )	//the path is a directory, overwrite res
+	memset(&fi, 0, sizeof(fi));
+	if( held == NULL )
 	{
-		res = -EISDIR;
+		res = test_fail("no memory to read", path);
 	}
-
- 	else if( attribute.index_of_directory > 1 && attribute.file_index == -1 )	//file not found(or wrong path but goes under same error)
+	else if( hello_oper.getattr(path, &stbuf) != 0 || stbuf.st_size != (off_t) size )
 	{
-		res = -ENOENT;
-	}   	
-	
-	else	//remove file
+		res = test_fail("wrong size of", path);
+	}
+	else if( hello_oper.open(path, &fi) != 0 )
 	{
-		int index = attribute.file_index;
-		cs1550_directory_entry directory_entry = get_directory_entry( attribute.index_of_directory );
-
-		//collasce the array
-		for( ; index < directory_entry.nFiles-1; index++)
+		res = test_fail("could not open", path);
+	}
+	else
+	{
+		if( hello_oper.read(path, held, size + 1, 0, &fi) != (int) size || memcmp(held, data, size) != 0 )
 		{
-			strcpy( directory_entry.files[ index ].fname, directory_entry.files[ index + 1 ].fname );
-			strcpy( directory_entry.files[ index ].fext, directory_entry.files[ index + 1 ].fext );
-			directory_entry.files[ index ].fsize = directory_entry.files[ index + 1 ].fsize;
-			directory_entry.files[ index ].nStartBlock = directory_entry.files[ index + 1 ].nStartBlock;
+			res = test_fail("wrong data in", path);
 		}
-		
-		directory_entry.nFiles = directory_entry.nFiles--;	//remove the file from count
-
-		write_directory_entry( directory_entry, attribute.index_of_directory );	//write the directory entry			
-
+		hello_oper.release(path, &fi);
 	}
+	free(held);
 	return res;
 }
 
-/* 
- * Read size bytes from file into buf starting from offset
- *
- */
-static int cs1550_read(const char *path, char *buf, size_t size, off_t offset,
-			  struct fuse_file_info *fi)
+static int test_codec(void)	//lz_expand() gives back what lz_compress() was given, for data that repeats, that does not and of every length up to a block, and refuses what is cut short or does not fit
 {
-	(void) fi;
-	meta_entry attribute = find_correct_directory(path);
+	size_t capacity = CHUNK_SIZE + CHUNK_SIZE / 255 + 16;	//room for a chunk that does not compress at all
+	unsigned char *plain = malloc(CHUNK_SIZE);
+	unsigned char *packed = malloc(capacity);
+	unsigned char *back = malloc(CHUNK_SIZE);
+	uint64_t state = 1550;
+	size_t packed_size;
+	size_t size;
+	size_t count;
+	int kind;	//0 zeros, 1 what test_fill() writes, 2 random bytes
+	int res = plain == NULL || packed == NULL || back == NULL ? test_fail("no memory for the codec", NULL) : 0;
 
-	//check to make sure path exists
-	if(attribute.index_of_directory > -1 && attribute.slash_count == 1)	//means that paramter path is a directory
-	{
-		size = -EISDIR;
-	}
-	
-	else
+	for(kind = 0; res == 0 && kind < 3; kind++)
 	{
-		int index = attribute.file_index;
-		cs1550_directory_entry directory_entry = get_directory_entry( attribute.index_of_directory );
-		
-		if( size > 0 && offset <= directory_entry.files[index].fsize )	//check that size is > 0 and offset is <= to the file size
-		{
-			//read in data
-			FILE *disk;
-			disk = fopen(".disk", "rb");
-
-			fseek(disk, directory_entry.files[ index ].nStartBlock + offset, SEEK_SET);	//seek from start to where the first block is plus offset
-			fread(buf, sizeof(char), sizeof(buf), disk);	//read in the amount of bytes needed			
- 			size = strlen(buf);	//set size and return, or error
-
-			fclose(disk);	
-		}
-		
-		else
+		for(size = 0; res == 0 && size <= CHUNK_SIZE; size = size < BLOCK_SIZE ? size + 1 : size * 2)
 		{
-			size = -1;	//error
+			for(count = 0; count < size; count++)
+			{
+				plain[ count ] = kind == 0 ? 0 : (kind == 1 ? 'a' + count % 251 % 26 : bench_random(&state));
+			}
+			packed_size = lz_compress(plain, size, packed, capacity);
+			if( packed_size == 0 || lz_expand(packed, packed_size, back, CHUNK_SIZE) != (long) size || memcmp(plain, back, size) != 0 )
+			{
+				res = test_fail("lz_expand() did not undo lz_compress()", NULL);
+			}
+			else if( size > 0 && (lz_expand(packed, packed_size - 1, back, CHUNK_SIZE) == (long) size || lz_expand(packed, packed_size, back, size - 1) != -1) )
+			{
+				res = test_fail("lz_expand() took data cut short or wrote past its capacity", NULL);
+			}
 		}
 	}
-	return size;
-}
-
-int is_next_block_free(long start_address)	//returns 1 if the next block is free, returns 0 if it is not
-{
-	FILE *disk;
-	bitmap bitmap;	//bitmap to read, edit and write
-	int next_bitmap_index = (start_address / 512) + 1;	//gets the index of the next block
-	int freedom = 0;	//by default set to 0, so the block is not free
-
-	disk = fopen(".disk", "r+b");
-	
-	fseek(disk, -1 * sizeof(bitmap), SEEK_END);	//seeks to end and -1 size of bitmap to read in
-	fread(&bitmap, sizeof(bitmap), 1, disk);	//read in bitmap
-	
-	if( bitmap.tracker[ next_bitmap_index ] == '\0' )	//free
+	if( res == 0 && lz_compress(plain, CHUNK_SIZE, packed, CHUNK_SIZE - BLOCK_SIZE) != 0 )	//the random bytes left in plain save no block
 	{
-		freedom = 1;
+		res = test_fail("lz_compress() said random bytes fit in less than they are", NULL);
 	}
-	fclose(disk);
 
-	return freedom;	
+	free(plain);
+	free(packed);
+	free(back);
+	return res;
 }
 
-long find_next_free_block(long start_address)	//finds address of next free block because next block returned false
+static int test_compress(void)	//a file written with -o compress goes into compressed chunks and reads back the same, after an overwrite in the middle and after a remount
 {
-	FILE *disk;
-	bitmap bitmap;	//bitmap to read, edit and write
-	long index = (start_address / 512);	//gets the index of the start block
+	char *data = malloc(TEST_FILE_BYTES);
+	thread_stats *stats = malloc(sizeof(thread_stats));
+	int res;
 
-	disk = fopen(".disk", "r+b");
-	
-	fseek(disk, -1 * sizeof(bitmap), SEEK_END);	//seeks to end and -1 size of bitmap to read in
-	fread(&bitmap, sizeof(bitmap), 1, disk);	//read in bitmap
-	
-	for(; index < MAX_BLOCKS; index++)
+	if( data == NULL || stats == NULL )
 	{
-		if( bitmap.tracker[ index ] == '\0' )	//free
-		{
-			start_address = index * 512;	//found free block so set address and break 
-			break;
-		}		
+		free(data);
+		free(stats);
+		return test_fail("no memory for the file", NULL);
 	}
-	fclose(disk);
+	config.compress = 1;
+	test_fill(data, TEST_FILE_BYTES, 0);
 
-	return start_address;	//returns the addres of the block
+	res = test_mount() || hello_oper.mkdir("/c", 0755) != 0 || test_write("/c/c.dat", data, TEST_FILE_BYTES, 0);
+	if( res == 0 )
+	{
+		total_stats(stats);
+		res = stats->counters[ COUNT_CHUNKS_COMPRESSED ] == 0 ? test_fail("no chunk was compressed in", "/c/c.dat") : 0;
+	}
+	if( res == 0 )	//the chunk it lands in is expanded and compressed again
+	{
+		test_fill(data + TEST_FILE_BYTES / 3, 1000, 7);
+		res = test_write("/c/c.dat", data + TEST_FILE_BYTES / 3, 1000, TEST_FILE_BYTES / 3) || test_matches("/c/c.dat", data, TEST_FILE_BYTES);
+	}
+	if( res == 0 )
+	{
+		hello_oper.destroy(NULL);
+		res = test_mount() || test_matches("/c/c.dat", data, TEST_FILE_BYTES);
+	}
+	hello_oper.destroy(NULL);
 
+	free(data);
+	free(stats);
+	return res;
 }
 
-long get_start_address(cs1550_directory_entry directory, int file_index)	//gives the new start address(if needed) of file
+static int test_crash(const char *data)	//in a child that exits the way a crash would, with no destroy and nothing written home, makes /j, an empty /j/e.dat and a /j/j.dat holding TEST_FILE_BYTES of data that is fsynced, returns 0 or 1 after saying why not
 {
-	long count = 0;
-	long start_address = directory.files[ file_index ].nStartBlock;	//holds the start address of the file
-	long error_checker_address = start_address;	
+	struct fuse_file_info fi;
+	pid_t child;
+	int status = -1;
 
-	while( count <= directory.files[ file_index ].fsize )
+	fflush(stderr);
+	child = fork();
+	if( child == 0 )
 	{
-		int check = is_next_block_free(start_address);
-		if(check != 0)	//next block is free
+		memset(&fi, 0, sizeof(fi));
+		if( test_mount() || hello_oper.mkdir("/j", 0755) != 0 || hello_oper.mknod("/j/e.dat", S_IFREG | 0644, 0) != 0 || hello_oper.mknod("/j/j.dat", S_IFREG | 0644, 0) != 0 || hello_oper.open("/j/j.dat", &fi) != 0 )
 		{
-			count+= 512;	//add a block size for every iteration
+			_exit(test_fail("could not make", "/j/j.dat"));
 		}
-		
-		else
+		if( hello_oper.write("/j/j.dat", data, TEST_FILE_BYTES, 0, &fi) != TEST_FILE_BYTES || hello_oper.fsync("/j/j.dat", 0, &fi) != 0 )
 		{
-			start_address = find_next_free_block(start_address);	//finds next free block and sets block_start to that address
-			if(error_checker_address == start_address)	//signalfies out of mememory
-			{
-				perror("OUT OF MEMORY!!\n");	//out of memeory
-				break;
-			}
-			count = 0;	//reset count
+			_exit(test_fail("could not write", "/j/j.dat"));
 		}
+		_exit(0);
 	}
-
-	return start_address;	//returns the new start address
+	if( child == -1 || waitpid(child, &status, 0) != child )
+	{
+		perror("test");
+	}
+	return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : 1;
 }
 
-cs1550_directory_entry move_file(cs1550_directory_entry directory, int file_index)	//moves the given file
+static int test_journal(void)	//what a crash leaves only in .journal is there after the next mount replays it, and the mount after that finds it too
 {
-	FILE *disk;
-	cs1550_disk_block block;	//block that holds information from parts of disk
-	bitmap bitmap;	//bitmap to read, edit and write
-	long new_address = get_start_address( directory, file_index );
-	long count = 0;
-	disk = fopen(".disk", "r+b");
-
-	fseek(disk, -1 * sizeof(bitmap), SEEK_END);	//seeks to end and -1 size of bitmap to read in
-	fread(&bitmap, sizeof(bitmap), 1, disk);	//read in bitmap		
+	char *data = malloc(TEST_FILE_BYTES);
+	char *more = malloc(BLOCK_SIZE);
+	int res;
 
-	while( count <= directory.files[ file_index ].fsize )	//note that this fsize is the old offset
+	if( data == NULL || more == NULL )
 	{
-		fseek(disk, directory.files[ file_index ].nStartBlock + count, SEEK_SET);	//seek from start to where current block is
-		fread(&block.data, sizeof(char), sizeof(block.data), disk);	//read in a block
-	
-		bitmap.tracker[ (directory.files[ file_index ].nStartBlock + count) / 512 ] = '0';	//sets the block to free
-	
-		fseek(disk, new_address + count, SEEK_SET);	//seek from start to new block on disk
-		fwrite(&block.data, sizeof(char), sizeof(block.data), disk);	//write data to new block			
-
-		bitmap.tracker[ (new_address + count) / 512 ] = '1';	//sets the new block to used
+		free(data);
+		free(more);
+		return test_fail("no memory for the file", NULL);
+	}
+	test_fill(data, TEST_FILE_BYTES, 3);
+	test_fill(more, BLOCK_SIZE, 5);
 
-		count += 512;	//increment count
+	res = test_crash(data) || test_mount() || test_matches("/j/e.dat", "", 0) || test_matches("/j/j.dat", data, TEST_FILE_BYTES);
+	if( res == 0 )	//.journal takes new transactions after the replay
+	{
+		res = test_write("/j/m.dat", more, BLOCK_SIZE, 0);
+		hello_oper.destroy(NULL);
+		res = res || test_mount() || test_matches("/j/j.dat", data, TEST_FILE_BYTES) || test_matches("/j/m.dat", more, BLOCK_SIZE);
 	}
+	hello_oper.destroy(NULL);
 
-	fseek(disk, -1 * sizeof(bitmap), SEEK_END);	//seeks to end and -1 size of bitmap to read in
-	fwrite(&bitmap, sizeof(bitmap), 1, disk);	//writes into bitmap
-	fclose(disk);
-	
-	directory.files[ file_index ].nStartBlock = new_address;	//puts new address in entry
-	return directory;
+	free(data);
+	free(more);
+	return res;
 }
 
-/* 
- * Write size bytes from buf into file starting from offset
- *
- */
-static int cs1550_write(const char *path, const char *buf, size_t size, 
-			  off_t offset, struct fuse_file_info *fi)
+static int test_truncate(void)	//what truncate grows a file by reads as zeros, a write into that hole reads back, and what it cut off does not come back when the file grows again, before and after a remount
 {
-	(void) fi;
-	meta_entry attribute = find_correct_directory(path);
-	int index = attribute.file_index;
-	cs1550_directory_entry directory_entry = get_directory_entry( attribute.index_of_directory );	
+	char *data = calloc(1, TEST_FILE_BYTES);	//what the file should hold
+	int res;
 
-	if( index == -1)	//check to make sure path exists
+	if( data == NULL )
 	{
-		size = -1;	//error
+		return test_fail("no memory for the file", NULL);
 	}
-	
-	else if(  && offset <= directory_entry.files[index].fsize )	//check that offset is <= to the file size and file size is greater than 0
+	test_fill(data, BLOCK_SIZE + 100, 1);
+	res = test_mount() || hello_oper.mkdir("/t", 0755) != 0 || test_write("/t/t.dat", data, BLOCK_SIZE + 100, 0);
+
+	if( res == 0 )
 	{
-		//write data
-		FILE *disk;
-		cs1550_disk_block block;	//block to be written
-		disk = fopen(".disk", "r+b");
-			
-		fseek(disk, directory_entry.files[ index ].nStartBlock + offset, SEEK_SET);	//seek from start to where the first block is plus offset
-		strcpy(block.data, buf);
-		fwrite(&block.data, sizeof(char), sizeof(buf), disk);	//write data			
+		res = hello_oper.truncate("/t/t.dat", TEST_FILE_BYTES) != 0 ? test_fail("could not grow", "/t/t.dat") : test_matches("/t/t.dat", data, TEST_FILE_BYTES);
+	}
+	if( res == 0 )	//a block in the middle of the hole
+	{
+		test_fill(data + TEST_FILE_BYTES / 2 + 10, BLOCK_SIZE, 2);
+		res = test_write("/t/t.dat", data + TEST_FILE_BYTES / 2 + 10, BLOCK_SIZE, TEST_FILE_BYTES / 2 + 10) || test_matches("/t/t.dat", data, TEST_FILE_BYTES);
+	}
+	if( res == 0 )	//cut inside the first block, then grown past where the second one was
+	{
+		memset(data + 100, 0, TEST_FILE_BYTES - 100);
+		res = hello_oper.truncate("/t/t.dat", 100) != 0 || hello_oper.truncate("/t/t.dat", 3 * BLOCK_SIZE) != 0 ? test_fail("could not truncate", "/t/t.dat") : test_matches("/t/t.dat", data, 3 * BLOCK_SIZE);
+	}
+	if( res == 0 )
+	{
+		hello_oper.destroy(NULL);
+		res = test_mount() || test_matches("/t/t.dat", data, 3 * BLOCK_SIZE);
+	}
+	hello_oper.destroy(NULL);
+
+	free(data);
+	return res;
+}
 
-		size = strlen(buf);	//return the length of data
-		fclose(disk);	
+static int test_dedup(void)	//with -o dedup a copy of a file shares its blocks, and writing to or removing one of them leaves the other as it was, before and after a remount
+{
+	char *data = malloc(TEST_FILE_BYTES);
+	char *changed = malloc(TEST_FILE_BYTES);	//what /d/a.dat holds after the overwrite
+	thread_stats *stats = malloc(sizeof(thread_stats));
+	int res;
 
-		directory_entry.files[index].fsize = size;
-		write_directory_entry( directory_entry, attribute.index_of_directory);
+	if( data == NULL || changed == NULL || stats == NULL )
+	{
+		free(data);
+		free(changed);
+		free(stats);
+		return test_fail("no memory for the files", NULL);
 	}
+	config.dedup = 1;
+	config.compress = 0;	//a compressed chunk is not shared
+	test_fill(data, TEST_FILE_BYTES, 4);
+	memcpy(changed, data, TEST_FILE_BYTES);
+	memset(changed + BLOCK_SIZE / 2, 'Z', 3 * BLOCK_SIZE);	//test_fill() never writes it
 
-	else if( offset <= directory_entry.files[index].fsize )	//append the file
+	res = test_mount() || hello_oper.mkdir("/d", 0755) != 0 || test_write("/d/a.dat", data, TEST_FILE_BYTES, 0) || test_write("/d/b.dat", data, TEST_FILE_BYTES, 0);
+	if( res == 0 )
+	{
+		total_stats(stats);
+		res = stats->counters[ COUNT_BLOCKS_DEDUPED ] < TEST_FILE_BYTES / BLOCK_SIZE ? test_fail("not every block was shared with", "/d/b.dat") : 0;
+	}
+	if( res == 0 )	//the blocks written to are copied first
+	{
+		res = test_write("/d/a.dat", changed + BLOCK_SIZE / 2, 3 * BLOCK_SIZE, BLOCK_SIZE / 2) || test_matches("/d/a.dat", changed, TEST_FILE_BYTES) || test_matches("/d/b.dat", data, TEST_FILE_BYTES);
+	}
+	if( res == 0 )
+	{
+		hello_oper.destroy(NULL);
+		res = test_mount() || test_matches("/d/a.dat", changed, TEST_FILE_BYTES) || test_matches("/d/b.dat", data, TEST_FILE_BYTES);
+	}
+	if( res == 0 )	//the blocks still shared stay with the other file
 	{
-		//hopefully how many writes is only 1 becuase it will be poor performance otherwise 
-		int how_many_writes = (offset - directory_entry.files[index].fsize) / 512 + 1;	//how many times to copy
-		int count = 0;
-		FILE *disk;
-		cs1550_disk_block block;
+		res = hello_oper.unlink("/d/a.dat") != 0 ? test_fail("could not remove", "/d/a.dat") : test_matches("/d/b.dat", data, TEST_FILE_BYTES);
+	}
+	hello_oper.destroy(NULL);
+
+	free(data);
+	free(changed);
+	free(stats);
+	return res;
+}
+
+static int test_io(void)	//run_batch() reads back what it wrote with a batch bigger than the io_uring, of requests with two buffers each that go to the file in reverse order, and fails a read past its end, through the ring unless -o io_depth=0 is given
+{
+	io_request requests[TEST_IO_REQUESTS];
+	struct iovec vectors[TEST_IO_REQUESTS][2];
+	size_t size = TEST_IO_REQUESTS * 2 * BLOCK_SIZE;	//two blocks a request
+	char *data = malloc(size);
+	char *back = calloc(1, size);
+	thread_stats *stats = malloc(sizeof(thread_stats));
+	int fd = open("io.dat", O_RDWR | O_CREAT | O_TRUNC, 0644);
+	char *buffer;
+	int writing;
+	int index;
+	int res = data == NULL || back == NULL || stats == NULL || fd == -1 ? test_fail("could not make", "io.dat") : 0;
 
-		FILE *directory_list;	//to edit and sent directory
-		cs1550_directory_entry directory = get_directory_entry( attribute.index_of_directory );	//get directory
-		while(count < how_many_writes)
+	start_io(config.io_depth < 8 ? config.io_depth : 8);	//a ring that takes the batch in pieces
+	if( res == 0 )
+	{
+		test_fill(data, size, 6);
+	}
+	for(writing = 1; res == 0 && writing >= 0; writing--)
+	{
+		for(index = 0; index < TEST_IO_REQUESTS; index++)	//the first half block in one buffer and the rest in the other
 		{
-			move_file( directory, index);
-			disk = fopen(".disk", "r+b");
-			strncpy(block.data, buf + count * 512, 512);	//copies up to \0 or 512 bytes
-			
-			fwrite(&block.data, sizeof(char), sizeof(block.data), disk);	//write the new data
-			count++;
-			directory.files[index].fsize = directory_entry.files[index].fsize + 512;	//update size
-			fclose(disk);
+			buffer = (writing ? data : back) + index * 2 * BLOCK_SIZE;
+			vectors[ index ][ 0 ].iov_base = buffer;
+			vectors[ index ][ 0 ].iov_len = BLOCK_SIZE / 2;
+			vectors[ index ][ 1 ].iov_base = buffer + BLOCK_SIZE / 2;
+			vectors[ index ][ 1 ].iov_len = 3 * BLOCK_SIZE / 2;
+			set_request(&requests[ index ], fd, vectors[ index ], 2, (off_t) (TEST_IO_REQUESTS - 1 - index) * 2 * BLOCK_SIZE, writing);
+		}
+		if( run_batch(requests, TEST_IO_REQUESTS) != 0 )
+		{
+			res = test_fail(writing ? "a batch could not write" : "a batch could not read", "io.dat");
 		}
-		directory_list = fopen(".directories", "r+b");	
-		fseek(directory_list, index * sizeof(directory_entry), SEEK_SET );	//seek to correct direcotry entry
-		fwrite(&directory_entry, sizeof(directory_entry), 1, directory_list);	//rewrite the struct				
-		fclose(directory_list);
+	}
+	if( res == 0 && memcmp(data, back, size) != 0 )
+	{
+		res = test_fail("a batch read back the wrong data from", "io.dat");
 	}
 
-	else
+	if( res == 0 )	//the second request starts where the file ends
 	{
-		size = -EFBIG;		
+		vectors[ 0 ][ 0 ].iov_base = back;
+		vectors[ 0 ][ 0 ].iov_len = BLOCK_SIZE;
+		vectors[ 1 ][ 0 ].iov_base = back + BLOCK_SIZE;
+		vectors[ 1 ][ 0 ].iov_len = BLOCK_SIZE;
+		set_request(&requests[ 0 ], fd, vectors[ 0 ], 1, 0, 0);
+		set_request(&requests[ 1 ], fd, vectors[ 1 ], 1, size, 0);
+		res = run_batch(requests, 2) != -EIO || requests[ 0 ].res != 0 ? test_fail("a batch read past the end of", "io.dat") : 0;
+	}
+	if( res == 0 && io_depth > 0 )
+	{
+		total_stats(stats);
+		res = stats->counters[ COUNT_IO_BATCHES ] == 0 ? test_fail("no batch went through the io_uring", NULL) : 0;
 	}
-	//set size (should be same as input) and return, or error
 
-	return size;
+	if( fd != -1 )
+	{
+		close(fd);
+		unlink("io.dat");
+	}
+	free(data);
+	free(back);
+	free(stats);
+	return res;
 }
 
-/******************************************************************************
- *
- *  DO NOT MODIFY ANYTHING BELOW THIS LINE
- *
- *****************************************************************************/
-
-/*
- * truncate is called when a new file is created (with a 0 size) or when an
- * existing file is made shorter. We're not handling deleting files or 
- * truncating existing ones, so all we need to do here is to initialize
- * the appropriate directory entry.
- *
- */
-static int cs1550_truncate(const char *path, off_t size)
+static const test_check test_checks[] =	//what test runs, in order
 {
-	(void) path;
-	(void) size;
-
-    return 0;
-}
-
+	{ "codec", test_codec },
+	{ "compress", test_compress },
+	{ "journal", test_journal },
+	{ "truncate", test_truncate },
+	{ "dedup", test_dedup },
+	{ "io", test_io },
+};
 
-/* 
- * Called when we open a file
- *
- */
-static int cs1550_open(const char *path, struct fuse_file_info *fi)
+static int test_run(const test_check *check)	//runs check in a child of its own on a fresh .disk in the current directory, so nothing one check leaves behind, mounted or not, reaches the next, prints whether it passed, returns 0 or 1
 {
-	(void) path;
-	(void) fi;
-    /*
-        //if we can't find the desired file, return an error
-        return -ENOENT;
-    */
-
-    //It's not really necessary for this project to anything in open
-
-    /* We're not going to worry about permissions for this project, but 
-	   if we were and we don't have them to the file we should return an error
+	pid_t child;
+	int status = -1;
 
-        return -EACCES;
-    */
+	fflush(stdout);
+	fflush(stderr);
+	child = fork();
+	if( child == 0 )
+	{
+		_exit(mkfs(TEST_DISK_SIZE, 1) != 0 || check->run() != 0);
+	}
+	if( child == -1 || waitpid(child, &status, 0) != child )
+	{
+		perror("test");
+	}
 
-    return 0; //success!
+	printf("%s %s\n", WIFEXITED(status) && WEXITSTATUS(status) == 0 ? "ok" : "FAIL", check->name);
+	clear_scratch();
+	return !WIFEXITED(status) || WEXITSTATUS(status) != 0;
 }
 
-/*
- * Called when close is called on a file descriptor, but because it might
- * have been dup'ed, this isn't a guarantee we won't ever need the file 
- * again. For us, return success simply to avoid the unimplemented error
- * in the debug log.
- */
-static int cs1550_flush (const char *path , struct fuse_file_info *fi)
+static int test(void)	//runs every check of test_checks in a new directory under TMPDIR with the -o options given, one line per check, the directory is removed after, returns 0 if they all passed or 1
 {
-	(void) path;
-	(void) fi;
+	char directory[4096];
+	unsigned int check;
+	int failed = 0;
 
-	return 0; //success!
+	if( enter_scratch(directory, sizeof(directory), "test") != 0 )
+	{
+		return 1;
+	}
+	for(check = 0; check < sizeof(test_checks) / sizeof(test_checks[0]); check++)
+	{
+		failed |= test_run(&test_checks[ check ]);
+	}
+	leave_scratch(directory, "test");
+	return failed;
 }
 
-
-//register our new functions as the implementations of the syscalls
-static struct fuse_operations hello_oper = {
-    .getattr	= cs1550_getattr,
-    .readdir	= cs1550_readdir,
-    .mkdir	= cs1550_mkdir,
-	.rmdir = cs1550_rmdir,
-    .read	= cs1550_read,
-    .write	= cs1550_write,
-	.mknod	= cs1550_mknod,
-	.unlink = cs1550_unlink,
-	.truncate = cs1550_truncate,
-	.flush = cs1550_flush,
-	.open	= cs1550_open,
-};
+/******************************************************************************
+ *
+ *  DO NOT MODIFY ANYTHING BELOW THIS LINE
+ *
+ *  The handlers, hello_oper and the mkfs, bench and test modes all live above it,
+ *  main() only picks which of them runs.
+ *
+ *****************************************************************************/
 
 //Don't change this.
 int main(int argc, char *argv[])
 {
-	return fuse_main(argc, argv, &hello_oper, NULL);
+	struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+	int res;
+
+	if( argc >= 2 && strcmp(argv[1], "mkfs") == 0 )	//formats .disk instead of mounting it
+	{
+		if( argc != 3 )
+		{
+			fprintf(stderr, "usage: %s mkfs SIZE\n", argv[0]);
+			return 1;
+		}
+		return mkfs(argv[2], 0);
+	}
+
+	config.cache_blocks = CACHE_DEFAULT_BLOCKS;
+	config.readahead_blocks = READAHEAD_DEFAULT_BLOCKS;
+	config.delalloc_bytes = DELALLOC_DEFAULT_BYTES;
+	config.inline_bytes = INLINE_BYTES;
+	config.io_depth = IO_DEFAULT_DEPTH;
+
+	if( fuse_opt_parse(&args, &config, cs1550_opts, NULL) == -1 )	//takes out our own -o options and leaves the rest for fuse
+	{
+		return 1;
+	}
+	if( config.inline_bytes > INLINE_BYTES )	//no more fits in an inode
+	{
+		config.inline_bytes = INLINE_BYTES;
+	}
+	if( config.io_depth > IO_MAX_DEPTH )
+	{
+		config.io_depth = IO_MAX_DEPTH;
+	}
+
+	if( args.argc >= 2 && strcmp(args.argv[1], "bench") == 0 )	//times the handlers on a scratch .disk instead of mounting, with the -o options given
+	{
+		res = bench(args.argc >= 3 ? args.argv[2] : NULL);
+	}
+	else if( args.argc >= 2 && strcmp(args.argv[1], "test") == 0 )	//checks the parts of the file system that are easy to get subtly wrong, on scratch .disks, with the -o options given
+	{
+		res = test();
+	}
+	else if( config.lowlevel )
+	{
+		res = lowlevel_main(&args);
+	}
+	else
+	{
+		res = fuse_main(args.argc, args.argv, &hello_oper, NULL);
+	}
+	fuse_opt_free_args(&args);
+
+	return res;
 }